@@ -48,6 +48,32 @@ sipi = {
     --
     nthreads = 8,
 
+    --
+    -- Number of threads used to decode or encode one JPEG2000 image (0 = number of cores)
+    --
+    kakadu_threads = 4,
+
+    --
+    -- Library used to decode JPEG2000 images: "kakadu" or "openjpeg" (only if built with -DSIPI_OPENJPEG=ON).
+    -- The number of threads per image is given by kakadu_threads.
+    --
+    j2k_decoder = "kakadu",
+
+    --
+    -- Small images are decoded from the first quality layers of JPEG2000 files only. Comma separated
+    -- list of "<longest edge>:<percentage>" entries, e.g. "256:25,1024:50" decodes 25% of the layers
+    -- for output images up to 256 pixels and 50% up to 1024 pixels. Lower percentages are acceptable
+    -- for a lower jpeg_quality. Empty to always decode all layers.
+    --
+    j2k_layers = "",
+
+    --
+    -- If true, small images of a whole JPEG file are scaled from the EXIF thumbnail embedded in the
+    -- file if it is not smaller than the output, e.g. for thumbnails in collection grid views. Only
+    -- enable this if the embedded thumbnails are known to match the images.
+    --
+    embedded_thumbnails = false,
+
     --
     -- SIPI is using libjpeg to generate the JPEG images. libjpeg requires a quality value which
     -- corresponds to the compression rate. 100 is (almost) no compression and best quality, 0
@@ -55,6 +81,28 @@ sipi = {
     --
     jpeg_quality = 60,
 
+    --
+    -- Quality of lossy WebP output between 0 and 100, and whether WebP output is lossless.
+    --
+    webp_quality = 80,
+    webp_lossless = false,
+
+    --
+    -- JPEG encoding profile by the size of the output image. Comma separated list of
+    -- "<longest edge>:<profile>" entries with the profiles "baseline", "optimized", "progressive"
+    -- or "tile" (baseline without ICC/XMP/EXIF/IPTC payloads for sRGB images), e.g.
+    -- "512:tile,2048:optimized". Larger images and all images if empty are progressive.
+    --
+    jpeg_profiles = "",
+
+    --
+    -- PNG encoding preset by the size of the output image. Comma separated list of
+    -- "<longest edge>:<preset>" entries with the presets "fast" (sub filter, level 1), "balanced"
+    -- (adaptive filters, level 6) and "small" (adaptive filters, level 9, one thread), e.g.
+    -- "512:fast,4096:balanced". Larger images and all images if empty are "balanced".
+    --
+    png_profiles = "",
+
     --
     -- For scaling images, SIPI offers two methods. The value "high" offers best quality using expensive
     -- algorithms (bilinear interpolation, if downscaling the image is first scaled up to an integer
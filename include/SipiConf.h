@@ -52,6 +52,8 @@ namespace Sipi {
         std::vector<std::string> subdir_excludes;
         bool prefix_as_path; //<! Use IIIF-prefix as part of path or ignore it...
         int jpeg_quality;
+        int webp_quality;
+        bool webp_lossless;
         std::map<std::string,std::string> scaling_quality;
         std::string init_script;
         std::string cache_dir;
@@ -61,6 +63,12 @@ namespace Sipi {
         std::string thumb_size;
         int cache_n_files;
         int n_threads;
+        int kakadu_threads;
+        std::string j2k_decoder;
+        std::string j2k_layers;
+        bool embedded_thumbnails;
+        std::string jpeg_profiles;
+        std::string png_profiles;
         size_t max_post_size;
         std::string tmp_dir;
         std::string scriptdir;
@@ -114,6 +122,12 @@ namespace Sipi {
         inline int getJpegQuality(void) { return jpeg_quality; }
         inline void setJpegQuality(int i) { jpeg_quality = i; }
 
+        inline int getWebpQuality(void) { return webp_quality; }
+        inline void setWebpQuality(int i) { webp_quality = i; }
+
+        inline bool getWebpLossless(void) { return webp_lossless; }
+        inline void setWebpLossless(bool b) { webp_lossless = b; }
+
         inline std::map<std::string,std::string> getScalingQuality(void) { return scaling_quality; }
         void inline setScalingQuality(const std::map<std::string,std::string> &v) { scaling_quality = v; }
 
@@ -147,6 +161,24 @@ namespace Sipi {
         inline int getNThreads(void) { return n_threads; }
         inline void setNThreads(int i) { n_threads = i; }
 
+        inline int getKakaduThreads(void) { return kakadu_threads; }
+        inline void setKakaduThreads(int i) { kakadu_threads = i; }
+
+        inline std::string getJ2kDecoder(void) { return j2k_decoder; }
+        inline void setJ2kDecoder(const std::string &str) { j2k_decoder = str; }
+
+        inline std::string getJ2kLayers(void) { return j2k_layers; }
+        inline void setJ2kLayers(const std::string &str) { j2k_layers = str; }
+
+        inline bool getEmbeddedThumbnails(void) { return embedded_thumbnails; }
+        inline void setEmbeddedThumbnails(bool b) { embedded_thumbnails = b; }
+
+        inline std::string getJpegProfiles(void) { return jpeg_profiles; }
+        inline void setJpegProfiles(const std::string &str) { jpeg_profiles = str; }
+
+        inline std::string getPngProfiles(void) { return png_profiles; }
+        inline void setPngProfiles(const std::string &str) { png_profiles = str; }
+
         inline size_t getMaxPostSize(void) { return max_post_size; }
         inline void setMaxPostSize(size_t i) { max_post_size = i; }
 
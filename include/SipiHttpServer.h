@@ -65,6 +65,8 @@ namespace Sipi {
         std::string _logfile;
         std::shared_ptr<SipiCache> _cache;
         int _jpeg_quality;
+        int _webp_quality;
+        bool _webp_lossless;
         std::unordered_map<std::string,SipiCompressionParams> _j2k_compression_profiles;
         ScalingQuality _scaling_quality;
 
@@ -113,6 +115,14 @@ namespace Sipi {
 
         inline int jpeg_quality(void) { return _jpeg_quality; }
 
+        inline void webp_quality(int webp_quality_p) { _webp_quality = webp_quality_p; }
+
+        inline int webp_quality(void) { return _webp_quality; }
+
+        inline void webp_lossless(bool webp_lossless_p) { _webp_lossless = webp_lossless_p; }
+
+        inline bool webp_lossless(void) { return _webp_lossless; }
+
 
         inline void scaling_quality(std::map<std::string,std::string> jpeg_quality_p) {
             if (jpeg_quality_p["jpk"] == "high") {
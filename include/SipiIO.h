@@ -76,6 +76,7 @@ namespace Sipi {
 
     enum {
         JPEG_QUALITY,
+        JPEG_profile,       //!< "baseline", "optimized", "progressive" or "tile" (baseline without payloads for sRGB)
         J2K_Sprofile,
         J2K_Creversible,
         J2K_Clayers,
@@ -85,7 +86,21 @@ namespace Sipi {
         J2K_Cblk,
         J2K_Cuse_sop,
         J2K_Stiles,
-        J2K_rates
+        J2K_rates,
+        J2K_Cmodes,         //!< Block coder modes in Kakadu syntax, e.g. "HT" for High-Throughput JPEG 2000 (Part 15)
+        J2K_ORGgen_plt,     //!< "yes" to write packet length (PLT) markers
+        J2K_ORGgen_tlm,     //!< maximum number of tile-parts per tile, > 0 writes tile-part length (TLM) markers
+        J2K_ORGtparts,      //!< tile-part boundaries in Kakadu syntax, e.g. "R" for one tile-part per resolution
+        J2K_preset,         //!< "deepzoom": 256x256 precincts, RPCL order, PLT and TLM markers for IIIF tile serving
+        TIFF_compression,   //!< "none", "deflate", "lzw", "zstd" or "jpeg"
+        TIFF_predictor,     //!< "none" or "horizontal" (default for deflate, lzw and zstd)
+        TIFF_tile,          //!< edge length of the (square) tiles, must be a multiple of 16
+        TIFF_pyramid,       //!< "yes" to add reduced resolutions as SubIFDs
+        PNG_filter,         //!< "none", "sub", "up", "average", "paeth" or "adaptive"
+        PNG_level,          //!< zlib compression level, 0 to 9
+        PNG_parallel,       //!< "yes" to deflate bands of rows in parallel
+        WEBP_quality,       //!< quality of lossy WebP compression, 0 to 100
+        WEBP_lossless       //!< "yes" for lossless WebP compression
     } SipiCompressionParamName;
     typedef std::unordered_map<int, std::string> SipiCompressionParams;
 
@@ -113,6 +128,21 @@ namespace Sipi {
                           std::shared_ptr<SipiSize> size, bool force_bps_8,
                           ScalingQuality scaling_quality) = 0;
 
+        /*!
+         * Method used to read an image file whose pixels are decoded strip by strip while
+         * the image is being written. Formats which cannot decode incrementally read the
+         * whole image (the default).
+         *
+         * \param *img Pointer to SipiImage instance
+         * \param filepath Image file path
+         * \param force_bps_8 Convert the file to 8 bits/sample on reading thus enforcing an 8 bit image
+         */
+        virtual bool readStrips(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                                std::shared_ptr<SipiSize> size, bool force_bps_8,
+                                ScalingQuality scaling_quality) {
+            return read(img, filepath, pagenum, region, size, force_bps_8, scaling_quality);
+        }
+
         /*!
          * Get the dimension of the image
          *
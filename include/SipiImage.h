@@ -88,6 +88,30 @@ namespace Sipi {
         SKIP_NONE = 0x00, SKIP_ICC = 0x01, SKIP_XMP = 0x02, SKIP_IPTC = 0x04, SKIP_EXIF = 0x08, SKIP_ALL = 0xFF
     } SkipMetadata;
 
+    /*!
+     * Delivers the pixels of an image strip by strip. A reader which can decode an image
+     * incrementally attaches a strip source to the image instead of filling the pixel buffer.
+     * The JPEG and PNG writers pull the strips directly into the encoder, all other operations
+     * load the remaining strips into the pixel buffer first (see SipiImage::loadStrips).
+     */
+    class SipiStripSource {
+    public:
+        virtual ~SipiStripSource() {};
+
+        /*!
+         * Maximal number of rows delivered by one call to pull()
+         */
+        virtual size_t stripHeight() = 0;
+
+        /*!
+         * Decodes the next strip
+         *
+         * \param[out] buf Buffer for at least stripHeight() rows, the rows are written without padding
+         * \returns Number of rows written to buf, 0 if all rows have been delivered
+         */
+        virtual size_t pull(byte *buf) = 0;
+    };
+
     enum InfoError { INFO_ERROR };
 
     /*!
@@ -167,10 +191,11 @@ class SipiImageError : public std::exception {
         friend class SipiIcc;       //!< We need SipiIcc as friend class
         friend class SipiIOTiff;    //!< I/O class for the TIFF file format
         friend class SipiIOJ2k;     //!< I/O class for the JPEG2000 file format
-        //friend class SipiIOOpenJ2k; //!< I/O class for the JPEG2000 file format
+        friend class SipiIOOpenJ2k; //!< I/O class for the JPEG2000 file format (OpenJPEG)
         friend class SipiIOJpeg;    //!< I/O class for the JPEG file format
         friend class SipiIOPng;     //!< I/O class for the PNG file format
         friend class SipiIOPdf;     //!< I/O class for the PDF file format
+        friend class SipiIOWebp;    //!< I/O class for the WebP file format
     private:
         static std::unordered_map<std::string, std::shared_ptr<SipiIO> > io; //!< member variable holding a map of I/O class instances for the different file formats
         byte bilinn(byte buf[], register int nx, register float x, register float y, register int c, register int n);
@@ -187,6 +212,7 @@ class SipiImageError : public std::exception {
         std::vector<ExtraSamples> es; //!< meaning of extra samples
         PhotometricInterpretation photo;    //!< Image type, that is the meaning of the channels
         byte *pixels;   //!< Pointer to block of memory holding the pixels
+        std::shared_ptr<SipiStripSource> strips; //!< If not null, the pixels have not been decoded yet
         std::shared_ptr<SipiXmp> xmp;   //!< Pointer to instance SipiXmp class (\ref SipiXmp), or NULL
         std::shared_ptr<SipiIcc> icc;   //!< Pointer to instance of SipiIcc class (\ref SipiIcc), or NULL
         std::shared_ptr<SipiIptc> iptc; //!< Pointer to instance of SipiIptc class (\ref SipiIptc), or NULL
@@ -203,9 +229,12 @@ class SipiImageError : public std::exception {
         SipiImage();
 
         /*!
-         * Copy constructor. Makes a deep copy of the image
+         * Copy constructor. Makes a deep copy of the image. The strips are not copied, since a strip
+         * source delivers its rows only once: the image to be copied must have been decoded completely.
          *
          * \param[in] img_p An existing instance if SipiImage
+         *
+         * \throws SipiImageError if img_p has undecoded strips (see loadStrips)
          */
         SipiImage(const SipiImage &img_p);
 
@@ -220,6 +249,15 @@ class SipiImageError : public std::exception {
          */
         SipiImage(size_t nx_p, size_t ny_p, size_t nc_p, size_t bps_p, PhotometricInterpretation photo_p);
 
+        /*!
+         * Replaces the I/O class of a file format, e.g. to decode JPEG2000 with OpenJPEG instead of
+         * Kakadu. Must be called before any image is read or written.
+         *
+         * \param[in] ftype File format ("tif", "jpx", "jpg", "png" or "pdf")
+         * \param[in] handler The I/O class instance
+         */
+        static void setIO(const std::string &ftype, std::shared_ptr<SipiIO> handler);
+
         /*!
          * Checks if the actual mimetype of an image file corresponds to the indicated mimetype and the extension of the filename.
          * This function is used to check if information submitted with a file are actually valid.
@@ -256,6 +294,11 @@ class SipiImageError : public std::exception {
          */
         inline size_t getBps() { return bps; }
 
+        /*!
+         * Getter for the pixel data (samples interleaved, row by row)
+         */
+        inline const byte *getPixels() { return pixels; }
+
         /*! Destructor
          *
          * Destroys the image and frees all the resources associated with it
@@ -297,9 +340,12 @@ class SipiImageError : public std::exception {
         /*!
          * Assignment operator
          *
-         * Makes a deep copy of the instance
+         * Makes a deep copy of the instance. As with the copy constructor, img_p must have been decoded
+         * completely. Undecoded strips of this image are dropped.
          *
          * \param[in] img_p Instance of a SipiImage
+         *
+         * \throws SipiImageError if img_p has undecoded strips (see loadStrips)
          */
         SipiImage &operator=(const SipiImage &img_p);
 
@@ -344,6 +390,32 @@ class SipiImageError : public std::exception {
                   std::shared_ptr<SipiSize> size = nullptr, bool force_bps_8 = false,
                   ScalingQuality scaling_quality = {HIGH, HIGH, HIGH, HIGH});
 
+        /*!
+         * Read an image from the given path, decoding the pixels only when they are written.
+         * If the file format and the request allow it (currently JPEG2000 images which need
+         * no scaling besides a reduce), only the header is read and the pixels are decoded
+         * strip by strip by the JPEG or PNG writer, so that the full image is never held in memory.
+         * Such an image can be written to JPEG or PNG only once, since the strips are not kept.
+         * Otherwise the image is read as with read().
+         *
+         * \param[in] filepath A string containing the path to the image file
+         * \param[in] region Pointer to a SipiRegion which indicates that we
+         *            are only interested in this region. The image will be cropped.
+         * \param[in] size Pointer to a size object. The image will be scaled accordingly
+         * \param[in] force_bps_8 We want in any case a 8 Bit/sample image. Reduce if necessary
+         *
+         * \throws SipiError
+         */
+        void readStrips(std::string filepath, int pagenum = 0, std::shared_ptr<SipiRegion> region = nullptr,
+                        std::shared_ptr<SipiSize> size = nullptr, bool force_bps_8 = false,
+                        ScalingQuality scaling_quality = {HIGH, HIGH, HIGH, HIGH});
+
+        /*!
+         * Decodes the strips not yet delivered into the pixel buffer. Does nothing if
+         * the image has been read completely.
+         */
+        void loadStrips(void);
+
         /*!
          * Read an image that is to be considered an "original image". In this case
          * a SipiEssentials object is created containing the original name, the
@@ -567,6 +639,15 @@ class SipiImageError : public std::exception {
 
         SipiImage &operator+(const SipiImage &rhs);
 
+        /*!
+         * Compares the dimensions, the number of channels, the bits per sample, the photometric
+         * interpretation and all samples of the pixel buffers. Metadata (ICC profile, EXIF, XMP, IPTC,
+         * essentials) and the extra samples are not compared.
+         *
+         * \param[in] rhs Image to compare with
+         *
+         * \throws SipiImageError if one of the images has undecoded strips (see loadStrips)
+         */
         bool operator==(const SipiImage &rhs);
 
         /*!
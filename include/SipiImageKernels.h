@@ -0,0 +1,567 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*!
+ * Pixel kernels used by SipiImage. Each kernel is a class template specialized on the sample
+ * type (unsigned char for 8 bit, unsigned short for 16 bit) and on the number of channels.
+ * For the common cases (1, 3 and 4 channels) the channel count is a compile time constant, thus
+ * the compiler is able to unroll and vectorize the innermost loop. All other channel counts
+ * use the generic instantiation with NC = 0, where the channel count is given at runtime.
+ *
+ * The kernels operate on raw pixel buffers and are selected with \ref dispatch_kernel.
+ */
+#ifndef __sipi_image_kernels_h
+#define __sipi_image_kernels_h
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <system_error>
+
+namespace Sipi {
+
+    /*!
+     * Properties of the sample types supported by Sipi
+     */
+    template<typename T>
+    struct SampleTraits;
+
+    template<>
+    struct SampleTraits<unsigned char> {
+        typedef int accu_t;                     //!< integer type large enough for 16 bit fixed point arithmetic
+        static constexpr int maxval = 255;      //!< largest sample value
+        static constexpr int midval = 0x80;     //!< zero point of signed chroma values
+    };
+
+    template<>
+    struct SampleTraits<unsigned short> {
+        typedef long long accu_t;               //!< integer type large enough for 16 bit fixed point arithmetic
+        static constexpr int maxval = 65535;    //!< largest sample value
+        static constexpr int midval = 0x8000;   //!< zero point of signed chroma values
+    };
+
+    /*!
+     * Calls Kernel<T, NC>::run for the given number of channels. The specializations for 1, 3 and 4
+     * channels have the channel count as compile time constant, all other values use NC = 0.
+     *
+     * \param[in] nc Number of channels of the image
+     * \param[in] args Arguments that are passed to the kernel (after nc)
+     */
+    template<template<typename, size_t> class Kernel, typename T, typename... Args>
+    inline void dispatch_channels(size_t nc, Args... args) {
+        switch (nc) {
+            case 1: Kernel<T, 1>::run(nc, args...); break;
+            case 3: Kernel<T, 3>::run(nc, args...); break;
+            case 4: Kernel<T, 4>::run(nc, args...); break;
+            default: Kernel<T, 0>::run(nc, args...);
+        }
+    }
+
+    /*!
+     * Selects the kernel implementation for the given bits/sample and number of channels.
+     *
+     * \param[in] bps Bits per sample, either 8 or 16
+     * \param[in] nc Number of channels of the image
+     * \param[in] args Arguments that are passed to the kernel (after nc)
+     * \returns false if the bits/sample are not supported
+     */
+    template<template<typename, size_t> class Kernel, typename... Args>
+    inline bool dispatch_kernel(size_t bps, size_t nc, Args... args) {
+        switch (bps) {
+            case 8: dispatch_channels<Kernel, unsigned char>(nc, args...); return true;
+            case 16: dispatch_channels<Kernel, unsigned short>(nc, args...); return true;
+            default: return false;
+        }
+    }
+
+    /*!
+     * Minimal number of pixels a strip must have to be processed by its own thread. Smaller images
+     * (e.g. IIIF tiles) are processed by the calling thread only.
+     */
+    const size_t min_strip_pixels = 256 * 1024;
+
+    /*!
+     * Number of worker threads of \ref parallel_strips running in the whole process. Concurrent requests
+     * share this budget, thus there are never more workers than cores, however many images are processed.
+     */
+    inline std::atomic<size_t> &strip_workers() {
+        static std::atomic<size_t> count(0);
+        return count;
+    }
+
+    /*!
+     * Reserves up to the given number of worker threads from the process wide budget.
+     *
+     * \param[in] wanted Number of worker threads wanted
+     * \returns Number of worker threads granted (may be 0). They must be given back with \ref release_strip_workers
+     */
+    inline size_t acquire_strip_workers(size_t wanted) {
+        const size_t max_workers = std::thread::hardware_concurrency();
+        std::atomic<size_t> &count = strip_workers();
+        size_t current = count.load();
+        size_t granted;
+        do {
+            granted = (current < max_workers) ? std::min(wanted, max_workers - current) : 0;
+            if (granted == 0) return 0;
+        } while (!count.compare_exchange_weak(current, current + granted));
+        return granted;
+    }
+
+    inline void release_strip_workers(size_t n) {
+        strip_workers() -= n;
+    }
+
+    /*!
+     * Splits the rows of an image into horizontal strips and calls func(first_row, end_row) for each strip
+     * in parallel. One strip is processed by the calling thread. The worker threads are taken from a process
+     * wide budget (see \ref acquire_strip_workers); if none is left or no thread can be started, the strips
+     * are processed by the calling thread.
+     *
+     * An exception thrown by func is rethrown in the calling thread after all strips have been processed.
+     *
+     * \param[in] nrows Number of rows of the image
+     * \param[in] rowpixels Number of pixels per row
+     * \param[in] func Function to be called for each strip
+     */
+    template<typename Func>
+    inline void parallel_strips(size_t nrows, size_t rowpixels, Func func) {
+        size_t nstrips = std::thread::hardware_concurrency();
+        size_t max_strips = (nrows * rowpixels) / min_strip_pixels;
+        if (nstrips > max_strips) nstrips = max_strips;
+        if (nstrips > nrows) nstrips = nrows;
+        size_t nworkers = (nstrips < 2) ? 0 : acquire_strip_workers(nstrips - 1);
+        if (nworkers == 0) {
+            func((size_t) 0, nrows);
+            return;
+        }
+        nstrips = nworkers + 1;
+
+        size_t strip_rows = (nrows + nstrips - 1) / nstrips;
+        std::vector<std::exception_ptr> errors(nstrips);
+        auto run_strip = [&func, &errors](size_t strip, size_t first, size_t end) {
+            try {
+                func(first, end);
+            } catch (...) {
+                errors[strip] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        workers.reserve(nworkers);
+        size_t strip = 1;
+        for (size_t first = strip_rows; first < nrows; first += strip_rows, strip++) {
+            size_t end = std::min(first + strip_rows, nrows);
+            try {
+                workers.push_back(std::thread(run_strip, strip, first, end));
+            } catch (const std::system_error &err) {
+                run_strip(strip, first, end);
+            }
+        }
+        run_strip(0, 0, std::min(strip_rows, nrows));
+        for (auto &worker : workers) worker.join();
+        release_strip_workers(nworkers);
+        for (auto &error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    /*!
+     * Bilinear interpolation of all channels of one pixel. The weights are calculated only once
+     * per pixel and then applied to all channels.
+     *
+     * \param[in] buf Pixel buffer
+     * \param[in] nx Width of the pixel buffer
+     * \param[in] n Number of channels
+     * \param[in] x Horizontal position (must be within [0, nx - 1])
+     * \param[in] y Vertical position (must be within [0, ny - 1])
+     * \param[out] dst Destination of the n interpolated samples
+     */
+    template<typename T, size_t NC>
+    inline void bilinear_sample(const T *buf, size_t nx, size_t nc, float x, float y, T *dst) {
+        const size_t n = (NC > 0) ? NC : nc;
+        size_t ix = (size_t) x;
+        size_t iy = (size_t) y;
+        float rx = x - (float) ix;
+        float ry = y - (float) iy;
+        const T *p00 = buf + n * (iy * nx + ix);
+
+        if ((rx < 1.0e-2) && (ry < 1.0e-2)) {
+            for (size_t k = 0; k < n; k++) dst[k] = p00[k];
+        } else if (rx < 1.0e-2) {
+            const T *p01 = p00 + n * nx;
+            const float w00 = 1 - rx - ry + rx * ry;
+            const float w01 = ry - rx * ry;
+            for (size_t k = 0; k < n; k++) {
+                dst[k] = (T) (((float) p00[k] * w00 + (float) p01[k] * w01) + 0.5);
+            }
+        } else if (ry < 1.0e-2) {
+            const T *p10 = p00 + n;
+            const float w00 = 1 - rx - ry + rx * ry;
+            const float w10 = rx - rx * ry;
+            for (size_t k = 0; k < n; k++) {
+                dst[k] = (T) (((float) p00[k] * w00 + (float) p10[k] * w10) + 0.5);
+            }
+        } else {
+            const T *p10 = p00 + n;
+            const T *p01 = p00 + n * nx;
+            const T *p11 = p01 + n;
+            const float w00 = 1 - rx - ry + rx * ry;
+            const float w10 = rx - rx * ry;
+            const float w01 = ry - rx * ry;
+            for (size_t k = 0; k < n; k++) {
+                // keep the evaluation order of the last term, (p11 * rx) * ry, to get identical results
+                dst[k] = (T) (((float) p00[k] * w00 + (float) p10[k] * w10 +
+                               (float) p01[k] * w01 + (float) p11[k] * rx * ry) + 0.5);
+            }
+        }
+    }
+
+    /*!
+     * Nearest neighbour resampling using precalculated lookup tables
+     */
+    template<typename T, size_t NC>
+    struct ScaleFastKernel {
+        static void run(size_t nc, const unsigned char *inbuf, size_t nx, unsigned char *outbuf, size_t nnx,
+                        size_t nny, const size_t *xlut, const size_t *ylut) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+
+            for (size_t y = 0; y < nny; y++) {
+                const T *inrow = in + n * ylut[y] * nx;
+                T *outrow = out + n * y * nnx;
+                for (size_t x = 0; x < nnx; x++) {
+                    const T *src = inrow + n * xlut[x];
+                    T *dst = outrow + n * x;
+                    for (size_t k = 0; k < n; k++) dst[k] = src[k];
+                }
+            }
+        }
+    };
+
+    /*!
+     * Bilinear resampling using precalculated lookup tables of the (fractional) source positions
+     */
+    template<typename T, size_t NC>
+    struct BilinearKernel {
+        static void run(size_t nc, const unsigned char *inbuf, size_t nx, unsigned char *outbuf, size_t nnx,
+                        size_t nny, const float *xlut, const float *ylut) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+
+            for (size_t j = 0; j < nny; j++) {
+                T *outrow = out + n * j * nnx;
+                for (size_t i = 0; i < nnx; i++) {
+                    bilinear_sample<T, NC>(in, nx, n, xlut[i], ylut[j], outrow + n * i);
+                }
+            }
+        }
+    };
+
+    /*!
+     * Box filter which averages iix * iiy source pixels into one destination pixel
+     */
+    template<typename T, size_t NC>
+    struct BoxAverageKernel {
+        static void run(size_t nc, const unsigned char *inbuf, size_t nx, unsigned char *outbuf, size_t nnx,
+                        size_t nny, size_t iix, size_t iiy) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+            const unsigned int area = (unsigned int) (iix * iiy);
+
+            for (size_t j = 0; j < nny; j++) {
+                for (size_t i = 0; i < nnx; i++) {
+                    T *dst = out + n * (j * nnx + i);
+                    for (size_t k = 0; k < n; k++) {
+                        unsigned int accu = 0;
+                        for (size_t jj = 0; jj < iiy; jj++) {
+                            const T *src = in + n * ((iiy * j + jj) * nx + iix * i) + k;
+                            for (size_t ii = 0; ii < iix; ii++) {
+                                accu += src[n * ii];
+                            }
+                        }
+                        dst[k] = accu / area;
+                    }
+                }
+            }
+        }
+    };
+
+    /*!
+     * Copies all channels except channel chan into a buffer with nc - 1 channels
+     */
+    template<typename T, size_t NC>
+    struct RemoveChanKernel {
+        static void run(size_t nc, const unsigned char *inbuf, unsigned char *outbuf, size_t npixels, size_t chan) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+
+            for (size_t p = 0; p < npixels; p++) {
+                const T *src = in + n * p;
+                T *dst = out + (n - 1) * p;
+                for (size_t k = 0, kk = 0; k < n; k++) {
+                    if (k == chan) continue;
+                    dst[kk++] = src[k];
+                }
+            }
+        }
+    };
+
+    /*!
+     * Conversion of full range YCbCr to RGB. Channels beyond the third are copied unchanged.
+     *
+     * The conversion uses integer arithmetic with 16 fractional bits and rounding to the nearest value.
+     * The loop has no data dependent branches, so that the compiler is able to vectorize it.
+     */
+    template<typename T, size_t NC>
+    struct YCC2RGBKernel {
+        static void run(size_t nc, const unsigned char *inbuf, unsigned char *outbuf, size_t npixels) {
+            typedef typename SampleTraits<T>::accu_t accu_t;
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+            const accu_t maxval = SampleTraits<T>::maxval;
+            const accu_t mid = SampleTraits<T>::midval;
+            const accu_t half = 1 << 15;
+            const accu_t cr_r = 91881;  // 1.40200 * 2^16
+            const accu_t cb_g = 22554;  // 0.34414 * 2^16
+            const accu_t cr_g = 46802;  // 0.71414 * 2^16
+            const accu_t cb_b = 116130; // 1.77200 * 2^16
+
+            for (size_t p = 0; p < npixels; p++) {
+                const T *src = in + n * p;
+                T *dst = out + n * p;
+                accu_t Y = ((accu_t) src[2] << 16) + half;
+                accu_t Cb = (accu_t) src[1] - mid;
+                accu_t Cr = (accu_t) src[0] - mid;
+
+                accu_t r = (Y + cr_r * Cr) >> 16;
+                accu_t g = (Y - cb_g * Cb - cr_g * Cr) >> 16;
+                accu_t b = (Y + cb_b * Cb) >> 16;
+
+                dst[0] = (T) std::max((accu_t) 0, std::min(maxval, r));
+                dst[1] = (T) std::max((accu_t) 0, std::min(maxval, g));
+                dst[2] = (T) std::max((accu_t) 0, std::min(maxval, b));
+
+                for (size_t k = 3; k < n; k++) dst[k] = src[k];
+            }
+        }
+    };
+
+    /*!
+     * Blends one watermark value into an 8 bit sample. Same as
+     * round(v * (1 + val / 2550) + val / 10), but in integer arithmetic.
+     */
+    inline unsigned char watermark_blend(unsigned char v, unsigned int val) {
+        unsigned int nv = v + (2 * val * (v + 255) + 2550) / 5100;
+        return (unsigned char) ((nv > 255) ? 255 : nv);
+    }
+
+    /*!
+     * Blends one watermark value into a 16 bit sample.
+     */
+    inline unsigned short watermark_blend(unsigned short v, unsigned int val) {
+        float scale = 1.0F + val / 655350.0F;
+        float offset = val / 352500.F;
+        float nval = (v / 65535.0F) * scale + offset;
+        return (nval > 1.0) ? (unsigned short) 65535 : (unsigned short) (nval * 65535. + .5);
+    }
+
+    /*!
+     * Adds a watermark to all channels of the image. The watermark has already been resampled
+     * to the image size and has one byte per pixel.
+     */
+    template<typename T, size_t NC>
+    struct WatermarkKernel {
+        static void run(size_t nc, unsigned char *buf, const unsigned char *wmbuf, size_t npixels) {
+            const size_t n = (NC > 0) ? NC : nc;
+            T *pix = reinterpret_cast<T *>(buf);
+
+            for (size_t p = 0; p < npixels; p++) {
+                const unsigned int val = wmbuf[p];
+                T *dst = pix + n * p;
+                for (size_t k = 0; k < n; k++) dst[k] = watermark_blend(dst[k], val);
+            }
+        }
+    };
+
+    /*!
+     * Block size (in pixels) used by the rotations by 90 and 270 degrees. A block of source and
+     * destination pixels fits into the L1 cache even for 4 channels with 16 bit.
+     */
+    const size_t transpose_block = 32;
+
+    /*!
+     * Reverses the order of the pixels of a row in place
+     */
+    template<typename T, size_t NC>
+    inline void reverse_row(T *row, size_t nx, size_t nc) {
+        const size_t n = (NC > 0) ? NC : nc;
+        if (n == 1) {
+            std::reverse(row, row + nx);
+            return;
+        }
+        T *left = row;
+        T *right = row + n * (nx - 1);
+        while (left < right) {
+            for (size_t k = 0; k < n; k++) std::swap(left[k], right[k]);
+            left += n;
+            right -= n;
+        }
+    }
+
+    /*!
+     * Horizontal mirroring in place
+     */
+    template<typename T, size_t NC>
+    struct MirrorKernel {
+        static void run(size_t nc, unsigned char *buf, size_t nx, size_t ny) {
+            const size_t n = (NC > 0) ? NC : nc;
+            T *pix = reinterpret_cast<T *>(buf);
+
+            for (size_t j = 0; j < ny; j++) {
+                reverse_row<T, NC>(pix + n * j * nx, nx, nc);
+            }
+        }
+    };
+
+    /*!
+     * Rotation by 90 degrees clockwise, processing the destination rows [first, end) in blocks.
+     * nx and ny are the dimensions of the source image.
+     */
+    template<typename T, size_t NC>
+    struct Rotate90Kernel {
+        static void run(size_t nc, const unsigned char *inbuf, unsigned char *outbuf, size_t nx, size_t ny,
+                        size_t first, size_t end) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+            const size_t nnx = ny;
+
+            for (size_t jb = first; jb < end; jb += transpose_block) {
+                const size_t jend = std::min(jb + transpose_block, end);
+                for (size_t ib = 0; ib < nnx; ib += transpose_block) {
+                    const size_t iend = std::min(ib + transpose_block, nnx);
+                    for (size_t j = jb; j < jend; j++) {
+                        T *dst = out + n * (j * nnx + ib);
+                        for (size_t i = ib; i < iend; i++) {
+                            const T *src = in + n * ((ny - i - 1) * nx + j);
+                            for (size_t k = 0; k < n; k++) dst[k] = src[k];
+                            dst += n;
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    /*!
+     * Rotation by 180 degrees in place
+     */
+    template<typename T, size_t NC>
+    struct Rotate180Kernel {
+        static void run(size_t nc, unsigned char *buf, size_t nx, size_t ny) {
+            const size_t n = (NC > 0) ? NC : nc;
+            T *pix = reinterpret_cast<T *>(buf);
+
+            for (size_t j = 0; j < ny / 2; j++) {
+                T *top = pix + n * j * nx;
+                T *bottom = pix + n * ((ny - j - 1) * nx + nx - 1);
+                for (size_t i = 0; i < nx; i++) {
+                    for (size_t k = 0; k < n; k++) std::swap(top[k], bottom[k]);
+                    top += n;
+                    bottom -= n;
+                }
+            }
+            if (ny % 2 == 1) {
+                reverse_row<T, NC>(pix + n * (ny / 2) * nx, nx, nc);
+            }
+        }
+    };
+
+    /*!
+     * Rotation by 270 degrees clockwise, processing the destination rows [first, end) in blocks.
+     * nx and ny are the dimensions of the source image.
+     */
+    template<typename T, size_t NC>
+    struct Rotate270Kernel {
+        static void run(size_t nc, const unsigned char *inbuf, unsigned char *outbuf, size_t nx, size_t ny,
+                        size_t first, size_t end) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+            const size_t nnx = ny;
+
+            for (size_t jb = first; jb < end; jb += transpose_block) {
+                const size_t jend = std::min(jb + transpose_block, end);
+                for (size_t ib = 0; ib < nnx; ib += transpose_block) {
+                    const size_t iend = std::min(ib + transpose_block, nnx);
+                    for (size_t j = jb; j < jend; j++) {
+                        T *dst = out + n * (j * nnx + ib);
+                        for (size_t i = ib; i < iend; i++) {
+                            const T *src = in + n * (i * nx + (nx - j - 1));
+                            for (size_t k = 0; k < n; k++) dst[k] = src[k];
+                            dst += n;
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    /*!
+     * Rotation by an arbitrary angle using bilinear interpolation. Pixels outside of the
+     * source image are set to 0.
+     */
+    template<typename T, size_t NC>
+    struct RotateKernel {
+        static void run(size_t nc, const unsigned char *inbuf, size_t nx, size_t ny, unsigned char *outbuf,
+                        size_t nnx, size_t nny, float co, float si, float ptx, float pty, float pptx, float ppty) {
+            const size_t n = (NC > 0) ? NC : nc;
+            const T *in = reinterpret_cast<const T *>(inbuf);
+            T *out = reinterpret_cast<T *>(outbuf);
+
+            for (size_t j = 0; j < nny; j++) {
+                for (size_t i = 0; i < nnx; i++) {
+                    float rx = ((float) i - pptx) * co - ((float) j - ppty) * si + ptx;
+                    float ry = ((float) i - pptx) * si + ((float) j - ppty) * co + pty;
+                    T *dst = out + n * (j * nnx + i);
+
+                    if ((rx < 0.0) || (rx >= (float) (nx - 1)) || (ry < 0.0) || (ry >= (float) (ny - 1))) {
+                        for (size_t k = 0; k < n; k++) dst[k] = 0;
+                    } else {
+                        bilinear_sample<T, NC>(in, nx, n, rx, ry, dst);
+                    }
+                }
+            }
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*!
+ * Size keyed settings of the codecs, e.g. the JPEG encoding profile or the number of quality layers of
+ * JPEG2000 images, chosen by the size of the output image.
+ */
+#ifndef __sipi_size_policy_h
+#define __sipi_size_policy_h
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <functional>
+
+#include "SipiImage.h"
+
+namespace Sipi {
+
+    /*!
+     * Maps the size of the output image to a setting of a codec. The policy is a comma separated list of
+     * "<longest edge>:<value>" entries. An entry applies to output images whose longest edge is at most
+     * <longest edge> pixels, the entry with the smallest such edge is used.
+     *
+     * \tparam T Type of the setting
+     */
+    template<typename T>
+    class SipiSizePolicy {
+    public:
+        /*!
+         * Parses the value of an entry (without leading and trailing blanks). Returns false or throws
+         * std::logic_error (e.g. from std::stoi) if the value is invalid.
+         */
+        typedef std::function<bool(const std::string &, T &)> ValueParser;
+
+    private:
+        std::mutex locking;
+        std::map<size_t, T> values; //!< longest edge of the output image -> setting
+
+    public:
+        /*!
+         * Sets the policy
+         *
+         * \param[in] policy Comma separated list of "<longest edge>:<value>" entries, empty for no entries
+         * \param[in] parse Parser of the values
+         * \param[in] name Name of the policy used in error messages, e.g. "JPEG profile policy"
+         * \param[in] syntax Syntax of an entry used in error messages, e.g. "<longest edge>:<percentage>"
+         * \throws SipiImageError if an entry cannot be parsed
+         */
+        void set(const std::string &policy, const ValueParser &parse, const std::string &name,
+                 const std::string &syntax) {
+            std::map<size_t, T> new_values;
+            std::stringstream ss(policy);
+            std::string entry;
+            while (std::getline(ss, entry, ',')) {
+                if (entry.find_first_not_of(" ") == std::string::npos) continue;
+                size_t colon = entry.find(':');
+                try {
+                    if (colon == std::string::npos) throw std::invalid_argument(entry);
+                    int edge = std::stoi(entry.substr(0, colon));
+                    std::string str = entry.substr(colon + 1);
+                    str.erase(0, str.find_first_not_of(" "));
+                    str.erase(str.find_last_not_of(" ") + 1);
+                    T value;
+                    if ((edge <= 0) || !parse(str, value)) throw std::out_of_range(entry);
+                    new_values[edge] = value;
+                } catch (const std::logic_error &err) {
+                    throw SipiImageError(__FILE__, __LINE__, "Invalid " + name + " entry \"" + entry +
+                                                             "\", expected \"" + syntax + "\"");
+                }
+            }
+            std::lock_guard<std::mutex> lock(locking);
+            values = new_values;
+        }
+
+        /*!
+         * Gets the setting for an output image
+         *
+         * \param[in] edge Longest edge of the output image
+         * \param[out] value The setting, unchanged if no entry applies
+         * \returns true if an entry applies
+         */
+        bool get(size_t edge, T &value) {
+            std::lock_guard<std::mutex> lock(locking);
+            auto rule = values.lower_bound(edge);
+            if (rule == values.end()) return false;
+            value = rule->second;
+            return true;
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __defined_sipi_watermark_cache_h
+#define __defined_sipi_watermark_cache_h
+
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Sipi {
+
+    /*!
+     * SipiWatermarkCache keeps the watermark files in memory. Each watermark file is read only once
+     * (and again if it has been modified). In addition the watermark resampled to the size of the
+     * output image is cached, since the same sizes (e.g. tiles) are requested over and over again.
+     * The resampled watermarks have one byte per pixel.
+     */
+    class SipiWatermarkCache {
+    public:
+        typedef std::shared_ptr<const std::vector<unsigned char>> Mask; //!< Watermark resampled to the image size
+
+    private:
+        typedef struct {
+            time_t mtime;       //!< modification time of the watermark file when it was read
+            size_t nx, ny;      //!< dimensions of the watermark
+            std::shared_ptr<const std::vector<unsigned char>> buf; //!< the gray values of the watermark
+        } WatermarkRecord;
+
+        typedef struct {
+            time_t mtime;       //!< modification time of the watermark file it has been resampled from
+            Mask mask;
+            unsigned long long last_access;
+        } MaskRecord;
+
+        std::mutex locking;
+        std::unordered_map<std::string, WatermarkRecord> watermarks;
+        std::unordered_map<std::string, MaskRecord> masks;
+        size_t masks_size;          //!< total size of all resampled watermarks in bytes
+        size_t max_masks_size;      //!< upper limit of the size of all resampled watermarks
+        unsigned long long access_counter;
+
+        SipiWatermarkCache();
+
+        WatermarkRecord load(const std::string &wmfile, time_t mtime);
+
+        void purge(size_t needed);
+
+    public:
+        SipiWatermarkCache(const SipiWatermarkCache &) = delete;
+
+        SipiWatermarkCache &operator=(const SipiWatermarkCache &) = delete;
+
+        /*!
+         * Returns the process wide instance of the cache
+         */
+        static SipiWatermarkCache &instance();
+
+        /*!
+         * Get the watermark resampled to the given image size
+         *
+         * \param[in] wmfile Path to the watermark file (TIFF, 8 bit, one channel)
+         * \param[in] nx Width of the image the watermark is applied to
+         * \param[in] ny Height of the image the watermark is applied to
+         * \returns nx*ny bytes with the watermark values
+         * \throws SipiImageError if the watermark file cannot be read
+         */
+        Mask get(const std::string &wmfile, size_t nx, size_t ny);
+
+        /*!
+         * Sets the upper limit for the memory used by the resampled watermarks
+         *
+         * \param[in] max_size Maximal size in bytes
+         */
+        void setMaxSize(size_t max_size);
+
+        /*!
+         * Removes all watermarks from the cache
+         */
+        void clear();
+    };
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ *//*!
+ * This file implements the reading of image file headers without initializing the codec libraries.
+ */
+#ifndef __sipi_header_reader_h
+#define __sipi_header_reader_h
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace Sipi {
+
+    /*!
+     * Reads the header of an image file with pread. The first few KB are read once when the file is opened,
+     * everything else (e.g. a TIFF directory at the end of the file) is read on demand. The getDim methods of
+     * the I/O classes use it to get the dimensions without opening the file with the codec library, which they
+     * do only for exotic files the header parsers do not understand.
+     */
+    class SipiHeaderReader {
+    private:
+        int fd;
+        off_t filesize;
+        std::vector<unsigned char> head; //!< the first HEAD_SIZE bytes of the file (or less)
+        static std::atomic<bool> enabled;
+
+    public:
+        static const size_t HEAD_SIZE = 4096;
+
+        /*!
+         * Opens the file and reads the first HEAD_SIZE bytes
+         *
+         * \param[in] filepath Path of the image file
+         */
+        explicit SipiHeaderReader(const std::string &filepath);
+
+        ~SipiHeaderReader();
+
+        SipiHeaderReader(const SipiHeaderReader &) = delete;
+
+        SipiHeaderReader &operator=(const SipiHeaderReader &) = delete;
+
+        /*!
+         * Enables or disables the header parsers of the getDim methods. Disabling them is only useful to
+         * compare them with the codec libraries (see the benchmarks).
+         */
+        static void setEnabled(bool enabled_p) { enabled = enabled_p; }
+
+        static bool isEnabled() { return enabled; }
+
+        /*!
+         * \returns true if the file could be opened
+         */
+        inline bool good() const { return fd != -1; }
+
+        /*!
+         * \returns the size of the file in bytes
+         */
+        inline off_t size() const { return filesize; }
+
+        /*!
+         * \returns the first bytes of the file (at most HEAD_SIZE)
+         */
+        inline const std::vector<unsigned char> &first() const { return head; }
+
+        /*!
+         * Reads len bytes at offset
+         *
+         * \returns false if the file is too short or cannot be read
+         */
+        bool read(uint64_t offset, void *buf, size_t len);
+
+        /*!
+         * Reads an unsigned integer of 1, 2, 4 or 8 bytes at offset
+         *
+         * \param[in] offset Position in the file
+         * \param[in] nbytes Size of the integer
+         * \param[in] big_endian Byte order of the integer
+         * \param[out] val The value
+         * \returns false if the file is too short or cannot be read
+         */
+        bool getUint(uint64_t offset, int nbytes, bool big_endian, uint64_t &val);
+    };
+
+}
+
+#endif
@@ -39,8 +39,35 @@ namespace Sipi {
     /*! Class which implements the JPEG2000-reader/writer */
     class SipiIOJ2k : public SipiIO {
     private:
+        /*!
+         * Reads the image. If strips is true and the image needs no further processing after
+         * decoding, a strip source is attached to the image instead of decoding the pixels.
+         */
+        bool decode(SipiImage *img, std::string filepath, std::shared_ptr<SipiRegion> region,
+                    std::shared_ptr<SipiSize> size, bool force_bps_8, ScalingQuality scaling_quality, bool strips);
+
     public:
         virtual ~SipiIOJ2k() {};
+
+        /*!
+         * Sets the number of Kakadu threads used to read or write one image. The threads are taken
+         * from a pool which persists for the lifetime of the server.
+         *
+         * \param[in] nthreads Number of threads per image, 0 to use the number of processors
+         */
+        static void setThreadBudget(int nthreads);
+
+        /*!
+         * Limits the quality layers decoded for small output images. The policy is a comma separated
+         * list of "<longest edge>:<percentage>" entries, e.g. "256:25,1024:50": an output image whose
+         * longest edge is at most 256 pixels is decoded from the first 25% of the quality layers, up to
+         * 1024 pixels from the first 50%, larger images from all layers. An empty policy decodes all layers.
+         *
+         * \param[in] policy The policy
+         * \throws SipiImageError if the policy cannot be parsed
+         */
+        static void setLayerPolicy(const std::string &policy);
+
         /*!
          * Method used to read an image file
          *
@@ -54,6 +81,17 @@ namespace Sipi {
                   std::shared_ptr<SipiSize> size = nullptr, bool force_bps_8 = false,
                   ScalingQuality scaling_quality = {HIGH, HIGH, HIGH, HIGH}) override;
 
+        /*!
+         * Reads the header of the image and attaches a strip source which decodes the
+         * region strip by strip. Images with a palette or which need scaling are read completely.
+         *
+         * \param *img Pointer to SipiImage instance
+         * \param filepath Image file path
+         */
+        bool readStrips(SipiImage *img, std::string filepath, int pagenum = 0,
+                        std::shared_ptr<SipiRegion> region = nullptr, std::shared_ptr<SipiSize> size = nullptr,
+                        bool force_bps_8 = false, ScalingQuality scaling_quality = {HIGH, HIGH, HIGH, HIGH}) override;
+
         /*!
          * Get the dimension of the image
          *
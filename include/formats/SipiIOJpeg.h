@@ -35,11 +35,47 @@ namespace Sipi {
     /*! Class which implements the JPEG2000-reader/writer */
     class SipiIOJpeg : public SipiIO {
     private:
+        static bool embedded_thumbnails; //!< true, if small images may be scaled from the embedded EXIF thumbnail
+
         void parse_photoshop(SipiImage *img, char *data, int length);
 
+        /*!
+         * Decodes the JPEG thumbnail embedded in the EXIF data if it can replace the image for an output
+         * of nnx x nny pixels: it must be at least as large, show the whole image and have the same colorspace.
+         *
+         * \param[in] colspace Output colorspace of the image (J_COLOR_SPACE)
+         * \returns false if the thumbnail is not suitable, the image is not changed in this case
+         */
+        bool read_thumbnail(SipiImage *img, const unsigned char *data, size_t len, size_t width, size_t height,
+                            int colspace, size_t nnx, size_t nny);
+
     public:
         virtual ~SipiIOJpeg() {};
 
+        /*!
+         * Selects the encoding profile by the size of the output image if no JPEG_profile is given. The
+         * policy is a comma separated list of "<longest edge>:<profile>" entries, e.g. "512:tile,2048:optimized":
+         * an image whose longest edge is at most 512 pixels is written with the profile "tile", up to 2048 pixels
+         * with "optimized", larger images progressive. Profiles are "baseline", "optimized" (baseline with
+         * optimized Huffman tables), "progressive" and "tile" (baseline without ICC, XMP, EXIF and IPTC payloads
+         * if the image is plain sRGB). An empty policy writes all images progressive.
+         *
+         * \param[in] policy The policy
+         * \throws SipiImageError if the policy cannot be parsed
+         */
+        static void setProfilePolicy(const std::string &policy);
+
+        /*!
+         * Allows a small version of the whole image to be scaled from the thumbnail in the EXIF data
+         * of the file instead of decoding the image. The thumbnail is only used if it is not smaller than
+         * the output, has the aspect ratio of the image and the image is sRGB or has no ICC profile (the
+         * thumbnail is always sRGB). Since the thumbnail is not updated by every
+         * application which edits an image, this is disabled by default.
+         *
+         * \param[in] use true to use embedded thumbnails
+         */
+        static void setEmbeddedThumbnails(bool use);
+
         /*!
          * Method used to read an image file
          *
@@ -71,6 +107,29 @@ namespace Sipi {
          */
         void write(SipiImage *img, std::string filepath, const SipiCompressionParams *params = nullptr) override;
 
+        /*!
+         * Checks if a JPEG file can be rotated with rotateLossless
+         *
+         * \param[in] infile Path of the JPEG file
+         * \returns true if the file is a JPEG file which can be rotated losslessly
+         */
+        static bool isLosslessRotatable(const std::string &infile);
+
+        /*!
+         * Writes a JPEG file rotated clockwise by 90, 180 or 270 degrees without decoding it: the DCT blocks
+         * are moved and their coefficients transposed and mirrored, the markers are copied. This is only
+         * possible for YCbCr or gray images without or with an sRGB profile whose dimensions are multiples
+         * of the MCU size.
+         *
+         * \param[in] infile Path of the JPEG file
+         * \param[in] angle 90, 180 or 270
+         * \param[in] filepath Name of the file to be written, "HTTP" to write to the connection
+         * \param[in] conobj The connection if filepath is "HTTP"
+         * \returns false if the file cannot be rotated losslessly, nothing is written in this case
+         */
+        static bool rotateLossless(const std::string &infile, int angle, const std::string &filepath,
+                                   shttps::Connection *conobj = nullptr);
+
     };
 
 }
@@ -20,54 +20,59 @@
  * You should have received a copy of the GNU Affero General Public
  * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
  *//*!
- * This file handles the reading and writing of JPEG 2000 files using libtiff.
+ * This file handles the reading of JPEG 2000 files using OpenJPEG.
  */
 #ifndef __sipi_io_openj2k_h
 #define __sipi_io_openj2k_h
 
 #include <string>
 
-#include "tiff.h"
-#include "tiffio.h"
-
 #include "SipiImage.h"
-#include "SipiExif.h"
 #include "SipiIO.h"
 
 namespace Sipi {
 
-    /*! Class which implements the JPEG2000-reader/writer */
+    /*!
+     * Class which implements a JPEG2000 reader based on OpenJPEG. It is an alternative to the
+     * Kakadu based SipiIOJ2k on hosts without a Kakadu licence (see the configuration j2k_decoder).
+     * JPEG2000 files are still written with SipiIOJ2k.
+     */
     class SipiIOOpenJ2k : public SipiIO {
-    private:
     public:
+        virtual ~SipiIOOpenJ2k() {};
+
+        /*!
+         * Sets the number of OpenJPEG threads used to decode one image.
+         *
+         * \param[in] nthreads Number of threads per image, 0 to use the number of processors
+         */
+        static void setThreadBudget(int nthreads);
+
         /*!
-         * Method used to read an image file
+         * Method used to read an image file. Only the region is decoded, and from the lowest resolution
+         * level which is not smaller than the requested size.
          *
          * \param *img Pointer to SipiImage instance
          * \param filepath Image file path
-         * \param reduce Reducing factor. If it is not 0, the reader
-         * only reads part of the data returning an image with reduces resolution.
-         * If the value is 1, only half the resolution is returned. If it is 2, only one forth etc.
          */
-        bool read(SipiImage *img, std::string filepath, std::shared_ptr <SipiRegion> region = nullptr,
-                  std::shared_ptr <SipiSize> size = nullptr);
+        bool read(SipiImage *img, std::string filepath, int pagenum = 0, std::shared_ptr<SipiRegion> region = nullptr,
+                  std::shared_ptr<SipiSize> size = nullptr, bool force_bps_8 = false,
+                  ScalingQuality scaling_quality = {HIGH, HIGH, HIGH, HIGH}) override;
 
         /*!
          * Get the dimension of the image
          *
          * \param[in] filepath Pathname of the image file
-         * \param[out] width Width of the image in pixels
-         * \param[out] height Height of the image in pixels
          */
-        bool getDim(std::string filepath, size_t &width, size_t &height);
+        Sipi::SipiImgInfo getDim(std::string filepath, int pagenum = 0) override;
 
         /*!
-         * Write a TIFF image to a file, stdout or to a memory buffer
+         * Writes a JPEG2000 file with SipiIOJ2k
          *
          * \param *img Pointer to SipiImage instance
          * \param filepath Name of the image file to be written.
          */
-        void write(SipiImage *img, std::string filepath, int quality = 0);
+        void write(SipiImage *img, std::string filepath, const SipiCompressionParams *params = nullptr) override;
     };
 }
 
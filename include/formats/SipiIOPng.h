@@ -36,6 +36,20 @@ namespace Sipi {
     public:
         virtual ~SipiIOPng() {};
 
+        /*!
+         * Selects the encoding preset by the size of the output image. The policy is a comma separated
+         * list of "<longest edge>:<preset>" entries, e.g. "512:fast,4096:balanced": an image whose longest
+         * edge is at most 512 pixels is written with the preset "fast", up to 4096 pixels with "balanced",
+         * larger images with "balanced" too. The presets are "fast" (sub filter, level 1), "balanced"
+         * (adaptive filters, level 6) and "small" (adaptive filters, level 9, one thread). "fast" and
+         * "balanced" deflate bands of rows in parallel. The compression parameters PNG_filter, PNG_level
+         * and PNG_parallel override the preset.
+         *
+         * \param[in] policy The policy
+         * \throws SipiImageError if the policy cannot be parsed
+         */
+        static void setPresetPolicy(const std::string &policy);
+
         /*!
          * Method used to read an image file
          *
@@ -56,6 +56,22 @@ namespace Sipi {
          */
         void writeExif(SipiImage *img, TIFF *tif);
 
+        /*!
+         * Reads the pixels of a region tile by tile (tiled files) or strip by strip (stripped files).
+         * Only the tiles or strips intersecting the region are decoded. For large regions the rows of
+         * tiles or strips are decoded in parallel.
+         *
+         * \param[in] tif Pointer to TIFF file handle
+         * \param[in] filepath Path of the TIFF file (used to open additional handles for parallel decoding)
+         * \param[in] img Pointer to SipiImage instance with nx, ny, nc and bps set
+         * \param[in] planar Planar configuration of the file
+         * \param[in] roi_x, roi_y, roi_w, roi_h The region to read
+         * \returns Buffer with the pixels of the region, for PLANARCONFIG_SEPARATE one plane after the other.
+         * NOTE: This buffer has to be deleted by the caller!
+         */
+        unsigned char *readBlocks(TIFF *tif, const std::string &filepath, SipiImage *img, uint16 planar,
+                                  uint32 roi_x, uint32 roi_y, uint32 roi_w, uint32 roi_h);
+
         /*!
          * Converts an image from RRRRRR...GGGGGG...BBBBB to RGBRGBRGBRGB....
          * \param img Pointer to SipiImage instance
@@ -87,6 +103,14 @@ namespace Sipi {
 
         static void initLibrary(void);
 
+        /*!
+         * Selects how TIFF files are opened for reading: through the file descriptor, which is used to
+         * tell the kernel which parts of the file will be read (posix_fadvise, default), or with TIFFOpen.
+         *
+         * \param[in] use true to give advice to the kernel
+         */
+        static void setReadAdvice(bool use);
+
         /*!
          * Method used to read an image file
          *
@@ -28,6 +28,9 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include <stdio.h>
 #include <limits.h>
@@ -64,6 +67,12 @@ namespace Sipi {
     private:
         cmsHPROFILE icc_profile;            //!< Handle of the littleCMS profile data
         PredefinedProfiles profile_type;    //!< Profile type that is represented
+        std::string profile_hash;           //!< Identifies the profile data as key of the transform cache
+
+        /*!
+         * Calculates the md5 checksum of the binary data of icc_profile
+         */
+        std::string profileChecksum() const;
 
     public:
         /*!
@@ -160,6 +169,13 @@ namespace Sipi {
          */
         unsigned int iccFormatter(SipiImage *img) const;
 
+        /*!
+         * Returns a key which identifies the profile data. It is set by the constructors: predefined
+         * profiles are identified by their type, all others by a checksum (md5) of the profile data.
+         * \returns Key as string, empty string if there is no profile
+         */
+        inline const std::string &iccHash() const { return profile_hash; }
+
         /**
          * Print info to output stream
          * \param[in] lhs Output stream
@@ -168,6 +184,69 @@ namespace Sipi {
         friend std::ostream &operator<<(std::ostream &lhs, SipiIcc &rhs);
     };
 
+
+    /*!
+     * Thread safe cache of littleCMS color transforms. Creating a transform builds the complete
+     * color pipeline, which is expensive compared to the transform of a tile. Transforms are therefore
+     * kept and reused for the same combination of source profile, target profile, formatters and intent.
+     *
+     * All transforms are created within one littleCMS context owned by the cache and without the
+     * internal 1-pixel cache (cmsFLAGS_NOCACHE), thus they may be used by several threads concurrently.
+     */
+    class SipiIccTransformCache {
+    public:
+        typedef std::shared_ptr<void> Transform; //!< The cmsHTRANSFORM, deleted when no longer referenced
+
+    private:
+        typedef struct {
+            Transform transform;
+            unsigned long long last_access;
+        } CacheEntry;
+
+        static const size_t max_entries = 64;  //!< Maximal number of transforms kept
+
+        std::mutex locking;
+        cmsContext context;
+        unsigned long long access_counter;
+        std::unordered_map<std::string, CacheEntry> transforms;
+
+        SipiIccTransformCache();
+
+    public:
+        SipiIccTransformCache(const SipiIccTransformCache &) = delete;
+
+        SipiIccTransformCache &operator=(const SipiIccTransformCache &) = delete;
+
+        /*!
+         * Returns the process wide instance of the cache
+         */
+        static SipiIccTransformCache &instance();
+
+        /*!
+         * Get a transform from the cache, or create it if it is not yet cached
+         *
+         * \param[in] src_icc Profile of the source data
+         * \param[in] in_formatter Formatter of the source data
+         * \param[in] dst_icc Profile of the destination data
+         * \param[in] out_formatter Formatter of the destination data
+         * \param[in] intent Rendering intent
+         * \returns The transform (never nullptr)
+         * \throws SipiError if the transform cannot be created
+         */
+        Transform get(const SipiIcc &src_icc, cmsUInt32Number in_formatter, const SipiIcc &dst_icc,
+                      cmsUInt32Number out_formatter, cmsUInt32Number intent = INTENT_PERCEPTUAL);
+
+        /*!
+         * Removes all cached transforms. Transforms still in use are deleted after their last use.
+         */
+        void clear();
+
+        /*!
+         * Number of cached transforms
+         */
+        size_t size();
+    };
+
 }
 
 #endif
@@ -685,6 +685,8 @@ namespace shttps {
 
         inline bool isBuffered(void) { return (outbuf != nullptr); }
 
+        inline bool isChunked(void) { return _chunked_transfer_out; }
+
         /*!
          * Set the transfer mode for the response to chunked
          */
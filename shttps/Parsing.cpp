@@ -23,6 +23,12 @@
 
 #include <regex>
 #include <sstream>
+#include <mutex>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "Parsing.h"
 #include "Error.h"
@@ -166,18 +172,128 @@ namespace shttps {
         }
         //=============================================================================================================
 
-        std::pair <std::string,std::string> getFileMimetype(const std::string &fpath) {
+        /*!
+         * A magic number: the bytes expected at the given offsets of a file
+         */
+        typedef struct {
+            std::vector<std::pair<size_t, std::string>> parts;
+            std::string mimetype;
+        } MagicNumber;
+
+        /*!
+         * The magic numbers of the image formats read by SIPI. Files of other types are given to libmagic.
+         */
+        static const std::vector<MagicNumber> magic_numbers = {
+                {{{0, std::string("\xFF\xD8\xFF", 3)}}, "image/jpeg"},
+                {{{0, std::string("\x89PNG\r\n\x1A\n", 8)}}, "image/png"},
+                {{{0, std::string("II*\0", 4)}}, "image/tiff"},
+                {{{0, std::string("MM\0*", 4)}}, "image/tiff"},
+                {{{0, std::string("II+\0", 4)}}, "image/tiff"}, // BigTIFF
+                {{{0, std::string("MM\0+", 4)}}, "image/tiff"}, // BigTIFF
+                {{{0, std::string("\0\0\0\x0CjP  \r\n\x87\n", 12)}, {16, "ftyp"}, {20, "jp2 "}}, "image/jp2"},
+                {{{0, std::string("\0\0\0\x0CjP  \r\n\x87\n", 12)}, {16, "ftyp"}, {20, "jpx "}}, "image/jpx"},
+                {{{0, "%PDF-"}}, "application/pdf"},
+                {{{0, "RIFF"}, {8, "WEBP"}}, "image/webp"}
+        };
+
+        /*!
+         * Number of bytes at the start of a file needed to check all magic numbers
+         */
+        static const size_t MAGIC_HEADER_SIZE = 24;
+
+        std::string sniffMimetype(const unsigned char *header, size_t len) {
+            for (const auto &magic: magic_numbers) {
+                bool match = true;
+                for (const auto &part: magic.parts) {
+                    if ((part.first + part.second.size() > len) ||
+                        (memcmp(header + part.first, part.second.data(), part.second.size()) != 0)) {
+                        match = false;
+                        break;
+                    }
+                }
+                if (match) return magic.mimetype;
+            }
+            return "";
+        }
+        //=============================================================================================================
+
+        /*!
+         * A mimetype already determined. It is valid as long as the file has the same inode, size and modification time
+         */
+        typedef struct {
+            dev_t dev;
+            ino_t ino;
+            off_t size;
+            time_t mtime;
+            std::pair<std::string, std::string> mimetype;
+        } MimetypeCacheEntry;
+
+        static const size_t MIMETYPE_CACHE_SIZE = 4096;
+        static std::unordered_map<std::string, MimetypeCacheEntry> mimetype_cache;
+        static std::mutex mimetype_cache_mutex;
+
+        static std::pair<std::string, std::string> getMagicMimetype(const std::string &fpath) {
             magic_t handle;
             if ((handle = magic_open(MAGIC_MIME | MAGIC_PRESERVE_ATIME)) == nullptr) {
-                throw Error(__file__, __LINE__, magic_error(handle));
+                throw Error(__file__, __LINE__, "magic_open failed");
             }
 
             if (magic_load(handle, nullptr) != 0) {
-                throw Error(__file__, __LINE__, magic_error(handle));
+                std::string err(magic_error(handle));
+                magic_close(handle);
+                throw Error(__file__, __LINE__, err);
             }
 
-            std::string mimestr(magic_file(handle, fpath.c_str()));
-            return parseMimetype(mimestr);
+            const char *mimestr = magic_file(handle, fpath.c_str());
+            if (mimestr == nullptr) {
+                std::string err(magic_error(handle));
+                magic_close(handle);
+                throw Error(__file__, __LINE__, err);
+            }
+            std::pair<std::string, std::string> mimetype = parseMimetype(mimestr);
+            magic_close(handle);
+            return mimetype;
+        }
+        //=============================================================================================================
+
+        std::pair <std::string,std::string> getFileMimetype(const std::string &fpath) {
+            int fd;
+            if ((fd = ::open(fpath.c_str(), O_RDONLY)) == -1) {
+                return getMagicMimetype(fpath); // libmagic knows how to report this
+            }
+            struct stat fstatbuf;
+            if ((fstat(fd, &fstatbuf) != 0) || !S_ISREG(fstatbuf.st_mode)) {
+                ::close(fd);
+                return getMagicMimetype(fpath);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mimetype_cache_mutex);
+                auto entry = mimetype_cache.find(fpath);
+                if ((entry != mimetype_cache.end()) && (entry->second.dev == fstatbuf.st_dev) &&
+                    (entry->second.ino == fstatbuf.st_ino) && (entry->second.size == fstatbuf.st_size) &&
+                    (entry->second.mtime == fstatbuf.st_mtime)) {
+                    ::close(fd);
+                    return entry->second.mimetype;
+                }
+            }
+
+            unsigned char header[MAGIC_HEADER_SIZE];
+            ssize_t n = pread(fd, header, MAGIC_HEADER_SIZE, 0);
+            ::close(fd);
+
+            std::pair<std::string, std::string> mimetype;
+            std::string sniffed = sniffMimetype(header, n > 0 ? n : 0);
+            if (!sniffed.empty()) {
+                mimetype = std::make_pair(sniffed, std::string("binary"));
+            } else {
+                mimetype = getMagicMimetype(fpath);
+            }
+
+            std::lock_guard<std::mutex> lock(mimetype_cache_mutex);
+            if (mimetype_cache.size() >= MIMETYPE_CACHE_SIZE) mimetype_cache.clear();
+            mimetype_cache[fpath] = {fstatbuf.st_dev, fstatbuf.st_ino, fstatbuf.st_size, fstatbuf.st_mtime, mimetype};
+            return mimetype;
         }
         //=============================================================================================================
 
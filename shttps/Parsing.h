@@ -46,7 +46,17 @@ namespace shttps {
 
 
         /*!
-         * Determine the mimetype of a file using the magic number
+         * Determine the mimetype of the image formats read by SIPI from the first bytes of a file
+         *
+         * \param[in] header The first bytes of the file, 24 bytes are enough for all formats
+         * \param[in] len Number of bytes in header
+         * \returns The mimetype or an empty string if the magic number is not known
+         */
+        std::string sniffMimetype(const unsigned char *header, size_t len);
+
+        /*!
+         * Determine the mimetype of a file using the magic number. The magic numbers of the image formats
+         * are checked first, other files are given to libmagic. The result is cached until the file changes.
          *
          * \param[in] fpath Path to file to check for the mimetype
          * \returns pair<string,string> containing the mimetype as first part
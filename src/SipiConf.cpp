@@ -41,6 +41,8 @@ namespace Sipi {
         subdir_excludes = luacfg.configStringList("sipi", "subdir_excludes"); // has no defaults, returns an empty vector if nothing is there
         prefix_as_path = luacfg.configBoolean("sipi", "prefix_as_path", true);
         jpeg_quality = luacfg.configInteger("sipi", "jpeg_quality", 80);
+        webp_quality = luacfg.configInteger("sipi", "webp_quality", 80);
+        webp_lossless = luacfg.configBoolean("sipi", "webp_lossless", false);
 
         std::map<std::string,std::string> default_scaling_quality = {
                 {"jpeg", "medium"},
@@ -71,6 +73,12 @@ namespace Sipi {
         thumb_size = luacfg.configString("sipi", "thumb_size", "!128,128");
         cache_n_files = luacfg.configInteger("sipi", "cache_nfiles", 0);
         n_threads = luacfg.configInteger("sipi", "nthreads", 2 * std::thread::hardware_concurrency());
+        kakadu_threads = luacfg.configInteger("sipi", "kakadu_threads", 4);
+        j2k_decoder = luacfg.configString("sipi", "j2k_decoder", "kakadu");
+        j2k_layers = luacfg.configString("sipi", "j2k_layers", "");
+        embedded_thumbnails = luacfg.configBoolean("sipi", "embedded_thumbnails", false);
+        jpeg_profiles = luacfg.configString("sipi", "jpeg_profiles", "");
+        png_profiles = luacfg.configString("sipi", "png_profiles", "");
         std::string max_post_size_str = luacfg.configString("sipi", "max_post_size", "0");
 
         if (!max_post_size_str.empty()) {
@@ -45,6 +45,7 @@
 
 #include "SipiImage.h"
 #include "SipiError.h"
+#include "formats/SipiIOJpeg.h"
 #include "iiifparser/SipiSize.h"
 #include "iiifparser/SipiRegion.h"
 #include "iiifparser/SipiRotation.h"
@@ -395,6 +396,7 @@ namespace Sipi {
         bool is_image_file = ((actual_mimetype == "image/tiff") ||
                               (actual_mimetype == "image/jpeg") ||
                               (actual_mimetype == "image/png") ||
+                              (actual_mimetype == "image/webp") ||
                               (actual_mimetype == "image/jpx") ||
                               (actual_mimetype == "image/jp2") ||
                               (actual_mimetype == "application/pdf"));
@@ -571,7 +573,7 @@ namespace Sipi {
                 json_object_set_new(root, "tiles", tiles);
             }
 
-            const char *extra_formats_str[] = {"tif", "pdf", "jp2"};
+            const char *extra_formats_str[] = {"tif", "pdf", "jp2", "webp"};
             json_t *extra_formats = json_array();
             for (unsigned int i = 0; i < sizeof(extra_formats_str) / sizeof(char *); i++) {
                 json_array_append_new(extra_formats, json_string(extra_formats_str[i]));
@@ -740,6 +742,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
   if ((actual_mimetype == "image/tiff") ||
       (actual_mimetype == "image/jpeg") ||
       (actual_mimetype == "image/png") ||
+      (actual_mimetype == "image/webp") ||
       (actual_mimetype == "image/jpx") ||
       (actual_mimetype == "image/jp2") ||
       (actual_mimetype == "application/pdf")) {
@@ -905,9 +908,18 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                 break; // pdf
             }
 
+            case SipiQualityFormat::WEBP: {
+                ext[0] = 'w';
+                ext[1] = 'e';
+                ext[2] = 'b';
+                ext[3] = 'p';
+                ext[4] = '\0';
+                break; // webp
+            }
+
             default: {
                 throw SipiError(__file__, __LINE__,
-                                "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf");
+                                "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf, .webp");
             }
         }
 
@@ -952,6 +964,35 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
     //=========================================================================
 
 
+    /**
+     * Checks if a region and size select the whole image at its original size, e.g. "full/max",
+     * "0,0,w,h/w," or "square/max" of a square image.
+     */
+    static bool selects_full_image(std::shared_ptr<SipiRegion> region, std::shared_ptr<SipiSize> size,
+                                   size_t img_w, size_t img_h) {
+        try {
+            int x, y;
+            size_t w, h;
+            if (region->getType() != SipiRegion::FULL) {
+                region->crop_coords(img_w, img_h, x, y, w, h);
+                if ((x != 0) || (y != 0) || (w != img_w) || (h != img_h)) return false;
+            }
+            if (size->getType() != SipiSize::FULL) {
+                int reduce;
+                bool redonly;
+                size->get_size(img_w, img_h, w, h, reduce, redonly);
+                if ((w != img_w) || (h != img_h)) return false;
+            }
+        } catch (Sipi::SipiError &err) {
+            return false;
+        } catch (Sipi::SipiSizeError &err) {
+            return false;
+        }
+        return true;
+    }
+    //=========================================================================
+
+
     static void process_get_request(
             Connection &conn_obj,
             shttps::LuaServer &luaserver,
@@ -1388,6 +1429,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                 if (actual_mimetype == "image/tiff") in_format = SipiQualityFormat::TIF;
                 if (actual_mimetype == "image/jpeg") in_format = SipiQualityFormat::JPG;
                 if (actual_mimetype == "image/png") in_format = SipiQualityFormat::PNG;
+                if (actual_mimetype == "image/webp") in_format = SipiQualityFormat::WEBP;
                 if ((actual_mimetype == "image/jpx") || (actual_mimetype == "image/jp2"))
                     in_format = SipiQualityFormat::JP2;
                 if (actual_mimetype == "application/pdf") in_format = SipiQualityFormat::PDF;
@@ -1491,7 +1533,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
 
                 // now we check if we can send the file directly
                 //
-                if ((region->getType() == SipiRegion::FULL) && (size->getType() == SipiSize::FULL) && (angle == 0.0) &&
+                if (selects_full_image(region, size, img_w, img_h) && (angle == 0.0) &&
                     (!mirror) && watermark.empty() && (quality_format.format() == in_format) &&
                     (quality_format.quality() == SipiQualityFormat::DEFAULT) && (sid.getPage() < 1)) {
 
@@ -1504,6 +1546,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                         case SipiQualityFormat::TIF: conn_obj.header("Content-Type", "image/tiff"); break;
                         case SipiQualityFormat::JPG: conn_obj.header("Content-Type", "image/jpeg"); break;
                         case SipiQualityFormat::PNG: conn_obj.header("Content-Type", "image/png"); break;
+                        case SipiQualityFormat::WEBP: conn_obj.header("Content-Type", "image/webp"); break;
                         case SipiQualityFormat::JP2: conn_obj.header("Content-Type", "image/jp2"); break;
                         case SipiQualityFormat::PDF: conn_obj.header("Content-Type", "application/pdf"); break;
                         default: {}
@@ -1535,6 +1578,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                             case SipiQualityFormat::TIF: conn_obj.header("Content-Type", "image/tiff"); break;
                             case SipiQualityFormat::JPG: conn_obj.header("Content-Type", "image/jpeg"); break;
                             case SipiQualityFormat::PNG: conn_obj.header("Content-Type", "image/png"); break;
+                            case SipiQualityFormat::WEBP: conn_obj.header("Content-Type", "image/webp"); break;
                             case SipiQualityFormat::JP2: conn_obj.header("Content-Type", "image/jp2"); break;
                             case SipiQualityFormat::PDF: {
                                 conn_obj.header("Content-Type", "application/pdf"); // set the header (mimetype)
@@ -1566,9 +1610,67 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                     cache->deblock(cachefile);
                 }
 
+                //
+                // a JPEG which is only rotated by a multiple of 90 degrees is rotated in the DCT domain, without
+                // decoding and encoding it again
+                //
+                if ((in_format == SipiQualityFormat::JPG) && (quality_format.format() == SipiQualityFormat::JPG) &&
+                    ((quality_format.quality() == SipiQualityFormat::DEFAULT) ||
+                     (quality_format.quality() == SipiQualityFormat::COLOR)) &&
+                    !mirror && ((angle == 90.0) || (angle == 180.0) || (angle == 270.0)) && watermark.empty() &&
+                    (sid.getPage() < 1) && selects_full_image(region, size, img_w, img_h) &&
+                    Sipi::SipiIOJpeg::isLosslessRotatable(infile)) {
+                    conn_obj.header("Cache-Control", "must-revalidate, post-check=0, pre-check=0");
+                    std::string cachefile;
+                    try {
+                        if (cache != nullptr) {
+                            try {
+                                //!> open the cache file to write into.
+                                cachefile = cache->getNewCacheFileName();
+                                conn_obj.openCacheFile(cachefile);
+                            } catch (const shttps::Error &err) {
+                                send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err);
+                                return;
+                            }
+                        }
+                        conn_obj.status(Connection::OK);
+                        conn_obj.header("Link", canonical_header);
+                        conn_obj.header("Content-Type", "image/jpeg"); // set the header (mimetype)
+                        conn_obj.setChunkedTransfer();
+                        (void) Sipi::SipiIOJpeg::rotateLossless(infile, (int) angle, "HTTP", &conn_obj);
+
+                        if (conn_obj.isCacheFileOpen()) {
+                            conn_obj.closeCacheFile();
+                            cache->add(infile, canonical, cachefile, img_w, img_h, tile_w, tile_h, clevels, numpages);
+                        }
+                    } catch (const SipiImageError &err) {
+                        if (cache != nullptr) {
+                            conn_obj.closeCacheFile();
+                            unlink(cachefile.c_str());
+                        }
+                        send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err.to_string());
+                        return;
+                    }
+                    conn_obj.flush();
+                    return;
+                }
+
+                //
+                // JPEG and PNG are encoded row by row. If the image is neither rotated, watermarked nor
+                // converted to bitonal, the decoder passes its strips directly to the encoder.
+                //
+                bool by_strips = ((quality_format.format() == SipiQualityFormat::JPG) ||
+                                  (quality_format.format() == SipiQualityFormat::PNG)) &&
+                                 !mirror && (angle == 0.0) && watermark.empty() &&
+                                 (quality_format.quality() != SipiQualityFormat::BITONAL);
+
                 Sipi::SipiImage img;
                 try {
-                    img.read(infile, sid.getPage(), region, size, quality_format.format() == SipiQualityFormat::JPG, serv->scaling_quality());
+                    if (by_strips) {
+                        img.readStrips(infile, sid.getPage(), region, size, quality_format.format() == SipiQualityFormat::JPG, serv->scaling_quality());
+                    } else {
+                        img.read(infile, sid.getPage(), region, size, quality_format.format() == SipiQualityFormat::JPG, serv->scaling_quality());
+                    }
                 } catch (const SipiImageError &err) {
                     send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err.to_string());
                     return;
@@ -1661,7 +1763,7 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                             conn_obj.status(Connection::OK);
                             conn_obj.header("Link", canonical_header);
                             conn_obj.header("Content-Type", "image/tiff"); // set the header (mimetype)
-                            // no chunked transfer needed...
+                            conn_obj.setChunkedTransfer();
 
                             img.write("tif", "HTTP");
                             break;
@@ -1677,6 +1779,17 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                             break;
                         }
 
+                        case SipiQualityFormat::WEBP: {
+                            conn_obj.status(Connection::OK);
+                            conn_obj.header("Link", canonical_header);
+                            conn_obj.header("Content-Type", "image/webp"); // set the header (mimetype)
+                            conn_obj.setChunkedTransfer();
+                            Sipi::SipiCompressionParams qp = {{WEBP_quality, std::to_string(serv->webp_quality())},
+                                                              {WEBP_lossless, serv->webp_lossless() ? "yes" : "no"}};
+                            img.write("webp", "HTTP", &qp);
+                            break;
+                        }
+
                         case SipiQualityFormat::PDF: {
                             conn_obj.status(Connection::OK);
                             conn_obj.header("Link", canonical_header);
@@ -1689,12 +1802,12 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
 
                         default: {
                             // HTTP 400 (format not supported)
-                            syslog(LOG_WARNING, "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf");
+                            syslog(LOG_WARNING, "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf, .webp");
                             conn_obj.setBuffer();
                             conn_obj.status(Connection::BAD_REQUEST);
                             conn_obj.header("Content-Type", "text/plain");
                             conn_obj << "Not Implemented!\n";
-                            conn_obj << "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf\n";
+                            conn_obj << "Unsupported file format requested! Supported are .jpg, .jp2, .tif, .png, .pdf, .webp\n";
                             conn_obj.flush();
                         }
                     }
@@ -1714,6 +1827,13 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
                     }
                     send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err);
                     return;
+                } catch (const SipiImageError &err) { // e.g. decoding a strip failed
+                    if (cache != nullptr) {
+                        conn_obj.closeCacheFile();
+                        unlink(cachefile.c_str());
+                    }
+                    send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err.to_string());
+                    return;
                 }
 
                 conn_obj.flush();
@@ -1766,6 +1886,8 @@ static void knora_send_info(Connection &conn_obj, SipiHttpServer *serv, shttps::
         _salsah_prefix = "imgrep";
         _cache = nullptr;
         _scaling_quality = {HIGH, HIGH, HIGH, HIGH};
+        _webp_quality = 80;
+        _webp_lossless = false;
     }
     //=========================================================================
 
@@ -34,12 +34,15 @@
 #include "shttps/Global.h"
 #include "shttps/Hash.h"
 #include "SipiImage.h"
+#include "SipiImageKernels.h"
+#include "SipiWatermarkCache.h"
 #include "formats/SipiIOTiff.h"
 #include "formats/SipiIOJ2k.h"
 //#include "formats/SipiIOOpenJ2k.h"
 #include "formats/SipiIOJpeg.h"
 #include "formats/SipiIOPng.h"
 #include "formats/SipiIOPdf.h"
+#include "formats/SipiIOWebp.h"
 #include "shttps/Parsing.h"
 
 static const char __file__[] = __FILE__;
@@ -52,7 +55,12 @@ namespace Sipi {
             //{"jpx", std::make_shared<SipiIOOpenJ2k>()},
                                                                                {"jpg", std::make_shared<SipiIOJpeg>()},
                                                                                {"png", std::make_shared<SipiIOPng>()},
-                                                                               {"pdf", std::make_shared<SipiIOPdf>()}};
+                                                                               {"pdf", std::make_shared<SipiIOPdf>()},
+                                                                               {"webp", std::make_shared<SipiIOWebp>()}};
+
+    void SipiImage::setIO(const std::string &ftype, std::shared_ptr<SipiIO> handler) {
+        io[ftype] = handler;
+    }
 
     /* ToDo: remove if everything is OK
     std::unordered_map<std::string, std::string> SipiImage::mimetypes = {{"jpx",  "image/jp2"},
@@ -71,6 +79,7 @@ namespace Sipi {
         nc = 0;
         bps = 0;
         pixels = nullptr;
+        strips = nullptr;
         xmp = nullptr;
         icc = nullptr;
         iptc = nullptr;
@@ -81,6 +90,9 @@ namespace Sipi {
     //============================================================================
 
     SipiImage::SipiImage(const SipiImage &img_p) {
+        if (img_p.strips != nullptr) {
+            throw SipiImageError(__file__, __LINE__, "Cannot copy an image with undecoded strips, call loadStrips() first");
+        }
         nx = img_p.nx;
         ny = img_p.ny;
         nc = img_p.nc;
@@ -117,6 +129,7 @@ namespace Sipi {
         emdata = img_p.emdata;
         skip_metadata = img_p.skip_metadata;
         conobj = img_p.conobj;
+        strips = nullptr;
     }
     //============================================================================
 
@@ -175,6 +188,9 @@ namespace Sipi {
 
     SipiImage &SipiImage::operator=(const SipiImage &img_p) {
         if (this != &img_p) {
+            if (img_p.strips != nullptr) {
+                throw SipiImageError(__file__, __LINE__, "Cannot copy an image with undecoded strips, call loadStrips() first");
+            }
             nx = img_p.nx;
             ny = img_p.ny;
             nc = img_p.nc;
@@ -209,6 +225,7 @@ namespace Sipi {
             exif = std::make_shared<SipiExif>(*img_p.exif);
             skip_metadata = img_p.skip_metadata;
             conobj = img_p.conobj;
+            strips = nullptr; // the pixels have been replaced by the ones of img_p
         }
 
         return *this;
@@ -265,27 +282,61 @@ namespace Sipi {
         return true;
     }
     */
-    void SipiImage::read(std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region, std::shared_ptr<SipiSize> size,
-                         bool force_bps_8, ScalingQuality scaling_quality) {
+
+    /*!
+     * Returns the key of the I/O class reading files of the given mimetype, or an empty string
+     */
+    static std::string ftype_of_mimetype(const std::string &mimetype) {
+        if ((mimetype == "image/tiff") || (mimetype == "image/x-tiff")) return "tif";
+        if ((mimetype == "image/jpeg") || (mimetype == "image/pjpeg")) return "jpg";
+        if (mimetype == "image/png") return "png";
+        if (mimetype == "image/webp") return "webp";
+        if ((mimetype == "image/jp2") || (mimetype == "image/jpx")) return "jpx";
+        if (mimetype == "application/pdf") return "pdf";
+        return "";
+    }
+
+    /*!
+     * Returns the key of the I/O class reading the file. The format is determined from the magic number,
+     * the filename extension is used only if the magic number is unknown (e.g. raw JPEG2000 codestreams).
+     * Returns an empty string if neither is known.
+     */
+    static std::string detect_ftype(const std::string &filepath) {
+        std::string ftype;
+        try {
+            ftype = ftype_of_mimetype(shttps::Parsing::getFileMimetype(filepath).first);
+        } catch (shttps::Error &err) {
+            // the I/O classes will report an unreadable file
+        }
+        if (!ftype.empty()) return ftype;
+
         size_t pos = filepath.find_last_of('.');
         std::string fext = filepath.substr(pos + 1);
         std::string _fext;
 
-        bool got_file = false;
         _fext.resize(fext.size());
         std::transform(fext.begin(), fext.end(), _fext.begin(), ::tolower);
 
-        if ((_fext == "tif") || (_fext == "tiff")) {
-            got_file = io[std::string("tif")]->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality);
-        } else if ((_fext == "jpg") || (_fext == "jpeg")) {
-            got_file = io[std::string("jpg")]->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality);
-        } else if (_fext == "png") {
-            got_file = io[std::string("png")]->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality);
-        } else if ((_fext == "jp2") || (_fext == "jpx") || (_fext == "j2k")) {
-            got_file = io[std::string("jpx")]->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality);
-        }
+        if ((_fext == "tif") || (_fext == "tiff")) return "tif";
+        if ((_fext == "jpg") || (_fext == "jpeg")) return "jpg";
+        if (_fext == "png") return "png";
+        if (_fext == "webp") return "webp";
+        if ((_fext == "jp2") || (_fext == "jpx") || (_fext == "j2k")) return "jpx";
+        return "";
+    }
+    //============================================================================
 
-        if (!got_file) {
+    void SipiImage::read(std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region, std::shared_ptr<SipiSize> size,
+                         bool force_bps_8, ScalingQuality scaling_quality) {
+        bool got_file = false;
+        std::string ftype = detect_ftype(filepath);
+
+        if (!ftype.empty()) {
+            got_file = io[ftype]->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality);
+        } else {
+            //
+            // unknown format: we try all I/O classes
+            //
             for (auto const &iterator : io) {
                 if ((got_file = iterator.second->read(this, filepath, pagenum, region, size, force_bps_8, scaling_quality))) break;
             }
@@ -297,6 +348,37 @@ namespace Sipi {
     }
     //============================================================================
 
+    void SipiImage::readStrips(std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                               std::shared_ptr<SipiSize> size, bool force_bps_8, ScalingQuality scaling_quality) {
+        if (detect_ftype(filepath) == "jpx") {
+            if (io[std::string("jpx")]->readStrips(this, filepath, pagenum, region, size, force_bps_8, scaling_quality)) {
+                return;
+            }
+        }
+        read(filepath, pagenum, region, size, force_bps_8, scaling_quality);
+    }
+    //============================================================================
+
+    void SipiImage::loadStrips(void) {
+        if (strips == nullptr) return;
+
+        size_t rowsize = nx * nc * bps / 8;
+        byte *buf = new byte[ny * rowsize];
+        size_t row = 0;
+        size_t n;
+        try {
+            while ((row < ny) && ((n = strips->pull(buf + row * rowsize)) > 0)) row += n;
+        } catch (...) {
+            delete[] buf;
+            strips = nullptr;
+            throw;
+        }
+        strips = nullptr;
+        delete[] pixels;
+        pixels = buf;
+    }
+    //============================================================================
+
     bool SipiImage::readOriginal(const std::string &filepath, int pagenum, std::shared_ptr<SipiRegion> region,
                                  std::shared_ptr<SipiSize> size, shttps::HashType htype) {
         read(filepath, pagenum, region, size, false);
@@ -352,30 +434,19 @@ namespace Sipi {
     //============================================================================
 
     SipiImgInfo SipiImage::getDim(std::string filepath, int pagenum) {
-        size_t pos = filepath.find_last_of('.');
-        std::string fext = filepath.substr(pos + 1);
-        std::string _fext;
-
-        _fext.resize(fext.size());
-        std::transform(fext.begin(), fext.end(), _fext.begin(), ::tolower);
-
         SipiImgInfo info;
         std::string mimetype = shttps::Parsing::getFileMimetype(filepath).first;
+        std::string ftype = ftype_of_mimetype(mimetype);
 
-        if ((mimetype == "image/tiff") || (mimetype == "image/x-tiff")) {
-            info = io[std::string("tif")]->getDim(filepath, pagenum);
-        } else if ((mimetype == "image/jpeg") || (mimetype == "image/pjpeg")) {
-            info = io[std::string("jpg")]->getDim(filepath, pagenum);
-        } else if (mimetype == "image/png") {
-            info = io[std::string("png")]->getDim(filepath, pagenum);
-        } else if ((mimetype == "image/jp2") || (mimetype == "image/jpx")) {
-            info = io[std::string("jpx")]->getDim(filepath, pagenum);
-        } else if (mimetype == "application/pdf") {
-            info = io[std::string("pdf")]->getDim(filepath, pagenum);
+        if (!ftype.empty()) {
+            info = io[ftype]->getDim(filepath, pagenum);
         }
         info.internalmimetype = mimetype;
 
-        if (info.success == SipiImgInfo::FAILURE) {
+        if (ftype.empty()) {
+            //
+            // unknown format: we try all I/O classes
+            //
             for (auto const &iterator : io) {
                 info = iterator.second->getDim(filepath, pagenum);
                 if (info.success != SipiImgInfo::FAILURE) break;
@@ -397,71 +468,61 @@ namespace Sipi {
     //============================================================================
 
     void SipiImage::write(std::string ftype, std::string filepath, const SipiCompressionParams *params) {
+        if ((ftype != "jpg") && (ftype != "png")) loadStrips(); // only JPEG and PNG are written strip by strip
         io[ftype]->write(this, filepath, params);
    }
     //============================================================================
 
     void SipiImage::convertYCC2RGB(void) {
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[(size_t) nc * (size_t) nx * (size_t) ny];
-
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    double Y = (double) inbuf[nc * (j * nx + i) + 2];
-                    double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
-                    double Cr = (double) inbuf[nc * (j * nx + i) + 0];
-
-                    int r = (int) (Y + 1.40200 * (Cr - 0x80));
-                    int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
-                    int b = (int) (Y + 1.77200 * (Cb - 0x80));
-
-                    outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(255, r));
-                    outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(255, g));
-                    outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(255, b));
-
-                    for (size_t k = 3; k < nc; k++) {
-                        outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
-                    }
-                }
-            }
-
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            size_t nnc = nc - 1;
-            unsigned short *outbuf = new unsigned short[nnc * nx * ny];
-
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    double Y = (double) inbuf[nc * (j * nx + i) + 2];
-                    double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
-                    double Cr = (double) inbuf[nc * (j * nx + i) + 0];
-
-                    int r = (int) (Y + 1.40200 * (Cr - 0x80));
-                    int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
-                    int b = (int) (Y + 1.77200 * (Cb - 0x80));
-
-                    outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(65535, r));
-                    outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(65535, g));
-                    outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(65535, b));
-
-                    for (size_t k = 3; k < nc; k++) {
-                        outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
-                    }
-                }
-            }
-
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
+        loadStrips();
+        if ((bps != 8) && (bps != 16)) {
             std::string msg = "Bits per sample is not supported for operation: " + std::to_string(bps);
             throw SipiImageError(__file__, __LINE__, msg);
         }
+        if (nc < 3) {
+            std::string msg = "YCbCr conversion needs at least 3 channels, got: " + std::to_string(nc);
+            throw SipiImageError(__file__, __LINE__, msg);
+        }
+
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[nx * ny * nc * bps / 8];
+        size_t rowsize = nx * nc * bps / 8;
+        size_t bits = bps, channels = nc, width = nx;
+        parallel_strips(ny, nx, [=](size_t first, size_t end) {
+            dispatch_kernel<YCC2RGBKernel>(bits, channels, (const byte *) (inbuf + first * rowsize),
+                                           outbuf + first * rowsize, (end - first) * width);
+        });
+        pixels = outbuf;
+        delete[] inbuf;
     }
     //============================================================================
 
+    /*!
+     * Strip source which converts the strips of another strip source with a color transform
+     */
+    class IccStripSource : public SipiStripSource {
+    private:
+        std::shared_ptr<SipiStripSource> source;
+        SipiIccTransformCache::Transform transform;
+        size_t width;
+        std::unique_ptr<byte[]> inbuf;
+
+    public:
+        IccStripSource(std::shared_ptr<SipiStripSource> source_p, SipiIccTransformCache::Transform transform_p,
+                       size_t width_p, size_t in_rowsize)
+                : source(source_p), transform(transform_p), width(width_p),
+                  inbuf(shttps::make_unique<byte[]>(source_p->stripHeight() * in_rowsize)) {}
+
+        size_t stripHeight() override { return source->stripHeight(); }
+
+        size_t pull(byte *buf) override {
+            size_t rows = source->pull(inbuf.get());
+            if (rows > 0) cmsDoTransform(transform.get(), inbuf.get(), buf, (cmsUInt32Number) (rows * width));
+            return rows;
+        }
+    };
+    //============================================================================
+
     void SipiImage::convertToIcc(const SipiIcc &target_icc_p, int new_bps) {
         cmsSetLogErrorHandler(icc_error_logger);
         cmsUInt32Number in_formatter, out_formatter;
@@ -495,24 +556,47 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Unsupported bits/sample (" + std::to_string(bps) + ")");
         }
 
-        cmsHTRANSFORM hTransform;
+        //
+        // sRGB to sRGB with the same number of channels and bits/sample: nothing to do
+        //
+        if ((icc->getProfileType() == icc_sRGB) && (target_icc_p.getProfileType() == icc_sRGB) &&
+            (photo == RGB) && (nc == nnc) && (bps == new_bps)) {
+            return;
+        }
+
         in_formatter = icc->iccFormatter(this);
         out_formatter = target_icc_p.iccFormatter(new_bps);
 
-        hTransform = cmsCreateTransform(icc->getIccProfile(), in_formatter, target_icc_p.getIccProfile(), out_formatter,
-                                        INTENT_PERCEPTUAL, 0);
-
-        if (hTransform == nullptr) {
+        SipiIccTransformCache::Transform transform;
+        try {
+            transform = SipiIccTransformCache::instance().get(*icc, in_formatter, target_icc_p, out_formatter,
+                                                              INTENT_PERCEPTUAL);
+        } catch (SipiError &err) {
             throw SipiImageError(__file__, __LINE__, "Couldn't create color transform");
         }
 
-        byte *inbuf = pixels;
-        byte *outbuf = new byte[nx * ny * nnc * new_bps / 8];
-        cmsDoTransform(hTransform, inbuf, outbuf, nx * ny);
-        cmsDeleteTransform(hTransform);
+        size_t in_rowsize = nx * nc * bps / 8;
+        if (strips != nullptr) {
+            //
+            // the pixels are not decoded yet, convert each strip when it is pulled by the writer
+            //
+            strips = std::make_shared<IccStripSource>(strips, transform, nx, in_rowsize);
+        } else {
+            //
+            // the cached transforms don't use the littleCMS 1-pixel cache, so all strips may share the transform
+            //
+            byte *inbuf = pixels;
+            byte *outbuf = new byte[nx * ny * nnc * new_bps / 8];
+            size_t out_rowsize = nx * nnc * new_bps / 8;
+            size_t width = nx;
+            parallel_strips(ny, nx, [=](size_t first, size_t end) {
+                cmsDoTransform(transform.get(), inbuf + first * in_rowsize, outbuf + first * out_rowsize,
+                               (cmsUInt32Number) ((end - first) * width));
+            });
+            pixels = outbuf;
+            delete[] inbuf;
+        }
         icc = std::make_shared<SipiIcc>(target_icc_p);
-        pixels = outbuf;
-        delete[] inbuf;
         nc = nnc;
         bps = new_bps;
 
@@ -550,6 +634,7 @@ namespace Sipi {
 
 
     void SipiImage::removeChan(unsigned int chan) {
+        loadStrips();
         if ((nc == 1) || (chan >= nc)) {
             std::string msg = "Cannot remove component: nc=" + std::to_string(nc) + " chan=" + std::to_string(chan);
             throw SipiImageError(__file__, __LINE__, msg);
@@ -572,44 +657,15 @@ namespace Sipi {
             }
         }
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            size_t nnc = nc - 1;
-            byte *outbuf = new byte[(size_t) nnc * (size_t) nx * (size_t) ny];
-
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        if (k == chan) continue;
-                        outbuf[nnc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
-                    }
-                }
-            }
-
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            size_t nnc = nc - 1;
-            unsigned short *outbuf = new unsigned short[nnc * nx * ny];
-
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        if (k == chan) continue;
-                        outbuf[nnc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
-                    }
-                }
-            }
-
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
-            if (bps != 8) {
-                std::string msg = "Bits per sample is not supported for operation: " + std::to_string(bps);
-                throw SipiImageError(__file__, __LINE__, msg);
-            }
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[(nc - 1) * nx * ny * bps / 8];
+        if (!dispatch_kernel<RemoveChanKernel>(bps, nc, (const byte *) inbuf, outbuf, nx * ny, (size_t) chan)) {
+            delete[] outbuf;
+            std::string msg = "Bits per sample is not supported for operation: " + std::to_string(bps);
+            throw SipiImageError(__file__, __LINE__, msg);
         }
+        pixels = outbuf;
+        delete[] inbuf;
 
         nc--;
     }
@@ -617,6 +673,7 @@ namespace Sipi {
 
 
     bool SipiImage::crop(int x, int y, size_t width, size_t height) {
+        loadStrips();
         if (x < 0) {
             width += x;
             x = 0;
@@ -645,38 +702,22 @@ namespace Sipi {
 
         if ((x == 0) && (y == 0) && (width == nx) && (height == ny)) return true; //we do not have to crop!!
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[width * height * nc];
-
-            for (size_t j = 0; j < height; j++) {
-                for (size_t i = 0; i < width; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * width + i) + k] = inbuf[nc * ((j + y) * nx + (i + x)) + k];
-                    }
-                }
-            }
+        if ((bps != 8) && (bps != 16)) return false;
 
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            word *outbuf = new word[width * height * nc];
-
-            for (size_t j = 0; j < height; j++) {
-                for (size_t i = 0; i < width; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * width + i) + k] = inbuf[nc * ((j + y) * nx + (i + x)) + k];
-                    }
-                }
-            }
+        //
+        // the pixels of a row of the region are contiguous, thus we copy row by row
+        //
+        const size_t psize = nc * bps / 8; // bytes per pixel
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[width * height * psize];
 
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
-            // clean up and throw exception
+        for (size_t j = 0; j < height; j++) {
+            memcpy(outbuf + j * width * psize, inbuf + ((j + y) * nx + x) * psize, width * psize);
         }
 
+        pixels = outbuf;
+        delete[] inbuf;
+
         nx = width;
         ny = height;
 
@@ -691,41 +732,7 @@ namespace Sipi {
         if (region->getType() == SipiRegion::FULL) return true; // we do not have to crop;
         region->crop_coords(nx, ny, x, y, width, height);
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[width * height * nc];
-
-            for (size_t j = 0; j < height; j++) {
-                for (size_t i = 0; i < width; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * width + i) + k] = inbuf[nc * ((j + y) * nx + (i + x)) + k];
-                    }
-                }
-            }
-
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            word *outbuf = new word[width * height * nc];
-
-            for (size_t j = 0; j < height; j++) {
-                for (size_t i = 0; i < width; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * width + i) + k] = inbuf[nc * ((j + y) * nx + (i + x)) + k];
-                    }
-                }
-            }
-
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
-            // clean up and throw exception
-        }
-
-        nx = width;
-        ny = height;
-        return true;
+        return crop(x, y, width, height);
     }
     //============================================================================
 
@@ -787,6 +794,7 @@ namespace Sipi {
 #undef POSITION
 
     bool SipiImage::scaleFast(size_t nnx, size_t nny) {
+        loadStrips();
         auto xlut = shttps::make_unique<size_t[]>(nnx);
         auto ylut = shttps::make_unique<size_t[]>(nny);
 
@@ -797,35 +805,14 @@ namespace Sipi {
             ylut[i] = (size_t) (i * (ny - 1) / (nny - 1 ) + 0.5);
         }
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[nnx * nny * nc];
-            for (size_t y = 0; y < nny; y++) {
-                for (size_t x = 0; x < nnx; x++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (y * nnx + x) + k] = inbuf[nc * (ylut[y] * nx + xlut[x]) + k];
-                    }
-                }
-            }
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            word *outbuf = new word[nnx * nny * nc];
-            for (size_t y = 0; y < nny; y++) {
-                for (size_t x = 0; x < nnx; x++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (y * nnx + x) + k] = inbuf[nc * (ylut[y] * nx + xlut[x]) + k];
-                    }
-                }
-            }
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-
-        } else {
-            return false;
+        if ((bps != 8) && (bps != 16)) return false;
 
-        }
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[nnx * nny * nc * bps / 8];
+        dispatch_kernel<ScaleFastKernel>(bps, nc, (const byte *) inbuf, nx, outbuf, nnx, nny,
+                                         (const size_t *) xlut.get(), (const size_t *) ylut.get());
+        pixels = outbuf;
+        delete[] inbuf;
 
         nx = nnx;
         ny = nny;
@@ -835,6 +822,7 @@ namespace Sipi {
 
 
     bool SipiImage::scaleMedium(size_t nnx, size_t nny) {
+        loadStrips();
         auto xlut = shttps::make_unique<float[]>(nnx);
         auto ylut = shttps::make_unique<float[]>(nny);
 
@@ -845,43 +833,14 @@ namespace Sipi {
             ylut[j] = (float) (j * (ny - 1)) / (float) (nny - 1);
         }
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[nnx * nny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
-
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            word *outbuf = new word[nnx * nny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
+        if ((bps != 8) && (bps != 16)) return false;
 
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
-            return false;
-        }
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[nnx * nny * nc * bps / 8];
+        dispatch_kernel<BilinearKernel>(bps, nc, (const byte *) inbuf, nx, outbuf, nnx, nny,
+                                        (const float *) xlut.get(), (const float *) ylut.get());
+        pixels = outbuf;
+        delete[] inbuf;
 
         nx = nnx;
         ny = nny;
@@ -891,6 +850,7 @@ namespace Sipi {
 
 
     bool SipiImage::scale(size_t nnx, size_t nny) {
+        loadStrips();
         size_t iix = 1, iiy = 1;
         size_t nnnx, nnny;
 
@@ -924,92 +884,24 @@ namespace Sipi {
             ylut[j] = (float) (j * (ny - 1)) / (float) (nnny - 1);
         }
 
-        if (bps == 8) {
-            byte *inbuf = pixels;
-            byte *outbuf = new byte[nnnx * nnny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nnny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
+        if ((bps != 8) && (bps != 16)) return false;
 
-            pixels = outbuf;
-            delete[] inbuf;
-        } else if (bps == 16) {
-            word *inbuf = (word *) pixels;
-            word *outbuf = new word[nnnx * nnny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nnny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
-
-            pixels = (byte *) outbuf;
-            delete[] inbuf;
-        } else {
-            return false;
-            // clean up and throw exception
-        }
+        byte *inbuf = pixels;
+        byte *outbuf = new byte[nnnx * nnny * nc * bps / 8];
+        dispatch_kernel<BilinearKernel>(bps, nc, (const byte *) inbuf, nx, outbuf, nnnx, nnny,
+                                        (const float *) xlut.get(), (const float *) ylut.get());
+        pixels = outbuf;
+        delete[] inbuf;
 
         //
         // now we have to check if we have to average the pixels
         //
         if ((iix > 1) || (iiy > 1)) {
-            if (bps == 8) {
-                byte *inbuf = pixels;
-                byte *outbuf = new byte[nnx * nny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            unsigned int accu = 0;
-
-                            for (size_t jj = 0; jj < iiy; jj++) {
-                                for (size_t ii = 0; ii < iix; ii++) {
-                                    accu += inbuf[nc * ((iiy * j + jj) * nnnx + (iix * i + ii)) + k];
-                                }
-                            }
-
-                            outbuf[nc * (j * nnx + i) + k] = accu / (iix * iiy);
-                        }
-                    }
-                }
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nnx * nny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            unsigned int accu = 0;
-
-                            for (size_t jj = 0; jj < iiy; jj++) {
-                                for (size_t ii = 0; ii < iix; ii++) {
-                                    accu += inbuf[nc * ((iiy * j + jj) * nnnx + (iix * i + ii)) + k];
-                                }
-                            }
-
-                            outbuf[nc * (j * nnx + i) + k] = accu / (iix * iiy);
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
+            inbuf = pixels;
+            outbuf = new byte[nnx * nny * nc * bps / 8];
+            dispatch_kernel<BoxAverageKernel>(bps, nc, (const byte *) inbuf, nnnx, outbuf, nnx, nny, iix, iiy);
+            pixels = outbuf;
+            delete[] inbuf;
         }
 
         nx = nnx;
@@ -1020,38 +912,11 @@ namespace Sipi {
 
 
     bool SipiImage::rotate(float angle, bool mirror) {
-        if (mirror) {
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-                for (size_t j = 0; j < ny; j++) {
-                    for (size_t i = 0; i < nx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
+        loadStrips();
+        if ((bps != 8) && (bps != 16)) return false;
 
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < ny; j++) {
-                    for (size_t i = 0; i < nx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            } else {
-                return false;
-                // clean up and throw exception
-            }
+        if (mirror) {
+            dispatch_kernel<MirrorKernel>(bps, nc, pixels, nx, ny);
         }
 
         while (angle < 0.) angle += 360.;
@@ -1066,80 +931,23 @@ namespace Sipi {
             //            qke
             //            rlf
             //
-            size_t nnx = ny;
-            size_t nny = nx;
-
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - i - 1) * nx + j) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - i - 1) * nx + j) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
-
-            nx = nnx;
-            ny = nny;
+            byte *inbuf = pixels;
+            byte *outbuf = new byte[nx * ny * nc * bps / 8];
+            size_t bits = bps, channels = nc, width = nx, height = ny;
+            parallel_strips(nx, ny, [=](size_t first, size_t end) {
+                dispatch_kernel<Rotate90Kernel>(bits, channels, (const byte *) inbuf, outbuf, width, height,
+                                                first, end);
+            });
+            pixels = outbuf;
+            delete[] inbuf;
+            std::swap(nx, ny);
         } else if (angle == 180.) {
             //
             // abcdef     rqponm
             // ghijkl ==> lkjihg
             // mnopqr     fedcba
             //
-            size_t nnx = nx;
-            size_t nny = ny;
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - j - 1) * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - j - 1) * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
-            nx = nnx;
-            ny = nny;
+            dispatch_kernel<Rotate180Kernel>(bps, nc, pixels, nx, ny);
         } else if (angle == 270.) {
             //
             // abcdef     flr
@@ -1149,39 +957,17 @@ namespace Sipi {
             //            bhn
             //            agm
             //
-            size_t nnx = ny;
-            size_t nny = nx;
-
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * (i * nx + (nx - j - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * (i * nx + (nx - j - 1)) + k];
-                        }
-                    }
-                }
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
-
-            nx = nnx;
-            ny = nny;
-        } else { // all other angles
+            byte *inbuf = pixels;
+            byte *outbuf = new byte[nx * ny * nc * bps / 8];
+            size_t bits = bps, channels = nc, width = nx, height = ny;
+            parallel_strips(nx, ny, [=](size_t first, size_t end) {
+                dispatch_kernel<Rotate270Kernel>(bits, channels, (const byte *) inbuf, outbuf, width, height,
+                                                 first, end);
+            });
+            pixels = outbuf;
+            delete[] inbuf;
+            std::swap(nx, ny);
+        } else if (angle != 0.) { // all other angles
             double phi = M_PI * angle / 180.0;
             float ptx = nx / 2. - .5;
             float pty = ny / 2. - .5;
@@ -1209,55 +995,13 @@ namespace Sipi {
             float pptx = ptx * (float) nnx / (float) nx;
             float ppty = pty * (float) nny / (float) ny;
 
-            if (bps == 8) {
-                byte *inbuf = pixels;
-                byte *outbuf = new byte[nnx * nny * nc];
-                byte bg = 0;
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        float rx = ((float) i - pptx) * co - ((float) j - ppty) * si + ptx;
-                        float ry = ((float) i - pptx) * si + ((float) j - ppty) * co + pty;
-
-                        if ((rx < 0.0) || (rx >= (float) (nx - 1)) || (ry < 0.0) || (ry >= (float) (ny - 1))) {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bg;
-                            }
-                        } else {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                            }
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nnx * nny * nc];
-                word bg = 0;
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        float rx = ((float) i - pptx) * co - ((float) j - ppty) * si + ptx;
-                        float ry = ((float) i - pptx) * si + ((float) j - ppty) * co + pty;
-
-                        if ((rx < 0.0) || (rx >= (float) (nx - 1)) || (ry < 0.0) || (ry >= (float) (ny - 1))) {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bg;
-                            }
-                        } else {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                            }
-                        }
-                    }
-                }
+            byte *inbuf = pixels;
+            byte *outbuf = new byte[nnx * nny * nc * bps / 8];
+            dispatch_kernel<RotateKernel>(bps, nc, (const byte *) inbuf, nx, ny, outbuf, nnx, nny,
+                                          co, si, ptx, pty, pptx, ppty);
+            pixels = outbuf;
+            delete[] inbuf;
 
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
             nx = nnx;
             ny = nny;
         }
@@ -1266,25 +1010,21 @@ namespace Sipi {
     //============================================================================
 
     bool SipiImage::to8bps(void) {
+        loadStrips();
         // little-endian architecture assumed
         //
         // we just use the shift-right operater (>> 8) to devide the values by 256 (2^8)!
-        // This is the most efficient and fastest way
+        // This is the most efficient and fastest way. The channels don't matter here, so
+        // we run over the buffer as one flat array which the compiler is able to vectorize.
         //
         if (bps == 16) {
-            //icc = NULL;
-
-            word *inbuf = (word *) pixels;
-            //byte *outbuf = new(std::nothrow) Sipi::byte[nc*nx*ny];
-            byte *outbuf = new(std::nothrow) byte[nc * nx * ny];
+            const word *inbuf = (word *) pixels;
+            const size_t nsamples = nc * nx * ny;
+            byte *outbuf = new(std::nothrow) byte[nsamples];
             if (outbuf == nullptr) return false;
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        // divide pixel values by 256 using ">> 8"
-                        outbuf[nc * (j * nx + i) + k] = (inbuf[nc * (j * nx + i) + k] >> 8);
-                    }
-                }
+            for (size_t i = 0; i < nsamples; i++) {
+                // divide pixel values by 256 using ">> 8"
+                outbuf[i] = (byte) (inbuf[i] >> 8);
             }
 
             delete[] pixels;
@@ -1298,6 +1038,7 @@ namespace Sipi {
 
 
     bool SipiImage::toBitonal(void) {
+        loadStrips();
         if ((photo != MINISBLACK) && (photo != MINISWHITE)) {
             convertToIcc(SipiIcc(icc_GRAY_D50), 8);
         }
@@ -1339,55 +1080,22 @@ namespace Sipi {
 
 
     bool SipiImage::add_watermark(std::string wmfilename) {
-        int wm_nx, wm_ny, wm_nc;
-        byte *wmbuf = read_watermark(wmfilename, wm_nx, wm_ny, wm_nc);
-        if (wmbuf == nullptr) {
-            throw SipiImageError(__file__, __LINE__, "Cannot read watermark file " + wmfilename);
-        }
-
-        auto xlut = shttps::make_unique<float[]>(nx);
-        auto ylut = shttps::make_unique<float[]>(ny);
-
-        //float *xlut = new float[nx];
-        //float *ylut = new float[ny];
-
-        for (size_t i = 0; i < nx; i++) {
-            xlut[i] = (float) (wm_nx * i) / (float) nx;
-        }
-
-        for (size_t j = 0; j < ny; j++) {
-            ylut[j] = (float) (wm_ny * j) / (float) ny;
-        }
-
-        if (bps == 8) {
-            byte *buf = pixels;
+        loadStrips();
+        if ((bps != 8) && (bps != 16)) return false;
 
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
-
-                    for (size_t k = 0; k < nc; k++) {
-                        float nval = (buf[nc * (j * nx + i) + k] / 255.) * (1.0F + val / 2550.0F) + val / 2550.0F;
-                        buf[nc * (j * nx + i) + k] = (nval > 1.0) ? 255 : floor(nval * 255. + .5);
-                    }
-                }
-            }
-        } else if (bps == 16) {
-            word *buf = (word *) pixels;
-
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
-                        float nval =
-                                (buf[nc * (j * nx + i) + k] / 65535.0F) * (1.0F + val / 655350.0F) + val / 352500.F;
-                        buf[nc * (j * nx + i) + k] = (nval > 1.0) ? (word) 65535 : (word) floor(nval * 65535. + .5);
-                    }
-                }
-            }
-        }
-
-        delete[] wmbuf;
+        //
+        // the watermark is read only once and cached already resampled to the image size
+        //
+        SipiWatermarkCache::Mask wmbuf = SipiWatermarkCache::instance().get(wmfilename, nx, ny);
+
+        byte *buf = pixels;
+        const byte *wm = wmbuf->data();
+        size_t rowsize = nx * nc * bps / 8;
+        size_t bits = bps, channels = nc, width = nx;
+        parallel_strips(ny, nx, [=](size_t first, size_t end) {
+            dispatch_kernel<WatermarkKernel>(bits, channels, buf + first * rowsize, wm + first * width,
+                                             (end - first) * width);
+        });
         return true;
     }
 
@@ -1517,6 +1225,7 @@ namespace Sipi {
     /*==========================================================================*/
 
     SipiImage &SipiImage::operator-(const SipiImage &rhs) {
+        loadStrips();
         SipiImage *lhs = new SipiImage(*this);
         *lhs -= rhs;
         return *lhs;
@@ -1640,6 +1349,7 @@ namespace Sipi {
     /*==========================================================================*/
 
     SipiImage &SipiImage::operator+(const SipiImage &rhs) {
+        loadStrips();
         SipiImage *lhs = new SipiImage(*this);
         *lhs += rhs;
         return *lhs;
@@ -1648,23 +1358,14 @@ namespace Sipi {
     /*==========================================================================*/
 
     bool SipiImage::operator==(const SipiImage &rhs) {
+        if ((strips != nullptr) || (rhs.strips != nullptr)) {
+            throw SipiImageError(__file__, __LINE__, "Cannot compare an image with undecoded strips, call loadStrips() first");
+        }
         if ((nx != rhs.nx) || (ny != rhs.ny) || (nc != rhs.nc) || (bps != rhs.bps) || (photo != rhs.photo)) {
             return false;
         }
 
-        long long n_differences = 0;
-
-        for (size_t j = 0; j < ny; j++) {
-            for (size_t i = 0; i < nx; i++) {
-                for (size_t k = 0; k < nc; k++) {
-                    if (pixels[nc * (j * nx + i) + k] != rhs.pixels[nc * (j * nx + i) + k]) {
-                        n_differences++;
-                    }
-                }
-            }
-        }
-
-        return n_differences <= 0;
+        return memcmp(pixels, rhs.pixels, nx * ny * nc * bps / 8) == 0;
     }
 
     /*==========================================================================*/
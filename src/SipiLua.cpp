@@ -924,10 +924,142 @@ namespace Sipi {
                             lua_pushstring(L, "SipiImage.write(): invalid Cuse_sop!");
                             return lua_error(L);
                           }
+                    } else if (key == std::string("Cmodes")) {
+                        comp_params[Sipi::J2K_Cmodes] = value;
+                    } else if (key == std::string("ORGgen_plt")) {
+                        if (value == "yes" || value == "no") {
+                            comp_params[Sipi::J2K_ORGgen_plt] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid ORGgen_plt!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("ORGgen_tlm")) {
+                        try {
+                            int i = std::stoi(value);
+                            if ((i < 0) || (i > 255)) throw std::out_of_range("ORGgen_tlm");
+                            value = std::to_string(i);
+                        } catch (std::invalid_argument) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid ORGgen_tlm!");
+                            return lua_error(L);
+                        } catch(std::out_of_range) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid ORGgen_tlm!");
+                            return lua_error(L);
+                        }
+                        comp_params[Sipi::J2K_ORGgen_tlm] = value;
+                    } else if (key == std::string("ORGtparts")) {
+                        comp_params[Sipi::J2K_ORGtparts] = value;
+                    } else if (key == std::string("j2k_preset")) {
+                        if (value == "deepzoom") {
+                            comp_params[Sipi::J2K_preset] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid j2k_preset!");
+                            return lua_error(L);
+                        }
                     } else if (key == std::string("rates")) {
                         comp_params[Sipi::J2K_rates] = value;
                     } else if (key == std::string("quality")) {
                         comp_params[Sipi::JPEG_QUALITY] = value;
+                    } else if (key == std::string("jpeg_profile")) {
+                        std::set<std::string> validvalues = {"baseline", "optimized", "progressive", "tile"};
+                        if (validvalues.find(value) != validvalues.end()) {
+                            comp_params[Sipi::JPEG_profile] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid jpeg_profile!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("tiff_compression")) {
+                        std::set<std::string> validvalues = {"none", "deflate", "lzw", "zstd", "jpeg"};
+                        if (validvalues.find(value) != validvalues.end()) {
+                            comp_params[Sipi::TIFF_compression] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid tiff_compression!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("tiff_predictor")) {
+                        if (value == "none" || value == "horizontal") {
+                            comp_params[Sipi::TIFF_predictor] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid tiff_predictor!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("tiff_tile")) {
+                        try {
+                            int i = std::stoi(value);
+                            if ((i < 16) || ((i % 16) != 0)) throw std::out_of_range("tiff_tile");
+                            value = std::to_string(i);
+                        } catch (std::invalid_argument) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid tiff_tile!");
+                            return lua_error(L);
+                        } catch(std::out_of_range) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid tiff_tile!");
+                            return lua_error(L);
+                        }
+                        comp_params[Sipi::TIFF_tile] = value;
+                    } else if (key == std::string("tiff_pyramid")) {
+                        if (value == "yes" || value == "no") {
+                            comp_params[Sipi::TIFF_pyramid] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid tiff_pyramid!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("png_filter")) {
+                        std::set<std::string> validvalues = {"none", "sub", "up", "average", "paeth", "adaptive"};
+                        if (validvalues.find(value) != validvalues.end()) {
+                            comp_params[Sipi::PNG_filter] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid png_filter!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("png_level")) {
+                        if ((value.size() == 1) && (value[0] >= '0') && (value[0] <= '9')) {
+                            comp_params[Sipi::PNG_level] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid png_level!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("png_parallel")) {
+                        if (value == "yes" || value == "no") {
+                            comp_params[Sipi::PNG_parallel] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid png_parallel!");
+                            return lua_error(L);
+                        }
+                    } else if (key == std::string("webp_quality")) {
+                        try {
+                            int i = std::stoi(value);
+                            if ((i < 0) || (i > 100)) throw std::out_of_range("webp_quality");
+                            value = std::to_string(i);
+                        } catch (std::invalid_argument) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid webp_quality!");
+                            return lua_error(L);
+                        } catch(std::out_of_range) {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid webp_quality!");
+                            return lua_error(L);
+                        }
+                        comp_params[Sipi::WEBP_quality] = value;
+                    } else if (key == std::string("webp_lossless")) {
+                        if (value == "yes" || value == "no") {
+                            comp_params[Sipi::WEBP_lossless] = value;
+                        } else {
+                            lua_pop(L, lua_gettop(L));
+                            lua_pushstring(L, "SipiImage.write(): invalid webp_lossless!");
+                            return lua_error(L);
+                        }
                     } else {
                         lua_pop(L, lua_gettop(L));
                         lua_pushstring(L, "SipiImage.write(): invalid compression parameter!");
@@ -967,6 +1099,8 @@ namespace Sipi {
             ftype = "jpg";
         } else if (extension == "png") {
             ftype = "png";
+        } else if (extension == "webp") {
+            ftype = "webp";
         } else if ((extension == "j2k") || (extension == "jpx") || (extension == "jp2")) {
             ftype = "jpx";
         } else {
@@ -1036,6 +1170,8 @@ namespace Sipi {
             ftype = "jpg";
         } else if (extension == "png") {
             ftype = "png";
+        } else if (extension == "webp") {
+            ftype = "webp";
         } else if ((extension == "j2k") || (extension == "jpx")) {
             ftype = "jpx";
         } else {
@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+
+#include "SipiWatermarkCache.h"
+#include "SipiImage.h"
+#include "SipiImageKernels.h"
+#include "formats/SipiIOTiff.h"
+
+static const char __file__[] = __FILE__;
+
+namespace Sipi {
+
+    SipiWatermarkCache::SipiWatermarkCache() : masks_size(0), max_masks_size(64 * 1024 * 1024), access_counter(0) {}
+    //============================================================================
+
+    SipiWatermarkCache &SipiWatermarkCache::instance() {
+        static SipiWatermarkCache cache; // thread safe initialization (C++11)
+        return cache;
+    }
+    //============================================================================
+
+    SipiWatermarkCache::WatermarkRecord SipiWatermarkCache::load(const std::string &wmfile, time_t mtime) {
+        int wm_nx, wm_ny, wm_nc;
+        unsigned char *wmbuf = read_watermark(wmfile, wm_nx, wm_ny, wm_nc);
+        if (wmbuf == nullptr) {
+            throw SipiImageError(__file__, __LINE__, "Cannot read watermark file " + wmfile);
+        }
+
+        //
+        // only the first channel is used
+        //
+        auto buf = std::make_shared<std::vector<unsigned char>>((size_t) wm_nx * wm_ny);
+        for (size_t i = 0; i < buf->size(); i++) {
+            (*buf)[i] = wmbuf[i * wm_nc];
+        }
+        delete[] wmbuf;
+
+        WatermarkRecord record;
+        record.mtime = mtime;
+        record.nx = wm_nx;
+        record.ny = wm_ny;
+        record.buf = buf;
+        return record;
+    }
+    //============================================================================
+
+    void SipiWatermarkCache::purge(size_t needed) {
+        while (!masks.empty() && (masks_size + needed > max_masks_size)) {
+            auto oldest = masks.begin();
+            for (auto it = masks.begin(); it != masks.end(); ++it) {
+                if (it->second.last_access < oldest->second.last_access) oldest = it;
+            }
+            masks_size -= oldest->second.mask->size();
+            masks.erase(oldest);
+        }
+    }
+    //============================================================================
+
+    SipiWatermarkCache::Mask SipiWatermarkCache::get(const std::string &wmfile, size_t nx, size_t ny) {
+        struct stat fileinfo;
+        if (stat(wmfile.c_str(), &fileinfo) != 0) {
+            throw SipiImageError(__file__, __LINE__, "Cannot read watermark file " + wmfile);
+        }
+        time_t mtime = fileinfo.st_mtime;
+        std::string key = wmfile + "|" + std::to_string(nx) + "x" + std::to_string(ny);
+
+        WatermarkRecord watermark;
+        {
+            std::lock_guard<std::mutex> lock(locking);
+            auto mask = masks.find(key);
+            if ((mask != masks.end()) && (mask->second.mtime == mtime)) {
+                mask->second.last_access = ++access_counter;
+                return mask->second.mask;
+            }
+            auto wm = watermarks.find(wmfile);
+            if ((wm != watermarks.end()) && (wm->second.mtime == mtime)) {
+                watermark = wm->second;
+            }
+        }
+
+        //
+        // reading and resampling is done without holding the lock
+        //
+        if (watermark.buf == nullptr) {
+            watermark = load(wmfile, mtime);
+            std::lock_guard<std::mutex> lock(locking);
+            watermarks[wmfile] = watermark;
+        }
+
+        auto resampled = std::make_shared<std::vector<unsigned char>>(nx * ny);
+        const float xmax = (float) (watermark.nx - 1);
+        const float ymax = (float) (watermark.ny - 1);
+        for (size_t j = 0; j < ny; j++) {
+            float y = std::min((float) (watermark.ny * j) / (float) ny, ymax);
+            for (size_t i = 0; i < nx; i++) {
+                float x = std::min((float) (watermark.nx * i) / (float) nx, xmax);
+                bilinear_sample<unsigned char, 1>(watermark.buf->data(), watermark.nx, 1, x, y,
+                                                  resampled->data() + j * nx + i);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(locking);
+        if (resampled->size() <= max_masks_size) {
+            auto old = masks.find(key);
+            if (old != masks.end()) {
+                masks_size -= old->second.mask->size();
+                masks.erase(old);
+            }
+            purge(resampled->size());
+            MaskRecord record;
+            record.mtime = mtime;
+            record.mask = resampled;
+            record.last_access = ++access_counter;
+            masks[key] = record;
+            masks_size += resampled->size();
+        }
+        return resampled;
+    }
+    //============================================================================
+
+    void SipiWatermarkCache::setMaxSize(size_t max_size) {
+        std::lock_guard<std::mutex> lock(locking);
+        max_masks_size = max_size;
+        purge(0);
+    }
+    //============================================================================
+
+    void SipiWatermarkCache::clear() {
+        std::lock_guard<std::mutex> lock(locking);
+        watermarks.clear();
+        masks.clear();
+        masks_size = 0;
+    }
+
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstring>
+
+#include "formats/SipiHeaderReader.h"
+
+namespace Sipi {
+
+    std::atomic<bool> SipiHeaderReader::enabled(true);
+
+    SipiHeaderReader::SipiHeaderReader(const std::string &filepath) : filesize(0) {
+        if ((fd = ::open(filepath.c_str(), O_RDONLY)) == -1) return;
+        struct stat fstatbuf;
+        if ((fstat(fd, &fstatbuf) != 0) || !S_ISREG(fstatbuf.st_mode)) {
+            ::close(fd);
+            fd = -1;
+            return;
+        }
+        filesize = fstatbuf.st_size;
+        head.resize(filesize < (off_t) HEAD_SIZE ? filesize : HEAD_SIZE);
+        size_t n = 0;
+        while (n < head.size()) {
+            ssize_t r = pread(fd, head.data() + n, head.size() - n, n);
+            if (r <= 0) break;
+            n += r;
+        }
+        head.resize(n);
+    }
+    //============================================================================
+
+    SipiHeaderReader::~SipiHeaderReader() {
+        if (fd != -1) ::close(fd);
+    }
+    //============================================================================
+
+    bool SipiHeaderReader::read(uint64_t offset, void *buf, size_t len) {
+        if ((fd == -1) || (offset + len > (uint64_t) filesize) || (offset + len < offset)) return false;
+        if (offset + len <= head.size()) {
+            memcpy(buf, head.data() + offset, len);
+            return true;
+        }
+        size_t n = 0;
+        while (n < len) {
+            ssize_t r = pread(fd, (unsigned char *) buf + n, len - n, offset + n);
+            if (r <= 0) return false;
+            n += r;
+        }
+        return true;
+    }
+    //============================================================================
+
+    bool SipiHeaderReader::getUint(uint64_t offset, int nbytes, bool big_endian, uint64_t &val) {
+        unsigned char buf[8];
+        if ((nbytes < 1) || (nbytes > 8) || !read(offset, buf, nbytes)) return false;
+        val = 0;
+        for (int i = 0; i < nbytes; i++) {
+            val = (val << 8) | buf[big_endian ? i : nbytes - 1 - i];
+        }
+        return true;
+    }
+    //============================================================================
+
+}
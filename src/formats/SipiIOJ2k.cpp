@@ -25,21 +25,34 @@
 #include <stdlib.h>
 #include <syslog.h>
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <vector>
 #include <cstdio>
+#include <mutex>
+#include <exception>
+#include <list>
+#include <memory>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
 
 #include <fcntl.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "shttps/Connection.h"
 #include "shttps/Global.h"
 
 #include "SipiError.h"
 #include "SipiIOJ2k.h"
+#include "SipiHeaderReader.h"
+#include "SipiImageKernels.h"
+#include "SipiSizePolicy.h"
 
 
 
@@ -191,51 +204,197 @@ class KduSipiError : public kdu_core::kdu_message {
 static KduSipiWarning kdu_sipi_warn("Kakadu-library: ");
 static KduSipiError kdu_sipi_error("Kakadu-library: ");
 
-static bool is_jpx(const char *fname) {
-  int inf;
-  int retval = 0;
-  if ((inf = ::open(fname, O_RDONLY)) != -1) {
-    char testbuf[48];
-    char sig0[] = {'\xff', '\x52'};
-    char sig1[] = {'\xff', '\x4f', '\xff', '\x51'};
-    char sig2[] = {'\x00', '\x00', '\x00', '\x0C', '\x6A', '\x50', '\x20', '\x20', '\x0D', '\x0A', '\x87',
-                   '\x0A'};
-    auto n = read(inf, testbuf, 48);
-    if ((n >= 47) && (memcmp(sig0, testbuf + 45, 2) == 0)) { retval = 1; }
-    else if ((n >= 4) && (memcmp(sig1, testbuf, 4) == 0)) { retval = 1; }
-    else if ((n >= 12) && (memcmp(sig2, testbuf, 12) == 0)) retval = 1;
+/*!
+ * Server-lifetime pool of Kakadu thread environments. Each environment is a group of
+ * threads_per_env threads (including the calling thread). An image read or write borrows an
+ * environment for its duration and returns it afterwards, so the worker threads are created
+ * once and the number of Kakadu threads per request is bounded.
+ */
+class KduThreadPool {
+ private:
+  std::mutex locking;
+  std::vector<kdu_core::kdu_thread_env *> idle;
+  int threads_per_env;
+
+  KduThreadPool() {
+    if ((threads_per_env = kdu_get_num_processors()) < 2) threads_per_env = 1;
   }
-  close(inf);
-  return retval == 1;
+
+ public:
+  static KduThreadPool &instance() {
+    static KduThreadPool pool;
+    return pool;
+  }
+
+  ~KduThreadPool() {
+    for (auto env : idle) {
+      env->change_group_owner_thread();
+      env->destroy();
+      delete env;
+    }
+  }
+
+  /*!
+   * Sets the number of threads of an environment. Environments of another size are destroyed when returned.
+   *
+   * \param[in] nthreads Number of threads, 0 to use the number of processors
+   */
+  void setThreadsPerEnv(int nthreads) {
+    std::lock_guard<std::mutex> lock(locking);
+    if (nthreads <= 0) nthreads = kdu_get_num_processors();
+    threads_per_env = nthreads < 1 ? 1 : nthreads;
+    for (auto env : idle) {
+      env->change_group_owner_thread();
+      env->destroy();
+      delete env;
+    }
+    idle.clear();
+  }
+
+  /*!
+   * Borrows a thread environment. The calling thread becomes the owner of the thread group.
+   *
+   * \returns Thread environment or nullptr if only one thread is to be used
+   */
+  kdu_core::kdu_thread_env *borrow() {
+    std::unique_lock<std::mutex> lock(locking);
+    if (threads_per_env < 2) return nullptr;
+    if (!idle.empty()) {
+      kdu_core::kdu_thread_env *env = idle.back();
+      idle.pop_back();
+      lock.unlock();
+      env->change_group_owner_thread();
+      return env;
+    }
+    const int nthreads = threads_per_env;
+    lock.unlock();
+
+    kdu_core::kdu_thread_env *env = new kdu_core::kdu_thread_env;
+    env->create();
+    for (int nt = 1; nt < nthreads; nt++) {
+      if (!env->add_thread()) break; // Unable to create all the threads requested
+    }
+    return env;
+  }
+
+  /*!
+   * Returns a thread environment to the pool. After an error, the environment is destroyed.
+   *
+   * \param[in] env Thread environment obtained from borrow()
+   * \param[in] failed True if the processing failed with an exception
+   */
+  void giveBack(kdu_core::kdu_thread_env *env, bool failed) {
+    if (env == nullptr) return;
+    if (failed) {
+      env->handle_exception(KDU_ERROR_EXCEPTION);
+      env->destroy();
+      delete env;
+      return;
+    }
+    std::unique_lock<std::mutex> lock(locking);
+    if (env->get_num_threads() == threads_per_env) {
+      idle.push_back(env);
+      return;
+    }
+    lock.unlock();
+    env->destroy();
+    delete env;
+  }
+};
+//=============================================================================
+
+/*!
+ * Thread environment borrowed from the KduThreadPool for the lifetime of this object. After the
+ * processing succeeded, the environment has to be returned with giveBack(). Otherwise (e.g. if the
+ * lease ends because of an exception) the environment is considered broken and is destroyed.
+ */
+class KduThreadEnvLease {
+ private:
+  kdu_core::kdu_thread_env *env;
+ public:
+  KduThreadEnvLease() : env(KduThreadPool::instance().borrow()) {}
+
+  ~KduThreadEnvLease() { KduThreadPool::instance().giveBack(env, true); }
+
+  KduThreadEnvLease(const KduThreadEnvLease &) = delete;
+
+  KduThreadEnvLease &operator=(const KduThreadEnvLease &) = delete;
+
+  inline kdu_core::kdu_thread_env *get() { return env; }
+
+  /*!
+   * Returns the environment to the pool after the processing succeeded
+   */
+  inline void giveBack() {
+    KduThreadPool::instance().giveBack(env, false);
+    env = nullptr;
+  }
+};
+//=============================================================================
+
+void SipiIOJ2k::setThreadBudget(int nthreads) {
+  KduThreadPool::instance().setThreadsPerEnv(nthreads);
 }
 //=============================================================================
 
+/*!
+ * Maps the size of the output image to the number of quality layers which have to be decoded.
+ * A thumbnail does not show the refinement carried by the last layers of a JPEG2000 file, so
+ * decoding only the first layers saves most of the entropy decoding.
+ */
+static SipiSizePolicy<int> j2k_layer_policy; //!< longest edge of the output image -> percentage of the layers
 
-bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
-                     std::shared_ptr<SipiSize> size, bool force_bps_8,
-                     ScalingQuality scaling_quality) {
-  if (!is_jpx(filepath.c_str())) return false; // It's not a JPGE2000....
+static bool parse_percentage(const std::string &str, int &percentage) {
+  percentage = std::stoi(str); // a trailing "%" is ignored
+  return (percentage > 0) && (percentage <= 100);
+}
 
-  int num_threads;
-  if ((num_threads = kdu_get_num_processors()) < 2) num_threads = 0;
+/*!
+ * Gets the number of quality layers to decode
+ *
+ * \param[in] nlayers Number of quality layers of the codestream
+ * \param[in] edge Longest edge of the output image
+ * \returns Maximal number of layers, 0 for all layers
+ */
+static int maxLayers(int nlayers, size_t edge) {
+  int percentage;
+  if (!j2k_layer_policy.get(edge, percentage) || (percentage == 100) || (nlayers < 2)) return 0;
+  int max_layers = (nlayers * percentage + 99) / 100;
+  return (max_layers < 1) ? 1 : max_layers;
+}
+//=============================================================================
 
-  // Custom messaging services
-  kdu_customize_warnings(&kdu_sipi_warn);
-  kdu_customize_errors(&kdu_sipi_error);
+void SipiIOJ2k::setLayerPolicy(const std::string &policy) {
+  j2k_layer_policy.set(policy, parse_percentage, "JPEG2000 layer policy", "<longest edge>:<percentage>");
+}
+//=============================================================================
 
-  kdu_core::kdu_compressed_source *input = nullptr;
+/*!
+ * An opened JPEG2000 file: the JPX boxes and the main header of the codestream are parsed once,
+ * the metadata boxes are kept as raw bytes. The codestream is persistent, that is, new input
+ * restrictions can be applied for each region/reduce request.
+ */
+struct J2kOpenFile {
+  std::string filepath;
+  time_t mtime;
   kdu_supp::kdu_simple_file_source file_in;
-
   kdu_supp::jp2_family_src jp2_ultimate_src;
   kdu_supp::jpx_source jpx_in;
   kdu_supp::jpx_codestream_source jpx_stream;
-  kdu_supp::jpx_layer_source jpx_layer;
-
-  kdu_supp::jp2_channels channels;
   kdu_supp::jp2_palette palette;
-  kdu_supp::jp2_resolution resolution;
-  kdu_supp::jp2_colour colour;
+  kdu_core::kdu_compressed_source *input = nullptr;
+  kdu_core::kdu_codestream codestream;
+  std::vector<char> xmp;
+  std::vector<unsigned char> iptc;
+  std::vector<unsigned char> exif;
+
+  J2kOpenFile(const std::string &filepath_p, time_t mtime_p);
 
+  ~J2kOpenFile();
+};
+//=============================================================================
+
+J2kOpenFile::J2kOpenFile(const std::string &filepath_p, time_t mtime_p) : filepath(filepath_p), mtime(mtime_p) {
   jp2_ultimate_src.open(filepath.c_str());
 
   if (jpx_in.open(&jp2_ultimate_src, true)
@@ -251,33 +410,14 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
           kdu_byte buf[16];
           box.read(buf, 16);
           if (memcmp(buf, xmp_uuid, 16) == 0) {
-            auto xmp_len = box.get_remaining_bytes();
-            auto xmp_buf = shttps::make_unique<char[]>(xmp_len);
-            box.read((kdu_byte *) xmp_buf.get(), xmp_len);
-            try {
-              img->xmp = std::make_shared<SipiXmp>(xmp_buf.get(),
-                                                   xmp_len); // ToDo: Problem with thread safety!!!!!!!!!!!!!!
-            } catch (SipiError &err) {
-              syslog(LOG_ERR, "%s", err.to_string().c_str());
-            }
+            xmp.resize(box.get_remaining_bytes());
+            box.read((kdu_byte *) xmp.data(), xmp.size());
           } else if (memcmp(buf, iptc_uuid, 16) == 0) {
-            auto iptc_len = box.get_remaining_bytes();
-            auto iptc_buf = shttps::make_unique<unsigned char[]>(iptc_len);
-            box.read(iptc_buf.get(), iptc_len);
-            try {
-              img->iptc = std::make_shared<SipiIptc>(iptc_buf.get(), iptc_len);
-            } catch (SipiError &err) {
-              syslog(LOG_ERR, "%s", err.to_string().c_str());
-            }
+            iptc.resize(box.get_remaining_bytes());
+            box.read(iptc.data(), iptc.size());
           } else if (memcmp(buf, exif_uuid, 16) == 0) {
-            auto exif_len = box.get_remaining_bytes();
-            auto exif_buf = shttps::make_unique<unsigned char[]>(exif_len);
-            box.read(exif_buf.get(), exif_len);
-            try {
-              img->exif = std::make_shared<SipiExif>(exif_buf.get(), exif_len);
-            } catch (SipiError &err) {
-              syslog(LOG_ERR, "%s", err.to_string().c_str());
-            }
+            exif.resize(box.get_remaining_bytes());
+            box.read(exif.data(), exif.size());
           }
         }
         box.close();
@@ -290,10 +430,272 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
     palette = jpx_stream.access_palette();
   }
 
-  kdu_core::kdu_codestream codestream;
   codestream.create(input);
+  codestream.set_persistent(); // allows to apply new input restrictions for every request
   //codestream.set_fussy(); // Set the parsing error tolerance.
   codestream.set_fast(); // No errors expected in input
+}
+//=============================================================================
+
+J2kOpenFile::~J2kOpenFile() {
+  if (codestream.exists()) codestream.destroy();
+  if (input != nullptr) input->close();
+  jpx_in.close(); // Not really necessary here.
+  if (jp2_ultimate_src.exists()) jp2_ultimate_src.close();
+}
+//=============================================================================
+
+/*!
+ * Cache of opened JPEG2000 files. A tile request borrows an opened file (or opens a new one) and
+ * returns it afterwards, so the many tile requests for a popular image only pay for setting the
+ * input restrictions and decoding. An opened file is used by one request at a time. Files are
+ * identified by path and modification time; at most max_files are kept, the least recently
+ * used are closed first.
+ */
+class J2kFileCache {
+ private:
+  std::mutex locking;
+  std::list<std::unique_ptr<J2kOpenFile>> files; //!< idle opened files, most recently used first
+  size_t max_files;
+
+  J2kFileCache() : max_files(32) {}
+
+ public:
+  static J2kFileCache &instance() {
+    static J2kFileCache cache;
+    return cache;
+  }
+
+  /*!
+   * Borrows an opened file from the cache or opens the file
+   *
+   * \param[in] filepath Path to the JPEG2000 file
+   * \returns Opened file which has to be returned with giveBack()
+   */
+  std::unique_ptr<J2kOpenFile> borrow(const std::string &filepath) {
+    struct stat fileinfo;
+    time_t mtime = (stat(filepath.c_str(), &fileinfo) == 0) ? fileinfo.st_mtime : 0;
+    std::list<std::unique_ptr<J2kOpenFile>> outdated;
+    {
+      std::lock_guard<std::mutex> lock(locking);
+      for (auto it = files.begin(); it != files.end();) {
+        if ((*it)->filepath != filepath) {
+          ++it;
+        } else if ((*it)->mtime == mtime) {
+          std::unique_ptr<J2kOpenFile> file = std::move(*it);
+          files.erase(it);
+          return file;
+        } else {
+          auto next = std::next(it);
+          outdated.splice(outdated.end(), files, it); // closed after releasing the lock
+          it = next;
+        }
+      }
+    }
+    return shttps::make_unique<J2kOpenFile>(filepath, mtime);
+  }
+
+  /*!
+   * Returns an opened file to the cache
+   *
+   * \param[in] file Opened file obtained from borrow()
+   */
+  void giveBack(std::unique_ptr<J2kOpenFile> file) {
+    std::list<std::unique_ptr<J2kOpenFile>> evicted;
+    std::lock_guard<std::mutex> lock(locking);
+    files.push_front(std::move(file));
+    while (files.size() > max_files) {
+      evicted.splice(evicted.end(), files, std::prev(files.end()));
+    }
+  }
+};
+//=============================================================================
+
+/*!
+ * Opened JPEG2000 file borrowed from the J2kFileCache for the lifetime of this object. After the
+ * file has been read successfully, it has to be returned with giveBack(). Otherwise (e.g. if the
+ * lease ends because of an exception) the state of the codestream is unknown and the file is closed.
+ */
+class J2kFileLease {
+ private:
+  std::unique_ptr<J2kOpenFile> file;
+ public:
+  explicit J2kFileLease(const std::string &filepath) : file(J2kFileCache::instance().borrow(filepath)) {}
+
+  J2kFileLease(const J2kFileLease &) = delete;
+
+  J2kFileLease &operator=(const J2kFileLease &) = delete;
+
+  inline J2kOpenFile *operator->() { return file.get(); }
+
+  /*!
+   * Returns the file to the cache after it has been read successfully
+   */
+  inline void giveBack() {
+    if (file != nullptr) J2kFileCache::instance().giveBack(std::move(file));
+  }
+};
+//=============================================================================
+
+/*!
+ * Decodes the restricted codestream of a borrowed JPEG2000 file strip by strip. The file and
+ * the Kakadu threads are held until the strip source is destroyed, i.e. until the image has
+ * been written.
+ */
+class J2kStripSource : public SipiStripSource {
+ private:
+  J2kFileLease file;
+  KduThreadEnvLease env;
+  kdu_supp::kdu_stripe_decompressor decompressor;
+  bool started;
+  bool failed;
+  size_t nx;
+  size_t nc;
+  size_t bps;
+  size_t rows_left;
+  size_t strip_height;
+  bool ycc; //!< convert YCbCr to RGB after decoding
+
+ public:
+  explicit J2kStripSource(const std::string &filepath)
+      : file(filepath), started(false), failed(false), nx(0), nc(0), bps(0), rows_left(0), strip_height(0),
+        ycc(false) {}
+
+  ~J2kStripSource() {
+    if (started && !failed) {
+      try {
+        decompressor.finish();
+        if (env.get() != nullptr) env.get()->cs_terminate(file->codestream);
+        env.giveBack();
+        file.giveBack();
+      } catch (kdu_exception e) {
+        // the leases close the file and destroy the thread environment
+      }
+    }
+  }
+
+  J2kStripSource(const J2kStripSource &) = delete;
+
+  J2kStripSource &operator=(const J2kStripSource &) = delete;
+
+  inline J2kOpenFile *openFile() { return file.operator->(); }
+
+  /*!
+   * Starts decoding the codestream with the input restrictions applied
+   *
+   * \param[in] nx_p Width of the restricted codestream
+   * \param[in] ny_p Height of the restricted codestream
+   * \param[in] nc_p Number of components
+   * \param[in] bps_p Bits per sample of the decoded pixels (8 or 16)
+   * \param[in] ycc_p True to convert YCbCr to RGB
+   * \param[in] whole True to decode all rows with one pull()
+   */
+  void start(size_t nx_p, size_t ny_p, size_t nc_p, size_t bps_p, bool ycc_p, bool whole) {
+    nx = nx_p;
+    nc = nc_p;
+    bps = bps_p;
+    ycc = ycc_p;
+    rows_left = ny_p;
+    decompressor.start(file->codestream, false, false, env.get());
+    started = true;
+    if (whole) {
+      strip_height = ny_p;
+    } else {
+      std::vector<int> heights(nc, 0);
+      decompressor.get_recommended_stripe_heights(16, 1024, heights.data(), nullptr);
+      strip_height = (heights[0] > 0) ? heights[0] : 16;
+      if (strip_height > ny_p) strip_height = ny_p;
+    }
+  }
+
+  size_t stripHeight() override { return strip_height; }
+
+  size_t pull(byte *buf) override {
+    if (rows_left == 0) return 0;
+    size_t rows = (rows_left < strip_height) ? rows_left : strip_height;
+    std::vector<int> heights(nc, (int) rows);
+    try {
+      if (bps == 8) {
+        decompressor.pull_stripe((kdu_core::kdu_byte *) buf, heights.data());
+      } else {
+        std::vector<char> get_signed(nc, 0); // vector<bool> does not work -> special treatment in C++
+        decompressor.pull_stripe((kdu_core::kdu_int16 *) buf,
+                                 heights.data(),
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 (bool *) get_signed.data());
+      }
+    } catch (kdu_exception e) {
+      failed = true;
+      throw SipiImageError(__file__, __LINE__, "Error decoding JPEG2000 file \"" + file->filepath + "\"");
+    }
+    if (ycc) dispatch_kernel<YCC2RGBKernel>(bps, nc, (const byte *) buf, buf, rows * nx);
+    rows_left -= rows;
+    return rows;
+  }
+};
+//=============================================================================
+
+static bool is_jpx(const char *fname) {
+  int inf;
+  int retval = 0;
+  if ((inf = ::open(fname, O_RDONLY)) != -1) {
+    char testbuf[48];
+    char sig0[] = {'\xff', '\x52'};
+    char sig1[] = {'\xff', '\x4f', '\xff', '\x51'};
+    char sig2[] = {'\x00', '\x00', '\x00', '\x0C', '\x6A', '\x50', '\x20', '\x20', '\x0D', '\x0A', '\x87',
+                   '\x0A'};
+    auto n = read(inf, testbuf, 48);
+    if ((n >= 47) && (memcmp(sig0, testbuf + 45, 2) == 0)) { retval = 1; }
+    else if ((n >= 4) && (memcmp(sig1, testbuf, 4) == 0)) { retval = 1; }
+    else if ((n >= 12) && (memcmp(sig2, testbuf, 12) == 0)) retval = 1;
+  }
+  close(inf);
+  return retval == 1;
+}
+//=============================================================================
+
+
+bool SipiIOJ2k::decode(SipiImage *img, std::string filepath, std::shared_ptr<SipiRegion> region,
+                       std::shared_ptr<SipiSize> size, bool force_bps_8, ScalingQuality scaling_quality,
+                       bool strips) {
+  if (!is_jpx(filepath.c_str())) return false; // It's not a JPGE2000....
+
+  // Custom messaging services
+  kdu_customize_warnings(&kdu_sipi_warn);
+  kdu_customize_errors(&kdu_sipi_error);
+
+  kdu_supp::jpx_layer_source jpx_layer;
+
+  std::shared_ptr<J2kStripSource> source = std::make_shared<J2kStripSource>(filepath);
+  J2kOpenFile *file = source->openFile();
+  kdu_supp::jpx_source &jpx_in = file->jpx_in;
+  kdu_supp::jp2_palette palette = file->palette;
+  kdu_core::kdu_codestream codestream = file->codestream;
+
+  if (!file->xmp.empty()) {
+    try {
+      img->xmp = std::make_shared<SipiXmp>(file->xmp.data(), (int) file->xmp.size());
+    } catch (SipiError &err) {
+      syslog(LOG_ERR, "%s", err.to_string().c_str());
+    }
+  }
+  if (!file->iptc.empty()) {
+    try {
+      img->iptc = std::make_shared<SipiIptc>(file->iptc.data(), (unsigned int) file->iptc.size());
+    } catch (SipiError &err) {
+      syslog(LOG_ERR, "%s", err.to_string().c_str());
+    }
+  }
+  if (!file->exif.empty()) {
+    try {
+      img->exif = std::make_shared<SipiExif>(file->exif.data(), (unsigned int) file->exif.size());
+    } catch (SipiError &err) {
+      syslog(LOG_ERR, "%s", err.to_string().c_str());
+    }
+  }
 
   //
   // get the
@@ -333,18 +735,11 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
   kdu_core::kdu_dims roi;
   bool do_roi = false;
   if ((region != nullptr) && (region->getType()) != SipiRegion::FULL) {
-    try {
-      size_t sx, sy;
-      region->crop_coords(__nx, __ny, roi.pos.x, roi.pos.y, sx, sy);
-      roi.size.x = sx;
-      roi.size.y = sy;
-      do_roi = true;
-    } catch (Sipi::SipiError &err) {
-      codestream.destroy();
-      input->close();
-      jpx_in.close(); // Not really necessary here.
-      throw err;
-    }
+    size_t sx, sy;
+    region->crop_coords(__nx, __ny, roi.pos.x, roi.pos.y, sx, sy); // the opened file is closed if this throws
+    roi.size.x = sx;
+    roi.size.y = sy;
+    do_roi = true;
   }
 
   //
@@ -365,7 +760,20 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
 
   if (reduce < 0) reduce = 0;
 
-  codestream.apply_input_restrictions(0, 0, reduce, 0, do_roi ? &roi : nullptr);
+  //
+  // small output images are decoded from the first quality layers only
+  //
+  size_t out_edge;
+  if ((size != nullptr) && (size->getType() != SipiSize::FULL)) {
+    out_edge = (nnx > nny) ? nnx : nny;
+  } else if (do_roi) {
+    out_edge = (roi.size.x > roi.size.y) ? roi.size.x : roi.size.y;
+  } else {
+    out_edge = (__nx > __ny) ? __nx : __ny;
+  }
+  int max_layers = maxLayers(codestream.get_max_tile_layers(), out_edge);
+
+  codestream.apply_input_restrictions(0, 0, reduce, max_layers, do_roi ? &roi : nullptr);
 
 
   // Determine number of components to decompress
@@ -530,59 +938,36 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
   // the following code directly converts a 16-Bit jpx into an 8-bit image.
   // In order to retrieve a 16-Bit image, use kdu_uin16 *buffer an the apropriate signature of the pull_stripe method
   //
-  kdu_supp::kdu_stripe_decompressor decompressor;
-  decompressor.start(codestream);
-  int stripe_heights[4] = {dims.size.y, dims.size.y, dims.size.y,
-                           dims.size.y}; // enough for alpha channel (4 components)
-
   if (force_bps_8) img->bps = 8; // forces kakadu to convert to 8 bit!
   switch (img->bps) {
-    case 8: {
-      kdu_core::kdu_byte *buffer8 = new kdu_core::kdu_byte[(int) dims.area() * img->nc];
-      decompressor.pull_stripe(buffer8, stripe_heights);
-      img->pixels = (byte *) buffer8;
+    case 8:
+    case 16: {
       break;
     }
     case 12: {
-      std::vector<char> get_signed(img->nc, 0); // vector<bool> does not work -> special treatment in C++
-      kdu_core::kdu_int16 *buffer16 = new kdu_core::kdu_int16[(int) dims.area() * img->nc];
-      decompressor.pull_stripe(buffer16,
-                               stripe_heights,
-                               nullptr,
-                               nullptr,
-                               nullptr,
-                               nullptr,
-                               (bool *) get_signed.data());
-      img->pixels = (byte *) buffer16;
       img->bps = 16;
       break;
     }
-    case 16: {
-      std::vector<char> get_signed(img->nc, 0); // vector<bool> does not work -> special treatment in C++
-      kdu_core::kdu_int16 *buffer16 = new kdu_core::kdu_int16[(int) dims.area() * img->nc];
-      decompressor.pull_stripe(buffer16,
-                               stripe_heights,
-                               nullptr,
-                               nullptr,
-                               nullptr,
-                               nullptr,
-                               (bool *) get_signed.data());
-      img->pixels = (byte *) buffer16;
-      break;
-    }
     default: {
-      decompressor.finish();
-      codestream.destroy();
-      input->close();
-      jpx_in.close(); // Not really necessary here.
       syslog(LOG_ERR, "Unsupported number of bits/sample: %ld !", img->bps);
       throw SipiImageError(__file__, __LINE__, "Unsupported number of bits/sample!");
     }
   }
-  decompressor.finish();
-  codestream.destroy();
-  input->close();
-  jpx_in.close(); // Not really necessary here.
+
+  //
+  // If nothing but a YCbCr conversion has to be done after decoding, the strips are
+  // decoded while the image is written
+  //
+  if (strips && (rlut == NULL) && redonly) {
+    source->start(img->nx, img->ny, img->nc, img->bps, img->photo == YCBCR, false);
+    if (img->photo == YCBCR) img->photo = RGB;
+    img->strips = source;
+    return true;
+  }
+
+  source->start(img->nx, img->ny, img->nc, img->bps, false, true);
+  img->pixels = new byte[img->nx * img->ny * img->nc * img->bps / 8];
+  source->pull(img->pixels);
 
   if (rlut != NULL) {
     //
@@ -627,8 +1012,138 @@ bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::sha
 //=============================================================================
 
 
+bool SipiIOJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                     std::shared_ptr<SipiSize> size, bool force_bps_8,
+                     ScalingQuality scaling_quality) {
+  return decode(img, filepath, region, size, force_bps_8, scaling_quality, false);
+}
+//=============================================================================
+
+
+bool SipiIOJ2k::readStrips(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                           std::shared_ptr<SipiSize> size, bool force_bps_8,
+                           ScalingQuality scaling_quality) {
+  return decode(img, filepath, region, size, force_bps_8, scaling_quality, true);
+}
+//=============================================================================
+
+
+/*!
+ * Gets the dimensions, tiles and decomposition levels of the first codestream of a JPEG2000 file from the
+ * JP2 boxes and the main header of the codestream, without Kakadu. Decomposition levels given in tile headers
+ * only are not considered.
+ *
+ * \returns false if the file cannot be parsed, e.g. if the codestream is fragmented
+ */
+static bool j2k_header_info(SipiHeaderReader &hdr, SipiImgInfo &info) {
+  static const unsigned char jp2_signature[] = {0x00, 0x00, 0x00, 0x0C, 0x6A, 0x50, 0x20, 0x20, 0x0D, 0x0A, 0x87, 0x0A};
+  static const unsigned char j2k_signature[] = {0xFF, 0x4F, 0xFF, 0x51};
+  const std::vector<unsigned char> &head = hdr.first();
+
+  //
+  // find the first codestream box, the other boxes (XMP, ICC profile etc.) are skipped without reading them
+  //
+  uint64_t pos = 0;
+  if ((head.size() >= sizeof(jp2_signature)) && (memcmp(head.data(), jp2_signature, sizeof(jp2_signature)) == 0)) {
+    bool found = false;
+    for (int i = 0; (i < 256) && (pos + 8 <= (uint64_t) hdr.size()); i++) {
+      uint64_t lbox, tbox;
+      if (!hdr.getUint(pos, 4, true, lbox) || !hdr.getUint(pos + 4, 4, true, tbox)) return false;
+      uint64_t header_len = 8;
+      if (lbox == 1) { // extended length
+        if (!hdr.getUint(pos + 8, 8, true, lbox)) return false;
+        header_len = 16;
+      } else if (lbox == 0) { // box extends to the end of the file
+        lbox = hdr.size() - pos;
+      }
+      if (lbox < header_len) return false;
+      if (tbox == 0x6A703263) { // "jp2c"
+        pos += header_len;
+        found = true;
+        break;
+      }
+      if (tbox == 0x6674626C) return false; // "ftbl": the codestream is fragmented
+      pos += lbox;
+    }
+    if (!found) return false;
+  }
+
+  unsigned char soc_siz[4];
+  if (!hdr.read(pos, soc_siz, 4) || (memcmp(soc_siz, j2k_signature, 4) != 0)) return false;
+
+  //
+  // the main header: SIZ directly follows SOC, the first SOT ends the main header
+  //
+  uint64_t xsiz, ysiz, xtsiz, ytsiz, csiz;
+  if (!hdr.getUint(pos + 8, 4, true, xsiz) || !hdr.getUint(pos + 12, 4, true, ysiz) ||
+      !hdr.getUint(pos + 24, 4, true, xtsiz) || !hdr.getUint(pos + 28, 4, true, ytsiz) ||
+      !hdr.getUint(pos + 40, 2, true, csiz)) {
+    return false;
+  }
+  info.width = xsiz;
+  info.height = ysiz;
+  info.tile_width = xtsiz;
+  info.tile_height = ytsiz;
+
+  int clevels = -1;
+  std::string comment;
+  pos += 2;
+  for (int i = 0; i < 4096; i++) {
+    uint64_t marker, length;
+    if (!hdr.getUint(pos, 2, true, marker) || !hdr.getUint(pos + 2, 2, true, length) || (length < 2)) return false;
+    if (marker == 0xFF90) break; // SOT
+    uint64_t levels;
+    switch (marker) {
+      case 0xFF52: { // COD: Lcod, Scod, SGcod (4 bytes), number of decomposition levels, ..., precinct sizes
+        uint64_t scod, ppxy;
+        if (!hdr.getUint(pos + 4, 1, true, scod) || !hdr.getUint(pos + 9, 1, true, levels)) return false;
+        if ((clevels < 0) || ((int) levels < clevels)) clevels = levels;
+        if (scod & 0x01) { // user defined precincts, the last one is the one of the highest resolution
+          if (!hdr.getUint(pos + 14 + levels, 1, true, ppxy)) return false;
+          info.tile_width = std::min(info.tile_width, 1 << (ppxy & 0x0F));
+          info.tile_height = std::min(info.tile_height, 1 << (ppxy >> 4));
+        }
+        break;
+      }
+      case 0xFF53: // COC: Lcoc, Ccoc (1 or 2 bytes), Scoc, number of decomposition levels
+        if (!hdr.getUint(pos + (csiz < 257 ? 6 : 7), 1, true, levels)) return false;
+        if ((clevels < 0) || ((int) levels < clevels)) clevels = levels;
+        break;
+      case 0xFF64: // COM: Lcom, Rcom, text
+        if (comment.empty() && (length > 4)) {
+          comment.resize(length - 4);
+          if (!hdr.read(pos + 6, &comment[0], length - 4)) return false;
+          if (comment.compare(0, 5, "SIPI:") != 0) comment.clear();
+        }
+        break;
+      default:
+        break;
+    }
+    pos += 2 + length;
+  }
+  if (clevels < 0) return false; // COD is mandatory
+  info.clevels = clevels;
+  info.success = SipiImgInfo::DIMS;
+
+  while (!comment.empty() && (comment.back() == '\0')) comment.pop_back();
+  if (!comment.empty()) {
+    SipiEssentials se(comment.substr(5));
+    info.origmimetype = se.mimetype();
+    info.origname = se.origname();
+    info.success = SipiImgInfo::ALL;
+  }
+  return true;
+}
+//=============================================================================
+
+
 SipiImgInfo SipiIOJ2k::getDim(std::string filepath, int pagenum) {
   SipiImgInfo info;
+  if (SipiHeaderReader::isEnabled()) {
+    SipiHeaderReader hdr(filepath);
+    if (j2k_header_info(hdr, info)) return info;
+    info = SipiImgInfo();
+  }
   if (!is_jpx(filepath.c_str())) {
     info.success = SipiImgInfo::FAILURE;
     return info;
@@ -637,28 +1152,8 @@ SipiImgInfo SipiIOJ2k::getDim(std::string filepath, int pagenum) {
   kdu_customize_warnings(&kdu_sipi_warn);
   kdu_customize_errors(&kdu_sipi_error);
 
-  kdu_supp::jp2_family_src jp2_ultimate_src;
-  kdu_supp::jpx_source jpx_in;
-  kdu_supp::jpx_codestream_source jpx_stream;
-  kdu_core::kdu_compressed_source *input = nullptr;
-  kdu_supp::kdu_simple_file_source file_in;
-
-  jp2_ultimate_src.open(filepath.c_str());
-
-  if (jpx_in.open(&jp2_ultimate_src, true) <
-      0) { // if < 0, not compatible with JP2 or JPX.  Try opening as a raw code-stream.
-    jp2_ultimate_src.close();
-    file_in.open(filepath.c_str());
-    input = &file_in;
-  } else {
-    int stream_id = 0;
-    jpx_stream = jpx_in.access_codestream(stream_id);
-    input = jpx_stream.open_stream();
-  }
-
-  kdu_core::kdu_codestream codestream;
-  codestream.create(input);
-  codestream.set_fussy(); // Set the parsing error tolerance.
+  J2kFileLease file(filepath);
+  kdu_core::kdu_codestream codestream = file->codestream;
 
   //
   // get the size of the full image (without reduce!)
@@ -677,6 +1172,15 @@ SipiImgInfo SipiIOJ2k::getDim(std::string filepath, int pagenum) {
   siz->get(Stiles, 0, 1, __tnx);
   info.tile_width = __tnx;
   info.tile_height = __tny;
+  //
+  // precincts smaller than the tiles can be decoded separately, thus they are the tiles for IIIF
+  //
+  kdu_params *cod = siz->access_cluster(COD_params);
+  int __pnx, __pny;
+  if ((cod != nullptr) && cod->get(Cprecincts, 0, 0, __pny) && cod->get(Cprecincts, 0, 1, __pnx)) {
+    info.tile_width = std::min(info.tile_width, __pnx);
+    info.tile_height = std::min(info.tile_height, __pny);
+  }
   info.clevels = codestream.get_min_dwt_levels();
 
   kdu_codestream_comment comment = codestream.get_comment();
@@ -691,10 +1195,7 @@ SipiImgInfo SipiIOJ2k::getDim(std::string filepath, int pagenum) {
     }
     comment = codestream.get_comment(comment);
   }
-
-  codestream.destroy();
-  input->close();
-  jpx_in.close(); // Not really necessary here.
+  file.giveBack();
 
   return info;
 }
@@ -731,6 +1232,52 @@ static void write_exif_box(kdu_supp::jp2_family_tgt *tgt, kdu_core::kdu_byte *ex
 }
 //=============================================================================
 
+/*!
+ * Expands a J2K_preset into the compression parameters it stands for. Parameters given
+ * explicitly take precedence over the preset.
+ *
+ * "deepzoom" writes an untiled codestream (unless J2K_Stiles is given) with precincts of 256x256
+ * pixels at every resolution level in RPCL order, one tile-part per resolution and PLT and TLM
+ * markers. getDim advertises the precinct size as IIIF tile size, so a IIIF tile at scale factor
+ * 2^r corresponds to one precinct of resolution level r, and the markers allow the decoder to seek
+ * to it without parsing the codestream. Without tiles the low resolutions are not fragmented.
+ */
+static SipiCompressionParams expand_preset(const SipiCompressionParams &params) {
+  static const int deepzoom_precinct = 256;
+  SipiCompressionParams result = params;
+  const std::string &preset = params.at(J2K_preset);
+  if (preset != "deepzoom") {
+    throw SipiImageError(__file__, __LINE__, "Unknown JPEG2000 preset: " + preset);
+  }
+
+  int pw = deepzoom_precinct, ph = deepzoom_precinct;
+  if (params.find(J2K_Stiles) != params.end()) {
+    int tw, th;
+    if ((std::sscanf(params.at(J2K_Stiles).c_str(), "{%d,%d}", &tw, &th) != 2) || (tw <= 0) || (th <= 0)) {
+      throw SipiImageError(__file__, __LINE__, "Tiling parameter invalid!");
+    }
+    while (pw > tw) pw /= 2; // precinct sizes must be powers of 2
+    while (ph > th) ph /= 2;
+  }
+  int clevels = 8;
+  if (params.find(J2K_Clevels) != params.end()) {
+    try {
+      clevels = std::stoi(params.at(J2K_Clevels));
+      if (clevels < 0) throw std::out_of_range(params.at(J2K_Clevels));
+    } catch (const std::logic_error &err) {
+      throw SipiImageError(__file__, __LINE__, "Clevels parameter invalid: " + params.at(J2K_Clevels));
+    }
+  }
+
+  result.emplace(J2K_Cprecincts, "{" + std::to_string(pw) + "," + std::to_string(ph) + "}");
+  result.emplace(J2K_Corder, "RPCL");
+  result.emplace(J2K_ORGtparts, "R");
+  result.emplace(J2K_ORGgen_plt, "yes");
+  result.emplace(J2K_ORGgen_tlm, std::to_string(clevels + 1));
+  return result;
+}
+//=============================================================================
+
 static long get_bpp_dims(kdu_codestream &codestream) {
   int comps = codestream.get_num_components();
   int n, max_width = 0, max_height = 0;
@@ -751,11 +1298,13 @@ void SipiIOJ2k::write(SipiImage *img, std::string filepath, const SipiCompressio
   kdu_customize_warnings(&kdu_sipi_warn);
   kdu_customize_errors(&kdu_sipi_error);
 
-  int num_threads;
-
   kdu_membroker membroker;
 
-  if ((num_threads = kdu_get_num_processors()) < 2) num_threads = 0;
+  SipiCompressionParams preset_params;
+  if ((params != nullptr) && (params->find(J2K_preset) != params->end())) {
+    preset_params = expand_preset(*params);
+    params = &preset_params;
+  }
 
   try {
     // Construct code-stream object
@@ -827,21 +1376,8 @@ void SipiIOJ2k::write(SipiImage *img, std::string filepath, const SipiCompressio
 
     output = jpx_stream.access_stream();
 
-    kdu_thread_env env;
-    kdu_thread_env *env_ref;
-
-    if (num_threads > 0) {
-      env.create();
-      for (int nt = 1; nt < num_threads; nt++) {
-        if (!env.add_thread()) {
-          num_threads = nt; // Unable to create all the threads requested
-          break;
-        }
-      }
-      env_ref = &env;
-    } else {
-      env_ref = nullptr;
-    }
+    KduThreadEnvLease env;
+    kdu_thread_env *env_ref = env.get();
 
     kdu_codestream codestream;
     codestream.create(&siz, output, nullptr, 0, 0, env_ref, &membroker);
@@ -866,11 +1402,18 @@ void SipiIOJ2k::write(SipiImage *img, std::string filepath, const SipiCompressio
         codestream.access_siz()->parse_string("Sprofile=PART2");
       }
 
+      bool ht_coder = (params->find(J2K_Cmodes) != params->end()) &&
+                      (params->at(J2K_Cmodes).find("HT") != std::string::npos);
+
       if (params->find(J2K_Clayers) != params->end()) {
         num_clayers = std::stoi(params->at(J2K_Clayers));
         std::stringstream ss;
         ss << "Clayers=" << params->at(J2K_Clayers);
         codestream.access_siz()->parse_string(ss.str().c_str());
+      } else if (ht_coder) {
+        // the HT block coder is not embedded, more quality layers mostly add overhead
+        codestream.access_siz()->parse_string("Clayers=1");
+        num_clayers = 1;
       } else {
         codestream.access_siz()->parse_string("Clayers=8");
         num_clayers = 8;
@@ -916,6 +1459,30 @@ void SipiIOJ2k::write(SipiImage *img, std::string filepath, const SipiCompressio
         codestream.access_siz()->parse_string("Cuse_sop=yes");
       }
 
+      if (params->find(J2K_Cmodes) != params->end()) {
+        std::stringstream ss;
+        ss << "Cmodes=" << params->at(J2K_Cmodes);
+        codestream.access_siz()->parse_string(ss.str().c_str());
+      }
+
+      if (params->find(J2K_ORGtparts) != params->end()) {
+        std::stringstream ss;
+        ss << "ORGtparts=" << params->at(J2K_ORGtparts);
+        codestream.access_siz()->parse_string(ss.str().c_str());
+      }
+
+      if (params->find(J2K_ORGgen_plt) != params->end()) {
+        std::stringstream ss;
+        ss << "ORGgen_plt=" << params->at(J2K_ORGgen_plt);
+        codestream.access_siz()->parse_string(ss.str().c_str());
+      }
+
+      if (params->find(J2K_ORGgen_tlm) != params->end()) {
+        std::stringstream ss;
+        ss << "ORGgen_tlm=" << params->at(J2K_ORGgen_tlm);
+        codestream.access_siz()->parse_string(ss.str().c_str());
+      }
+
       if (params->find(J2K_rates) != params->end()) {
         std::string ratestr = params->at(J2K_rates);
         std::stringstream ss(ratestr);
@@ -1241,7 +1808,9 @@ void SipiIOJ2k::write(SipiImage *img, std::string filepath, const SipiCompressio
     }
     compressor.finish(0, NULL, NULL, env_ref);
     // Finally, cleanup
+    if (env_ref != nullptr) env_ref->cs_terminate(codestream);
     codestream.destroy(); // All done: simple as that.
+    env.giveBack();
     output->close(); // Not really necessary here.
     jpx_out.close();
     if (jp2_ultimate_tgt.exists()) {
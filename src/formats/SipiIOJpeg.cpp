@@ -25,9 +25,16 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
 #include <syslog.h>
 
@@ -36,7 +43,9 @@
 
 #include "SipiError.h"
 #include "SipiIOJpeg.h"
+#include "SipiHeaderReader.h"
 #include "SipiCommon.h"
+#include "SipiSizePolicy.h"
 #include "shttps/Connection.h"
 #include "shttps/makeunique.h"
 
@@ -54,27 +63,6 @@ static const char __file__[] = __FILE__;
 namespace Sipi {
     //static std::mutex inlock;
 
-    inline bool getbyte(int &c, FILE *f) {
-        if ((c = getc(f)) == EOF) {
-            return false;
-        }
-        else {
-            return true;
-        }
-    }
-
-    inline bool getword(int &c, FILE *f) {
-        int cc_ = 0;
-        int dd_ = 0;
-        if (((cc_ = getc(f)) == EOF) || ((dd_ = getc(f)) == EOF)) {
-            return false;
-        }
-        else {
-            c = (cc_ << 8) + dd_;
-            return true;
-        }
-    }
-
     /*!
      * Special exception within the JPEG routines which can be caught separately
      */
@@ -439,6 +427,127 @@ namespace Sipi {
     }
     //=============================================================================
 
+    bool SipiIOJpeg::embedded_thumbnails = false;
+
+    void SipiIOJpeg::setEmbeddedThumbnails(bool use) {
+        embedded_thumbnails = use;
+    }
+    //=============================================================================
+
+    /*!
+     * Locates the JPEG compressed thumbnail in the second IFD (IFD1) of an EXIF block
+     *
+     * \param[in] exif EXIF data starting with the TIFF header (after "Exif\0\0")
+     * \param[in] len Length of the EXIF data
+     * \param[out] thumb Start of the thumbnail within the EXIF data
+     * \param[out] thumb_len Length of the thumbnail
+     * \returns true if the EXIF data contains a JPEG thumbnail
+     */
+    static bool exif_thumbnail(const unsigned char *exif, size_t len, const unsigned char *&thumb, size_t &thumb_len) {
+        if (len < 8) return false;
+        bool big_endian;
+        if ((exif[0] == 'I') && (exif[1] == 'I')) {
+            big_endian = false;
+        } else if ((exif[0] == 'M') && (exif[1] == 'M')) {
+            big_endian = true;
+        } else {
+            return false;
+        }
+        auto get = [&](size_t offset, size_t nbytes) -> uint32_t {
+            uint32_t val = 0;
+            for (size_t i = 0; i < nbytes; i++) {
+                uint32_t b = exif[offset + i];
+                val |= big_endian ? (b << (8 * (nbytes - i - 1))) : (b << (8 * i));
+            }
+            return val;
+        };
+
+        uint32_t ifd0 = get(4, 4);
+        if ((ifd0 < 8) || (ifd0 > len - 2)) return false;
+        uint32_t nentries = get(ifd0, 2);
+        if (ifd0 + 2 + 12 * nentries + 4 > len) return false;
+        uint32_t ifd1 = get(ifd0 + 2 + 12 * nentries, 4);
+        if ((ifd1 < 8) || (ifd1 > len - 2)) return false;
+        nentries = get(ifd1, 2);
+        if (ifd1 + 2 + 12 * nentries > len) return false;
+
+        uint32_t compression = 0, offset = 0, length = 0;
+        for (uint32_t i = 0; i < nentries; i++) {
+            size_t entry = ifd1 + 2 + 12 * i;
+            uint32_t tag = get(entry, 2);
+            uint32_t type = get(entry + 2, 2);
+            size_t nbytes = (type == 3) ? 2 : 4; // SHORT or LONG
+            switch (tag) {
+                case 0x0103: compression = get(entry + 8, nbytes); break; // Compression
+                case 0x0201: offset = get(entry + 8, nbytes); break; // JPEGInterchangeFormat
+                case 0x0202: length = get(entry + 8, nbytes); break; // JPEGInterchangeFormatLength
+                default: break;
+            }
+        }
+        if ((compression != 6) || (offset == 0) || (length < 4) || (offset > len) || (length > len - offset)) {
+            return false;
+        }
+        if ((exif[offset] != 0xFF) || (exif[offset + 1] != 0xD8)) return false;
+        thumb = exif + offset;
+        thumb_len = length;
+        return true;
+    }
+    //=============================================================================
+
+    bool SipiIOJpeg::read_thumbnail(SipiImage *img, const unsigned char *data, size_t len, size_t width,
+                                    size_t height, int colspace, size_t nnx, size_t nny) {
+        struct jpeg_decompress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jerr.error_exit = jpegErrorExit;
+        jpeg_create_decompress(&cinfo);
+
+        byte *pixels = nullptr;
+        try {
+            jpeg_mem_src(&cinfo, (unsigned char *) data, (unsigned long) len);
+            if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+                jpeg_destroy_decompress(&cinfo);
+                return false;
+            }
+            //
+            // the thumbnail must not have to be upscaled and must show the whole image: some cameras
+            // letterbox the thumbnail to 4:3, its aspect ratio may differ only by rounding to full pixels
+            //
+            size_t tw = cinfo.image_width, th = cinfo.image_height;
+            long long skew = std::llabs((long long) (tw * height) - (long long) (th * width));
+            if ((tw < nnx) || (th < nny) || (skew > (long long) std::max(width, height)) ||
+                (cinfo.out_color_space != colspace) ||
+                ((colspace != JCS_RGB) && (colspace != JCS_GRAYSCALE))) {
+                jpeg_destroy_decompress(&cinfo);
+                return false;
+            }
+            cinfo.dct_method = JDCT_FLOAT;
+            jpeg_start_decompress(&cinfo);
+
+            size_t sll = cinfo.output_components * cinfo.output_width;
+            pixels = new byte[cinfo.output_height * sll];
+            while (cinfo.output_scanline < cinfo.output_height) {
+                JSAMPROW row = &(pixels[cinfo.output_scanline * sll]);
+                jpeg_read_scanlines(&cinfo, &row, 1);
+            }
+            jpeg_finish_decompress(&cinfo);
+        } catch (JpegError &jpgerr) {
+            delete[] pixels;
+            jpeg_destroy_decompress(&cinfo);
+            return false; // a broken thumbnail is ignored, the image itself is decoded
+        }
+
+        img->bps = 8;
+        img->nx = cinfo.output_width;
+        img->ny = cinfo.output_height;
+        img->nc = cinfo.output_components;
+        img->photo = (colspace == JCS_RGB) ? RGB : MINISBLACK;
+        img->pixels = pixels;
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+    //=============================================================================
+
 
     bool SipiIOJpeg::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
                           std::shared_ptr<SipiSize> size, bool force_bps_8,
@@ -553,6 +662,8 @@ namespace Sipi {
         marker = cinfo.marker_list;
         unsigned char *icc_buffer = nullptr;
         int icc_buffer_len = 0;
+        const unsigned char *thumb = nullptr;
+        size_t thumb_len = 0;
         while (marker) {
             if (marker->marker == JPEG_COM) {
                 std::string emdatastr((char *) marker->data, marker->data_length);
@@ -567,6 +678,9 @@ namespace Sipi {
                 unsigned char *pos = (unsigned char *) memmem(marker->data, marker->data_length, "Exif\000\000", 6);
                 if (pos != nullptr) {
                     img->exif = std::make_shared<SipiExif>(pos + 6, marker->data_length - (pos - marker->data) - 6);
+                    if (!exif_thumbnail(pos + 6, marker->data_length - (pos - marker->data) - 6, thumb, thumb_len)) {
+                        thumb = nullptr;
+                    }
                 }
 
                 //
@@ -658,6 +772,29 @@ namespace Sipi {
             img->icc = std::make_shared<SipiIcc>(icc_buffer, icc_buffer_len);
         }
 
+        //
+        // a small version of the whole image is scaled from the embedded EXIF thumbnail if it is large enough.
+        // EXIF (DCF) thumbnails are sRGB, so the profile of the image only applies to them if it is sRGB.
+        //
+        bool srgb = (img->icc == nullptr) || (img->icc->getProfileType() == icc_sRGB);
+        if (embedded_thumbnails && srgb && no_cropping && (rtype != SipiSize::FULL) && (thumb != nullptr) &&
+            read_thumbnail(img, thumb, thumb_len, cinfo.image_width, cinfo.image_height, cinfo.out_color_space,
+                           nnx, nny)) {
+            jpeg_destroy_decompress(&cinfo); // frees the saved markers which contain the thumbnail
+            close(infile);
+            if ((img->nx != nnx) || (img->ny != nny)) {
+                switch (scaling_quality.jpeg) {
+                    case HIGH: img->scale(nnx, nny);
+                        break;
+                    case MEDIUM: img->scaleMedium(nnx, nny);
+                        break;
+                    case LOW: img->scaleFast(nnx, nny);
+                        break;
+                }
+            }
+            return TRUE;
+        }
+
         try {
             jpeg_start_decompress(&cinfo);
         } catch (JpegError &jpgerr) {
@@ -666,9 +803,35 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
         }
 
+        //
+        // for a region only the scanlines covering it are decoded. libjpeg-turbo in addition
+        // restricts the decoding to the MCU columns of the region.
+        //
+        int rx = 0, ry = 0;
+        size_t rw = cinfo.output_width, rh = cinfo.output_height;
+        JDIMENSION xoffset = 0;
+        if (!no_cropping) {
+            try {
+                (void) region->crop_coords(cinfo.output_width, cinfo.output_height, rx, ry, rw, rh);
+#ifdef LIBJPEG_TURBO_VERSION
+                xoffset = (JDIMENSION) rx;
+                JDIMENSION cropwidth = (JDIMENSION) rw;
+                jpeg_crop_scanline(&cinfo, &xoffset, &cropwidth); // widened to iMCU boundaries, sets output_width
+#endif
+            } catch (SipiError &err) {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
+                throw;
+            } catch (JpegError &jpgerr) {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
+                throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
+            }
+        }
+
         img->bps = 8;
         img->nx = cinfo.output_width;
-        img->ny = cinfo.output_height;
+        img->ny = rh;
         img->nc = cinfo.output_components;
         int colspace = cinfo.out_color_space; // JCS_UNKNOWN, JCS_GRAYSCALE, JCS_RGB, JCS_YCbCr, JCS_CMYK, JCS_YCCK
         switch (colspace) {
@@ -703,10 +866,26 @@ namespace Sipi {
         img->pixels = new byte[img->ny * sll];
 
         try {
-            linbuf = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, sll, 1);
+            if (ry > 0) {
+#ifdef LIBJPEG_TURBO_VERSION
+                jpeg_skip_scanlines(&cinfo, (JDIMENSION) ry);
+#else
+                linbuf = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, sll, 1);
+                while (cinfo.output_scanline < (JDIMENSION) ry) {
+                    jpeg_read_scanlines(&cinfo, linbuf, 1);
+                }
+#endif
+            }
+            //
+            // the scanlines are decoded directly into the image, as many per call as the decoder delivers
+            //
+            std::vector<JSAMPROW> rows(img->ny);
             for (size_t i = 0; i < img->ny; i++) {
-                jpeg_read_scanlines(&cinfo, linbuf, 1);
-                memcpy(&(img->pixels[i * sll]), linbuf[0], (size_t) sll);
+                rows[i] = &(img->pixels[i * sll]);
+            }
+            size_t nread = 0;
+            while (nread < img->ny) {
+                nread += jpeg_read_scanlines(&cinfo, rows.data() + nread, (JDIMENSION) (img->ny - nread));
             }
         } catch (JpegError &jpgerr) {
             jpeg_destroy_decompress(&cinfo);
@@ -714,7 +893,11 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
         }
         try {
-            jpeg_finish_decompress(&cinfo);
+            if (cinfo.output_scanline < cinfo.output_height) {
+                jpeg_abort_decompress(&cinfo); // the scanlines below the region are not needed
+            } else {
+                jpeg_finish_decompress(&cinfo);
+            }
         } catch (JpegError &jpgerr) {
             close(infile);
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
@@ -735,16 +918,21 @@ namespace Sipi {
         //
         if (!no_cropping) { // not no cropping (!!) means "do crop"!
             //
-            // let's first crop the region (we read the full size image in this case)
+            // let's first crop the region (only the scanlines of the region have been decoded)
             //
-            (void) img->crop(region);
+            const int cx = rx - (int) xoffset;
+            if ((cx != 0) || (rw != img->nx)) {
+                (void) img->crop(cx, 0, rw, rh);
+            }
 
             //
             // no we scale the region to the desired size
             //
-            int reduce = -1;
-            bool redonly;
-            (void) size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
+            if (size != nullptr) {
+                int reduce = -1;
+                bool redonly;
+                (void) size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
+            }
         }
 
         //
@@ -777,52 +965,35 @@ namespace Sipi {
 
 
     SipiImgInfo SipiIOJpeg::getDim(std::string filepath, int pagenum) {
-        // portions derived from IJG code */
-
-        FILE *infile;
         SipiImgInfo info;
-
-        //
-        // open the input file
-        //
-        if ((infile = fopen(filepath.c_str(), "rb")) == nullptr) {
-            // inlock.unlock();
+        SipiHeaderReader hdr(filepath);
+        const std::vector<unsigned char> &head = hdr.first();
+        if ((head.size() < 2) || (head[0] != 0xFF) || (head[1] != 0xD8)) {
             info.success = SipiImgInfo::FAILURE;
             return info;
         }
 
-        int marker = 0;
-        int dummy = 0;
-        if (getc(infile) != 0xFF || getc(infile) != 0xD8) {
-            fclose(infile);
-            info.success = SipiImgInfo::FAILURE;
-            return info;
-        }
+        //
+        // we walk along the markers up to the frame header. The segments in between (EXIF, ICC profile etc.)
+        // are skipped without reading them, only comments are read to find the SIPI essential metadata
+        //
+        uint64_t pos = 2;
+        std::string emdatastr;
         for (;;) {
-            int discarded_bytes = 0;
-            if (!getbyte(marker, infile)) {
+            unsigned char buf[7];
+            if (!hdr.read(pos, buf, 1) || (buf[0] != 0xFF)) {
                 info.success = SipiImgInfo::FAILURE;
                 return info;
             }
-            while (marker != 0xFF) {
-                discarded_bytes++;
-                if (!getbyte(marker, infile)) {
-                    info.success = SipiImgInfo::FAILURE;
-                    return info;
-                }
-            }
-            do {
-                if (!getbyte(marker, infile)) {
+            int marker;
+            do { // skip fill bytes
+                if (!hdr.read(++pos, buf, 1)) {
                     info.success = SipiImgInfo::FAILURE;
                     return info;
                 }
+                marker = buf[0];
             } while (marker == 0xFF);
-
-            if (discarded_bytes != 0) {
-                fclose(infile);
-                info.success = SipiImgInfo::FAILURE;
-                return info;
-            }
+            pos++;
 
             switch (marker) {
                 case 0xC0:
@@ -838,71 +1009,90 @@ namespace Sipi {
                 case 0xCD:
                 case 0xCE:
                 case 0xCF: {
-                    if (!getword(dummy, infile)) { /* usual parameter length count */
-                        info.success = SipiImgInfo::FAILURE;
-                        return info;
-                    }
-                    if (!getbyte(dummy, infile)) {
+                    // length (2 bytes), precision (1 byte), height (2 bytes), width (2 bytes)
+                    if (!hdr.read(pos, buf, 7)) {
                         info.success = SipiImgInfo::FAILURE;
                         return info;
                     }
-                    int tmp_height;
-                    if (!getword(tmp_height, infile)) {
-                        info.success = SipiImgInfo::FAILURE;
-                        return info;
-                    }
-                    info.height = tmp_height;
-                    int tmp_width;
-                    if (!getword(tmp_width, infile)) {
-                        info.success = SipiImgInfo::FAILURE;
-                        return info;
-                    }
-                    info.width = tmp_width;
+                    info.height = (buf[3] << 8) + buf[4];
+                    info.width = (buf[5] << 8) + buf[6];
                     info.success = SipiImgInfo::DIMS;
-                    if (!getbyte(dummy, infile)) {
-                        info.success = SipiImgInfo::FAILURE;
-                        return info;
+                    if (emdatastr.compare(0, 5, "SIPI:", 5) == 0) {
+                        SipiEssentials se(emdatastr.substr(5));
+                        info.origmimetype = se.mimetype();
+                        info.origname = se.origname();
+                        info.success = SipiImgInfo::ALL;
                     }
-                    fclose(infile);
                     return info;
                 }
                 case 0xDA:
                 case 0xD9:
-                    fclose(infile);
                     info.success = SipiImgInfo::FAILURE;
                     return info;
+                case 0x01:
+                case 0xD0:
+                case 0xD1:
+                case 0xD2:
+                case 0xD3:
+                case 0xD4:
+                case 0xD5:
+                case 0xD6:
+                case 0xD7:
+                    break; // markers without a segment
                 default: {
-                    int length;
-                    if (!getword(length, infile)) {
-                        info.success = SipiImgInfo::FAILURE;
-                        return info;
-                    }
-                    if (length < 2) {
-                        fclose(infile);
+                    uint64_t length;
+                    if (!hdr.getUint(pos, 2, true, length) || (length < 2)) {
                         info.success = SipiImgInfo::FAILURE;
                         return info;
                     }
-                    length -= 2;
-                    while (length > 0) {
-                        if (!getbyte(dummy, infile)) {
-                            info.success = SipiImgInfo::FAILURE;
-                            return info;
-                        }
-                        length--;
+                    if ((marker == JPEG_COM) && emdatastr.empty()) {
+                        emdatastr.resize(length - 2);
+                        if (!hdr.read(pos + 2, &emdatastr[0], length - 2)) emdatastr.clear();
                     }
+                    pos += length;
                 }
-                break;
             }
         }
-        info.success = SipiImgInfo::FAILURE;
-        return info;
+    }
+    //============================================================================
+
+    /*!
+     * Encoding profiles of the JPEG writer
+     */
+    typedef enum {
+        PROFILE_BASELINE,    //!< baseline with the standard Huffman tables (fastest)
+        PROFILE_OPTIMIZED,   //!< baseline with Huffman tables optimized for the image (one extra pass)
+        PROFILE_PROGRESSIVE, //!< progressive with several scans (smallest, slowest)
+        PROFILE_TILE         //!< baseline without ICC, XMP, EXIF and IPTC payloads if the image is plain sRGB
+    } JpegProfile;
+
+    static bool parse_profile(const std::string &name, JpegProfile &profile) {
+        if (name == "baseline") profile = PROFILE_BASELINE;
+        else if (name == "optimized") profile = PROFILE_OPTIMIZED;
+        else if (name == "progressive") profile = PROFILE_PROGRESSIVE;
+        else if (name == "tile") profile = PROFILE_TILE;
+        else return false;
+        return true;
+    }
+    //============================================================================
+
+    /*!
+     * Maps the size of the output image to the encoding profile. Small images like tiles are
+     * requested often and profit most from the cheaper baseline encoding.
+     */
+    static SipiSizePolicy<JpegProfile> jpeg_profile_policy;
+    //============================================================================
+
+    void SipiIOJpeg::setProfilePolicy(const std::string &policy) {
+        jpeg_profile_policy.set(policy, parse_profile, "JPEG profile policy",
+                                "<longest edge>:<baseline|optimized|progressive|tile>");
     }
     //============================================================================
 
 
     void SipiIOJpeg::write(SipiImage *img, std::string filepath, const SipiCompressionParams *params) {
         int quality = 80;
-        if ((params != nullptr) && (!params->empty())) {
+        if ((params != nullptr) && (params->find(JPEG_QUALITY) != params->end())) {
             try {
                 quality = stoi(params->at(JPEG_QUALITY));
             }
@@ -917,6 +1107,16 @@ namespace Sipi {
             }
         }
 
+        JpegProfile profile;
+        if ((params != nullptr) && (params->find(JPEG_profile) != params->end())) {
+            if (!parse_profile(params->at(JPEG_profile), profile)) {
+                throw SipiImageError(__file__, __LINE__, "Unknown JPEG profile: " + params->at(JPEG_profile));
+            }
+        } else {
+            profile = PROFILE_PROGRESSIVE;
+            jpeg_profile_policy.get(img->nx > img->ny ? img->nx : img->ny, profile);
+        }
+
         if (img->bps == 16) img->to8bps();
 
         //
@@ -1009,14 +1209,25 @@ namespace Sipi {
                 throw SipiImageError(__file__, __LINE__, "Unsupported JPEG colorspace: " + std::to_string(img->photo));
             }
         }
-        cinfo.progressive_mode = TRUE;
-        cinfo.write_Adobe_marker = TRUE;
-        cinfo.write_JFIF_header = TRUE;
         try {
             jpeg_set_defaults(&cinfo);
             jpeg_set_quality(&cinfo, quality, TRUE /* TRUE, then limit to baseline-JPEG values */);
 
-            jpeg_simple_progression(&cinfo);
+            switch (profile) {
+                case PROFILE_BASELINE:
+                case PROFILE_TILE: {
+                    cinfo.optimize_coding = FALSE;
+                    break;
+                }
+                case PROFILE_OPTIMIZED: {
+                    cinfo.optimize_coding = TRUE;
+                    break;
+                }
+                case PROFILE_PROGRESSIVE: {
+                    jpeg_simple_progression(&cinfo);
+                    break;
+                }
+            }
             jpeg_start_compress(&cinfo, TRUE);
         } catch (JpegError &jpgerr) {
             jpeg_finish_compress(&cinfo);
@@ -1035,7 +1246,19 @@ namespace Sipi {
         //!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
         //
 
-        if (img->exif != nullptr) {
+        SipiEssentials es = img->essential_metadata();
+
+        //
+        // a tile of a plain sRGB image carries no payloads: untagged JPEGs are displayed as sRGB anyway,
+        // and the metadata is available from the full image
+        //
+        bool with_payloads = true;
+        if ((profile == PROFILE_TILE) && !es.use_icc() &&
+            ((img->icc == nullptr) || (img->icc->getProfileType() == Sipi::icc_sRGB))) {
+            with_payloads = false;
+        }
+
+        if (with_payloads && (img->exif != nullptr)) {
             std::vector<unsigned char> buf = img->exif->exifBytes();
             if (buf.size() <= 65535) {
                 char start[] = "Exif\000\000";
@@ -1057,7 +1280,7 @@ namespace Sipi {
             }
         }
 
-        if (img->xmp != nullptr) {
+        if (with_payloads && (img->xmp != nullptr)) {
             std::string buf = img->xmp->xmpBytes();
 
             if ((!buf.empty()) && (buf.size() <= 65535)) {
@@ -1079,9 +1302,7 @@ namespace Sipi {
             }
         }
 
-        SipiEssentials es = img->essential_metadata();
-
-        if ((img->icc != nullptr) || es.use_icc()) {
+        if (with_payloads && ((img->icc != nullptr) || es.use_icc())) {
             std::vector<unsigned char> buf;
             try {
                 if (es.use_icc()) {
@@ -1125,7 +1346,7 @@ namespace Sipi {
             }
         }
 
-        if (img->iptc != nullptr) {
+        if (with_payloads && (img->iptc != nullptr)) {
             std::vector<unsigned char> buf = img->iptc->iptcBytes();
             if (buf.size() <= 65535) {
                 char start[] = " Photoshop 3.0\0008BIM\004\004\000\000";
@@ -1172,17 +1393,37 @@ namespace Sipi {
         row_stride = img->nx * img->nc;    /* JSAMPLEs per row in image_buffer */
 
         try {
-            while (cinfo.next_scanline < cinfo.image_height) {
-                // jpeg_write_scanlines expects an array of pointers to scanlines.
-                // Here the array is only one element long, but you could pass
-                // more than one scanline at a time if that's more convenient.
-                row_pointer[0] = &img->pixels[cinfo.next_scanline * row_stride];
-                (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+            if (img->strips != nullptr) {
+                //
+                // the pixels are decoded strip by strip, each strip is passed to the encoder
+                // as soon as it is available
+                //
+                size_t strip_height = img->strips->stripHeight();
+                auto strip = shttps::make_unique<byte[]>(strip_height * row_stride);
+                std::vector<JSAMPROW> strip_rows(strip_height);
+                for (size_t i = 0; i < strip_height; i++) strip_rows[i] = strip.get() + i * row_stride;
+                size_t nrows;
+                while ((cinfo.next_scanline < cinfo.image_height) && ((nrows = img->strips->pull(strip.get())) > 0)) {
+                    (void) jpeg_write_scanlines(&cinfo, strip_rows.data(), (JDIMENSION) nrows);
+                }
+                img->strips = nullptr;
+            } else {
+                while (cinfo.next_scanline < cinfo.image_height) {
+                    // jpeg_write_scanlines expects an array of pointers to scanlines.
+                    // Here the array is only one element long, but you could pass
+                    // more than one scanline at a time if that's more convenient.
+                    row_pointer[0] = &img->pixels[cinfo.next_scanline * row_stride];
+                    (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+                }
             }
         } catch (JpegError &jpgerr) {
             jpeg_destroy_compress(&cinfo);
             if (outfile != -1) close(outfile);
             throw SipiImageError(__file__, __LINE__, jpgerr.what());
+        } catch (SipiImageError &err) { // decoding a strip failed
+            jpeg_destroy_compress(&cinfo);
+            if (outfile != -1) close(outfile);
+            throw;
         }
 
         try {
@@ -1198,4 +1439,217 @@ namespace Sipi {
 
     }
 
+    //============================================================================
+
+    /*!
+     * Checks if a JPEG file can be rotated in the DCT domain and gives the same result as decoding,
+     * converting to sRGB and rotating: the dimensions must be multiples of the MCU size (otherwise the
+     * partial blocks at the edges would move into the image) and the image must be YCbCr or gray, either
+     * untagged or with an sRGB profile.
+     */
+    static bool dct_rotatable(j_decompress_ptr cinfo) {
+        if ((cinfo->jpeg_color_space != JCS_YCbCr) && (cinfo->jpeg_color_space != JCS_GRAYSCALE)) return false;
+#if JPEG_LIB_VERSION >= 80
+        if (cinfo->block_size != DCTSIZE) return false;
+#endif
+        if ((cinfo->image_width % (cinfo->max_h_samp_factor * DCTSIZE)) != 0) return false;
+        if ((cinfo->image_height % (cinfo->max_v_samp_factor * DCTSIZE)) != 0) return false;
+
+        std::vector<unsigned char> icc_buf;
+        for (jpeg_saved_marker_ptr marker = cinfo->marker_list; marker != nullptr; marker = marker->next) {
+            if ((marker->marker == ICC_MARKER) && (marker->data_length > 14) &&
+                (memcmp(marker->data, "ICC_PROFILE\0", 12) == 0)) {
+                icc_buf.insert(icc_buf.end(), marker->data + 14, marker->data + marker->data_length);
+            }
+        }
+        if (!icc_buf.empty()) {
+            try {
+                SipiIcc icc(icc_buf.data(), (int) icc_buf.size());
+                if (icc.getProfileType() != Sipi::icc_sRGB) return false;
+            } catch (SipiError &err) {
+                return false;
+            }
+        }
+        return true;
+    }
+    //============================================================================
+
+    /*!
+     * Rotates one block of DCT coefficients. A transposition exchanges the horizontal and vertical
+     * frequencies, a mirror negates the odd frequencies along its axis.
+     */
+    static void rotate_block(const JCOEF *src, JCOEF *dst, int angle) {
+        for (int i = 0; i < DCTSIZE; i++) {
+            for (int j = 0; j < DCTSIZE; j++) {
+                JCOEF v = src[i * DCTSIZE + j];
+                switch (angle) {
+                    case 90: dst[j * DCTSIZE + i] = (i & 1) ? -v : v; break; // transpose, mirror horizontally
+                    case 180: dst[i * DCTSIZE + j] = ((i + j) & 1) ? -v : v; break;
+                    case 270: dst[j * DCTSIZE + i] = (j & 1) ? -v : v; break; // transpose, mirror vertically
+                }
+            }
+        }
+    }
+    //============================================================================
+
+    bool SipiIOJpeg::isLosslessRotatable(const std::string &infile) {
+        int infd;
+        if ((infd = ::open(infile.c_str(), O_RDONLY)) == -1) return false;
+
+        struct jpeg_decompress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jerr.error_exit = jpegErrorExit;
+        jpeg_create_decompress(&cinfo);
+
+        bool rotatable;
+        try {
+            jpeg_file_src(&cinfo, infd);
+            jpeg_save_markers(&cinfo, ICC_MARKER, 0xffff);
+            rotatable = (jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK) && dct_rotatable(&cinfo);
+        } catch (JpegError &jpgerr) {
+            rotatable = false;
+        }
+        jpeg_destroy_decompress(&cinfo);
+        close(infd);
+        return rotatable;
+    }
+    //============================================================================
+
+    bool SipiIOJpeg::rotateLossless(const std::string &infile, int angle, const std::string &filepath,
+                                    shttps::Connection *conobj) {
+        if ((angle != 90) && (angle != 180) && (angle != 270)) return false;
+
+        int infd;
+        if ((infd = ::open(infile.c_str(), O_RDONLY)) == -1) {
+            throw SipiImageError(__file__, __LINE__, "Cannot open file \"" + infile + "\"!");
+        }
+        int outfd = -1;
+
+        struct jpeg_decompress_struct srcinfo;
+        struct jpeg_compress_struct dstinfo;
+        struct jpeg_error_mgr srcerr;
+        struct jpeg_error_mgr dsterr;
+        srcinfo.err = jpeg_std_error(&srcerr);
+        srcerr.error_exit = jpegErrorExit;
+        dstinfo.err = jpeg_std_error(&dsterr);
+        dsterr.error_exit = jpegErrorExit;
+        jpeg_create_decompress(&srcinfo);
+        jpeg_create_compress(&dstinfo);
+
+        auto cleanup = [&]() {
+            jpeg_destroy_compress(&dstinfo);
+            jpeg_destroy_decompress(&srcinfo);
+            close(infd);
+            if (outfd != -1) close(outfd);
+        };
+
+        try {
+            jpeg_file_src(&srcinfo, infd);
+            jpeg_save_markers(&srcinfo, JPEG_COM, 0xffff);
+            for (int i = 0; i < 16; i++) {
+                jpeg_save_markers(&srcinfo, JPEG_APP0 + i, 0xffff);
+            }
+            (void) jpeg_read_header(&srcinfo, TRUE);
+            if (!dct_rotatable(&srcinfo)) {
+                cleanup();
+                return false;
+            }
+
+            //
+            // the blocks of the rotated components, requested before the coefficients are read
+            //
+            const JDIMENSION mcu_cols = srcinfo.image_width / (srcinfo.max_h_samp_factor * DCTSIZE);
+            const JDIMENSION mcu_rows = srcinfo.image_height / (srcinfo.max_v_samp_factor * DCTSIZE);
+            std::vector<jvirt_barray_ptr> dst_coefs(srcinfo.num_components);
+            for (int ci = 0; ci < srcinfo.num_components; ci++) {
+                JDIMENSION src_w = mcu_cols * srcinfo.comp_info[ci].h_samp_factor;
+                JDIMENSION src_h = mcu_rows * srcinfo.comp_info[ci].v_samp_factor;
+                dst_coefs[ci] = (*srcinfo.mem->request_virt_barray)((j_common_ptr) &srcinfo, JPOOL_IMAGE, FALSE,
+                                                                    (angle == 180) ? src_w : src_h,
+                                                                    (angle == 180) ? src_h : src_w, 1);
+            }
+            jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&srcinfo);
+
+            jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+            if (angle != 180) {
+                dstinfo.image_width = srcinfo.image_height;
+                dstinfo.image_height = srcinfo.image_width;
+                for (int ci = 0; ci < dstinfo.num_components; ci++) {
+                    std::swap(dstinfo.comp_info[ci].h_samp_factor, dstinfo.comp_info[ci].v_samp_factor);
+                }
+                //
+                // the coefficients are transposed, so the quantization tables have to be transposed as well
+                //
+                for (int n = 0; n < NUM_QUANT_TBLS; n++) {
+                    JQUANT_TBL *qtbl = dstinfo.quant_tbl_ptrs[n];
+                    if (qtbl == nullptr) continue;
+                    for (int i = 0; i < DCTSIZE; i++) {
+                        for (int j = 0; j < i; j++) {
+                            std::swap(qtbl->quantval[i * DCTSIZE + j], qtbl->quantval[j * DCTSIZE + i]);
+                        }
+                    }
+                }
+            }
+#if JPEG_LIB_VERSION >= 70
+            dstinfo.jpeg_width = dstinfo.image_width;
+            dstinfo.jpeg_height = dstinfo.image_height;
+#endif
+            if (jpeg_has_multiple_scans(&srcinfo)) jpeg_simple_progression(&dstinfo);
+
+            for (int ci = 0; ci < srcinfo.num_components; ci++) {
+                JDIMENSION src_w = mcu_cols * srcinfo.comp_info[ci].h_samp_factor;
+                JDIMENSION src_h = mcu_rows * srcinfo.comp_info[ci].v_samp_factor;
+                JDIMENSION dst_w = (angle == 180) ? src_w : src_h;
+                JDIMENSION dst_h = (angle == 180) ? src_h : src_w;
+                for (JDIMENSION dy = 0; dy < dst_h; dy++) {
+                    JBLOCKARRAY dst_row = (*srcinfo.mem->access_virt_barray)((j_common_ptr) &srcinfo, dst_coefs[ci],
+                                                                             dy, 1, TRUE);
+                    for (JDIMENSION dx = 0; dx < dst_w; dx++) {
+                        JDIMENSION sy, sx; // the source block of the destination block (dx, dy)
+                        switch (angle) {
+                            case 90: sy = dst_w - 1 - dx; sx = dy; break;
+                            case 180: sy = src_h - 1 - dy; sx = src_w - 1 - dx; break;
+                            default: sy = dx; sx = dst_h - 1 - dy; break;
+                        }
+                        JBLOCKARRAY src_row = (*srcinfo.mem->access_virt_barray)((j_common_ptr) &srcinfo,
+                                                                                 src_coefs[ci], sy, 1, FALSE);
+                        rotate_block(src_row[0][sx], dst_row[0][dx], angle);
+                    }
+                }
+            }
+
+            if (filepath == "HTTP") {
+                jpeg_html_dest(&dstinfo, conobj);
+            } else {
+                if ((outfd = ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+                    cleanup();
+                    throw SipiImageError(__file__, __LINE__, "Cannot open file \"" + filepath + "\"!");
+                }
+                jpeg_file_dest(&dstinfo, outfd);
+            }
+            jpeg_write_coefficients(&dstinfo, dst_coefs.data());
+
+            //
+            // copy the markers, except JFIF and Adobe which are written by libjpeg
+            //
+            for (jpeg_saved_marker_ptr marker = srcinfo.marker_list; marker != nullptr; marker = marker->next) {
+                if (dstinfo.write_JFIF_header && (marker->marker == JPEG_APP0) && (marker->data_length >= 5) &&
+                    (memcmp(marker->data, "JFIF", 4) == 0)) continue;
+                if (dstinfo.write_Adobe_marker && (marker->marker == JPEG_APP0 + 14) && (marker->data_length >= 5) &&
+                    (memcmp(marker->data, "Adobe", 5) == 0)) continue;
+                jpeg_write_marker(&dstinfo, marker->marker, marker->data, marker->data_length);
+            }
+
+            jpeg_finish_compress(&dstinfo);
+            (void) jpeg_finish_decompress(&srcinfo);
+        } catch (JpegError &jpgerr) {
+            cleanup();
+            throw SipiImageError(__file__, __LINE__, "Error rotating JPEG file: \"" + infile + "\": " + jpgerr.what());
+        }
+        cleanup();
+        return true;
+    }
+
 } // namespace
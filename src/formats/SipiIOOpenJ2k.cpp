@@ -22,205 +22,447 @@
  */
 #include <assert.h>
 #include <stdlib.h>
+#include <syslog.h>
+#include <string.h>
+#include <algorithm>
 #include <string>
-#include <iostream>
+#include <vector>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <cstdint>
 #include <cstdio>
 
-#include <stdio.h>
-
-#include "shttps/Connection.h"
-#include "shttps/Global.h"
-
 #include "SipiError.h"
 #include "SipiIOJ2k.h"
-
 #include "SipiIOOpenJ2k.h"
-#include "shttps/Logger.h"  // logging...
 
 #include "openjpeg.h"
 
-#define J2K_CFMT 0
-#define JP2_CFMT 1
-#define JPT_CFMT 2
-
-#define JP2_RFC3745_MAGIC "\x00\x00\x00\x0c\x6a\x50\x20\x20\x0d\x0a\x87\x0a"
-#define JP2_MAGIC "\x0d\x0a\x87\x0a"
-/* position 45: "\xff\x52" */
-#define J2K_CODESTREAM_MAGIC "\xff\x4f\xff\x51"
-
 static const char __file__[] = __FILE__;
 
 namespace Sipi {
 
-    static void error_callback(const char *msg, void *client_data) {
-        (void) client_data;
-        fprintf(stdout, "[ERROR] %s", msg);
+    static const unsigned char xmp_uuid[] = {0xBE, 0x7A, 0xCF, 0xCB, 0x97, 0xA9, 0x42, 0xE8, 0x9C, 0x71, 0x99, 0x94,
+                                             0x91, 0xE3, 0xAF, 0xAC};
+    static const unsigned char iptc_uuid[] = {0x33, 0xc7, 0xa4, 0xd2, 0xb8, 0x1d, 0x47, 0x23, 0xa0, 0xba, 0xf1, 0xa3,
+                                              0xe0, 0x97, 0xad, 0x38};
+    static const unsigned char exif_uuid[] = {'J', 'p', 'g', 'T', 'i', 'f', 'f', 'E', 'x', 'i', 'f', '-', '>', 'J',
+                                              'P', '2'};
+
+    static int openj2k_threads = 0; //!< OpenJPEG threads per image, 0 for the number of processors
+
+    void SipiIOOpenJ2k::setThreadBudget(int nthreads) {
+        openj2k_threads = nthreads;
     }
 
-    static void warning_callback(const char *msg, void *client_data) {
+    static void opj_sipi_error(const char *msg, void *client_data) {
         (void) client_data;
-        fprintf(stdout, "[WARNING] %s", msg);
+        syslog(LOG_ERR, "OpenJPEG: %s", msg);
     }
 
-    static void info_callback(const char *msg, void *client_data) {
+    static void opj_sipi_warning(const char *msg, void *client_data) {
         (void) client_data;
-        fprintf(stdout, "[INFO] %s", msg);
+        syslog(LOG_WARNING, "OpenJPEG: %s", msg);
     }
 
+    //=============================================================================
 
-    bool SipiIOOpenJ2k::read(SipiImage *img, string filepath, std::shared_ptr <SipiRegion> region,
-                             std::shared_ptr <SipiSize> size) {
-        auto logger = Logger::getLogger(shttps::loggername);
-        FILE *reader;
+    /*!
+     * The metadata which OpenJPEG does not return: the XMP, IPTC and EXIF uuid boxes of a JP2 file and
+     * the SipiEssentials, which are written as a comment (COM marker) into the main header of the codestream.
+     */
+    struct J2kMetadata {
+        std::vector<char> xmp;
+        std::vector<unsigned char> iptc;
+        std::vector<unsigned char> exif;
+        std::string essentials;
+        bool jp2 = false; //!< false for a raw codestream
+    };
+
+    static inline uint32_t get_be32(const unsigned char *buf) {
+        return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | (uint32_t) buf[3];
+    }
 
+    /*!
+     * Reads the SIPI comment from the main header of the codestream at the given offset
+     */
+    static void read_codestream_comment(std::ifstream &in, uint64_t pos, J2kMetadata &meta) {
+        unsigned char buf[4];
+        in.seekg(pos);
+        if (!in.read((char *) buf, 2) || (buf[0] != 0xff) || (buf[1] != 0x4f)) return; // SOC
+        pos += 2;
+        for (;;) {
+            if (!in.read((char *) buf, 4) || (buf[0] != 0xff)) return;
+            if ((buf[1] == 0x90) || (buf[1] == 0x93)) return; // SOT or SOD: end of the main header
+            size_t len = ((size_t) buf[2] << 8) | buf[3];
+            if (len < 2) return;
+            if ((buf[1] == 0x64) && (len > 4)) { // COM
+                std::vector<char> comment(len - 2);
+                if (!in.read(comment.data(), comment.size())) return;
+                if ((comment.size() > 7) && (strncmp(comment.data() + 2, "SIPI:", 5) == 0)) {
+                    meta.essentials.assign(comment.data() + 7, comment.size() - 7);
+                    meta.essentials.erase(meta.essentials.find_last_not_of('\0') + 1);
+                    return;
+                }
+            }
+            pos += 2 + len;
+            in.seekg(pos);
+        }
+    }
 
-        opj_dparameters_t parameters;
+    /*!
+     * Walks through the top level boxes of a JP2 file (or reads the main header of a raw codestream)
+     */
+    static J2kMetadata read_metadata(const std::string &filepath) {
+        J2kMetadata meta;
+        std::ifstream in(filepath, std::ios::binary);
+        if (!in) return meta;
+        in.seekg(0, std::ios::end);
+        uint64_t filesize = (uint64_t) in.tellg();
+        in.seekg(0);
+
+        unsigned char buf[16];
+        if (!in.read((char *) buf, 4)) return meta;
+        if ((buf[0] == 0xff) && (buf[1] == 0x4f) && (buf[2] == 0xff) && (buf[3] == 0x51)) {
+            read_codestream_comment(in, 0, meta);
+            return meta;
+        }
+        meta.jp2 = true;
+
+        uint64_t pos = 0;
+        while (pos + 8 <= filesize) {
+            in.seekg(pos);
+            if (!in.read((char *) buf, 8)) break;
+            uint64_t boxlen = get_be32(buf);
+            uint32_t boxtype = get_be32(buf + 4);
+            uint64_t header = 8;
+            if (boxlen == 1) { // extended length
+                if (!in.read((char *) buf + 8, 8)) break;
+                boxlen = ((uint64_t) get_be32(buf + 8) << 32) | get_be32(buf + 12);
+                header = 16;
+            } else if (boxlen == 0) { // last box
+                boxlen = filesize - pos;
+            }
+            if ((boxlen < header) || (pos + boxlen > filesize)) break;
+
+            if ((boxtype == 0x75756964) && (boxlen >= header + 16)) { // "uuid"
+                unsigned char uuid[16];
+                if (!in.read((char *) uuid, 16)) break;
+                size_t datalen = boxlen - header - 16;
+                if (memcmp(uuid, xmp_uuid, 16) == 0) {
+                    meta.xmp.resize(datalen);
+                    in.read(meta.xmp.data(), datalen);
+                } else if (memcmp(uuid, iptc_uuid, 16) == 0) {
+                    meta.iptc.resize(datalen);
+                    in.read((char *) meta.iptc.data(), datalen);
+                } else if (memcmp(uuid, exif_uuid, 16) == 0) {
+                    meta.exif.resize(datalen);
+                    in.read((char *) meta.exif.data(), datalen);
+                }
+            } else if (boxtype == 0x6a703263) { // "jp2c"
+                read_codestream_comment(in, pos + header, meta);
+            }
+            pos += boxlen;
+        }
+        return meta;
+    }
 
-        opj_set_default_decoder_parameters(&parameters);
+    //=============================================================================
 
-        if ((reader = fopen(filepath.c_str(), "rb")) == nullptr) {
-            throw SipiError(__file__, __LINE__, "Couldn't open input file!", errno);
+    /*!
+     * Owns the OpenJPEG objects of one decoding
+     */
+    class OpjDecoder {
+    public:
+        opj_stream_t *stream;
+        opj_codec_t *codec;
+        opj_image_t *image;
+        opj_codestream_info_v2_t *cstr_info;
+
+        OpjDecoder() : stream(nullptr), codec(nullptr), image(nullptr), cstr_info(nullptr) {}
+
+        ~OpjDecoder() {
+            if (cstr_info != nullptr) opj_destroy_cstr_info(&cstr_info);
+            if (image != nullptr) opj_image_destroy(image);
+            if (codec != nullptr) opj_destroy_codec(codec);
+            if (stream != nullptr) opj_stream_destroy(stream);
         }
 
-        unsigned char buf[12];
+        OpjDecoder(const OpjDecoder &) = delete;
 
-        memset(buf, 0, 12);
-        ssize_t n = fread(buf, 1, 12, reader);
-        fclose(reader);
+        OpjDecoder &operator=(const OpjDecoder &) = delete;
 
-        if (n != 12) {
-            throw SipiError(__file__, __LINE__, "Couldn't determine filetype!");
+        /*!
+         * Opens the file and reads the main header
+         *
+         * \param[in] filepath Path of the file
+         * \param[in] jp2 True for a JP2 file, false for a raw codestream
+         * \throws SipiImageError if the header cannot be read
+         */
+        void open(const std::string &filepath, bool jp2) {
+            if ((stream = opj_stream_create_default_file_stream(filepath.c_str(), OPJ_TRUE)) == nullptr) {
+                throw SipiImageError(__file__, __LINE__, "Cannot open JPEG2000 file \"" + filepath + "\"");
+            }
+            codec = opj_create_decompress(jp2 ? OPJ_CODEC_JP2 : OPJ_CODEC_J2K);
+            opj_set_warning_handler(codec, opj_sipi_warning, nullptr);
+            opj_set_error_handler(codec, opj_sipi_error, nullptr);
+
+            opj_dparameters_t parameters;
+            opj_set_default_decoder_parameters(&parameters);
+            if (!opj_setup_decoder(codec, &parameters)) {
+                throw SipiImageError(__file__, __LINE__, "OpenJPEG: failed to setup the decoder");
+            }
+            int nthreads = (openj2k_threads > 0) ? openj2k_threads : (int) std::thread::hardware_concurrency();
+            if (opj_has_thread_support() && (nthreads > 1)) (void) opj_codec_set_threads(codec, nthreads);
+
+            if (!opj_read_header(stream, codec, &image)) {
+                throw SipiImageError(__file__, __LINE__, "Error reading JPEG2000 header of \"" + filepath + "\"");
+            }
+            cstr_info = opj_get_cstr_info(codec);
         }
 
-        if (memcmp(buf, JP2_RFC3745_MAGIC, 12) == 0 || memcmp(buf, JP2_MAGIC, 4) == 0) {
-            parameters.decod_format = JP2_CFMT;
-        } else if (memcmp(buf, J2K_CODESTREAM_MAGIC, 4) == 0) {
-            parameters.decod_format = J2K_CFMT;
-        } else {
-            throw SipiError(__file__, __LINE__, "J2K magic not supported!");
+        /*!
+         * Number of resolution levels which can be discarded
+         */
+        int maxReduce() {
+            if ((cstr_info == nullptr) || (cstr_info->m_default_tile_info.tccp_info == nullptr)) return 0;
+            int reduce = (int) cstr_info->m_default_tile_info.tccp_info[0].numresolutions - 1;
+            for (OPJ_UINT32 c = 1; c < cstr_info->nbcomp; c++) {
+                int r = (int) cstr_info->m_default_tile_info.tccp_info[c].numresolutions - 1;
+                if (r < reduce) reduce = r;
+            }
+            return (reduce > 0) ? reduce : 0;
         }
+    };
 
-        //
-        // first we open a file stream
-        //
-        opj_stream_t *l_stream;
+    //=============================================================================
 
-        if (!(l_stream = opj_stream_create_default_file_stream(filepath.c_str(), true))) {
-            throw SipiError(__file__, __LINE__, "OpenJPEG2000: Could not create file stream...!");
-        }
+    static bool is_j2k(const std::string &filepath) {
+        static const unsigned char sig1[] = {0xff, 0x4f, 0xff, 0x51};
+        static const unsigned char sig2[] = {0x00, 0x00, 0x00, 0x0C, 0x6A, 0x50, 0x20, 0x20, 0x0D, 0x0A, 0x87, 0x0A};
+        unsigned char buf[12];
+        std::ifstream in(filepath, std::ios::binary);
+        if (!in.read((char *) buf, 12)) return false;
+        return (memcmp(buf, sig1, 4) == 0) || (memcmp(buf, sig2, 12) == 0);
+    }
 
-        opj_codec_t *l_codec;
+    //=============================================================================
 
-        switch (parameters.decod_format) {
-            case J2K_CFMT:    /* JPEG-2000 codestream */
-            {
-                /* Get a decoder handle */
-                l_codec = opj_create_decompress(OPJ_CODEC_J2K);
-                break;
-            }
-            case JP2_CFMT:    /* JPEG 2000 compressed image data */
-            {
-                /* Get a decoder handle */
-                l_codec = opj_create_decompress(OPJ_CODEC_JP2);
-                break;
+    bool SipiIOOpenJ2k::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                             std::shared_ptr<SipiSize> size, bool force_bps_8, ScalingQuality scaling_quality) {
+        if (!is_j2k(filepath)) return false;
+
+        J2kMetadata meta = read_metadata(filepath);
+        if (!meta.xmp.empty()) {
+            try {
+                img->xmp = std::make_shared<SipiXmp>(meta.xmp.data(), (int) meta.xmp.size());
+            } catch (SipiError &err) {
+                syslog(LOG_ERR, "%s", err.to_string().c_str());
             }
-            case JPT_CFMT:    /* JPEG 2000, JPIP */
-            {
-                /* Get a decoder handle */
-                l_codec = opj_create_decompress(OPJ_CODEC_JPT);
-                break;
+        }
+        if (!meta.iptc.empty()) {
+            try {
+                img->iptc = std::make_shared<SipiIptc>(meta.iptc.data(), (unsigned int) meta.iptc.size());
+            } catch (SipiError &err) {
+                syslog(LOG_ERR, "%s", err.to_string().c_str());
             }
-            default: {
-                fprintf(stderr, "skipping file..\n");
-                throw SipiError(__file__, __LINE__, "OpenJPEG2000: Invalid format for decompressor!");
+        }
+        if (!meta.exif.empty()) {
+            try {
+                img->exif = std::make_shared<SipiExif>(meta.exif.data(), (unsigned int) meta.exif.size());
+            } catch (SipiError &err) {
+                syslog(LOG_ERR, "%s", err.to_string().c_str());
             }
         }
+        if (!meta.essentials.empty()) {
+            SipiEssentials se(meta.essentials);
+            img->essential_metadata(se);
+        }
 
-        /* catch events using our callbacks and give a local context */
-        opj_set_info_handler(l_codec, info_callback, 00);
-        opj_set_warning_handler(l_codec, warning_callback, 00);
-        opj_set_error_handler(l_codec, error_callback, 00);
+        OpjDecoder dec;
+        dec.open(filepath, meta.jp2);
+        opj_image_t *image = dec.image;
+        size_t full_nx = image->x1 - image->x0;
+        size_t full_ny = image->y1 - image->y0;
 
-        /* Setup the decoder decoding parameters using user parameters */
-        if (!opj_setup_decoder(l_codec, &parameters)) {
-            opj_stream_destroy(l_stream);
-            opj_destroy_codec(l_codec);
-            throw SipiError(__file__, __LINE__, "OpenJPEG2000: failed to setup the decoder!");
+        //
+        // is there a region of interest defined ? If yes, get the cropping parameters...
+        //
+        int rx = 0, ry = 0;
+        size_t rw = full_nx, rh = full_ny;
+        bool do_roi = false;
+        if ((region != nullptr) && (region->getType() != SipiRegion::FULL)) {
+            region->crop_coords(full_nx, full_ny, rx, ry, rw, rh);
+            do_roi = true;
         }
 
-        opj_image_t *image = nullptr;
-
-        /* Read the main header of the codestream and if necessary the JP2 boxes*/
-        if (!opj_read_header(l_stream, l_codec, &image)) {
-            opj_stream_destroy(l_stream);
-            opj_destroy_codec(l_codec);
-            opj_image_destroy(image);
-            throw SipiError(__file__, __LINE__, "OpenJPEG2000: failed to read the header!");
+        //
+        // the lowest resolution level which is not smaller than the requested size
+        //
+        int reduce = dec.maxReduce();
+        size_t nnx, nny;
+        bool redonly = true;
+        if ((size != nullptr) && (size->getType() != SipiSize::FULL)) {
+            size->get_size(rw, rh, nnx, nny, reduce, redonly);
+        } else {
+            reduce = 0;
         }
+        if (reduce < 0) reduce = 0;
 
-        int __nx, __ny;
-        __nx = image->x1;
-        __ny = image->y1;
+        if ((reduce > 0) && !opj_set_decoded_resolution_factor(dec.codec, (OPJ_UINT32) reduce)) {
+            throw SipiImageError(__file__, __LINE__, "OpenJPEG: cannot set the resolution of \"" + filepath + "\"");
+        }
+        if (do_roi && !opj_set_decode_area(dec.codec, image, (OPJ_INT32) (image->x0 + rx),
+                                           (OPJ_INT32) (image->y0 + ry), (OPJ_INT32) (image->x0 + rx + rw),
+                                           (OPJ_INT32) (image->y0 + ry + rh))) {
+            throw SipiImageError(__file__, __LINE__, "OpenJPEG: cannot set the region of \"" + filepath + "\"");
+        }
+        if (!(opj_decode(dec.codec, dec.stream, image) && opj_end_decompress(dec.codec, dec.stream))) {
+            throw SipiImageError(__file__, __LINE__, "Error decoding JPEG2000 file \"" + filepath + "\"");
+        }
 
-        cerr << "image.x0: " << image->x0 << endl;
-        cerr << "image.y0: " << image->y0 << endl;
-        cerr << "image.x1: " << image->x1 << endl;
-        cerr << "image.y1: " << image->y1 << endl;
-        cerr << "image.numcomps: " << image->numcomps << endl;
+        //
+        // photometric interpretation, ICC profile and alpha channels
+        //
+        img->nx = image->comps[0].w;
+        img->ny = image->comps[0].h;
+        img->nc = image->numcomps;
+        size_t numcol = 0;
+        for (OPJ_UINT32 c = 0; c < image->numcomps; c++) {
+            if (image->comps[c].alpha) {
+                img->es.push_back(ASSOCALPHA);
+            } else {
+                numcol++;
+            }
+        }
+        switch (image->color_space) {
+            case OPJ_CLRSPC_SRGB:
+                img->photo = RGB;
+                img->icc = std::make_shared<SipiIcc>(icc_sRGB);
+                break;
+            case OPJ_CLRSPC_GRAY:
+                img->photo = MINISBLACK;
+                img->icc = std::make_shared<SipiIcc>(icc_LUM_D65);
+                break;
+            case OPJ_CLRSPC_SYCC:
+                img->photo = YCBCR;
+                img->icc = std::make_shared<SipiIcc>(icc_sRGB);
+                break;
+            case OPJ_CLRSPC_CMYK:
+                img->photo = SEPARATED;
+                img->icc = std::make_shared<SipiIcc>(icc_CYMK_standard);
+                break;
+            default:
+                switch (numcol) {
+                    case 1: img->photo = MINISBLACK;
+                        break;
+                    case 3: img->photo = RGB;
+                        break;
+                    case 4: img->photo = SEPARATED;
+                        break;
+                    default:
+                        throw SipiImageError(__file__, __LINE__, "Unsupported number of colors: " + std::to_string(numcol));
+                }
+        }
+        if ((image->icc_profile_buf != nullptr) && (image->icc_profile_len > 0)) {
+            img->icc = std::make_shared<SipiIcc>(image->icc_profile_buf, (int) image->icc_profile_len);
+        }
 
         //
-        // is there a region of interest defined ? If yes, get the cropping parameters...
+        // OpenJPEG returns one plane of 32 bit integers per component, we interleave them
         //
-        bool do_roi = false;
-        if ((region != nullptr) && (region->getType()) != SipiRegion::FULL) {
-            int x, y, nx, ny;
-            try {
-                region->crop_coords(__nx, __ny, x, y, nx, ny);
-                do_roi = true;
-            } catch (Sipi::SipiError &err) {
-                opj_stream_destroy(l_stream);
-                opj_destroy_codec(l_codec);
-                opj_image_destroy(image);
-                throw err;
+        int prec = image->comps[0].prec;
+        if ((prec < 1) || (prec > 16)) {
+            throw SipiImageError(__file__, __LINE__, "Unsupported number of bits/sample: " + std::to_string(prec));
+        }
+        img->bps = ((prec <= 8) || force_bps_8) ? 8 : 16;
+        const size_t npixels = img->nx * img->ny;
+        img->pixels = new byte[npixels * img->nc * img->bps / 8];
+        for (size_t c = 0; c < img->nc; c++) {
+            const opj_image_comp_t &comp = image->comps[c];
+            if (comp.data == nullptr) {
+                throw SipiImageError(__file__, __LINE__, "Error decoding JPEG2000 file \"" + filepath + "\"");
             }
-            if (!opj_set_decode_area(l_codec, image, x, y, x + nx, y + ny)) {
-                opj_stream_destroy(l_stream);
-                opj_destroy_codec(l_codec);
-                opj_image_destroy(image);
-                throw SipiError(__file__, __LINE__, "OpenJPEG2000: failed to set the decoded area!");
+            const int offset = comp.sgnd ? (1 << (comp.prec - 1)) : 0;
+            const int maxval = (1 << comp.prec) - 1;
+            const int shift = (int) img->bps - (int) comp.prec; // scale to the full range of 8 or 16 bits
+            const bool subsampled = (comp.w != img->nx) || (comp.h != img->ny);
+            for (size_t y = 0; y < img->ny; y++) {
+                size_t cy = subsampled ? y * comp.h / img->ny : y;
+                for (size_t x = 0; x < img->nx; x++) {
+                    size_t cx = subsampled ? x * comp.w / img->nx : x;
+                    int v = comp.data[cy * comp.w + cx] + offset;
+                    v = (v < 0) ? 0 : ((v > maxval) ? maxval : v);
+                    v = (shift >= 0) ? (v << shift) : (v >> -shift);
+                    if (img->bps == 8) {
+                        img->pixels[(y * img->nx + x) * img->nc + c] = (byte) v;
+                    } else {
+                        ((unsigned short *) img->pixels)[(y * img->nx + x) * img->nc + c] = (unsigned short) v;
+                    }
+                }
             }
         }
 
-        parameters.cp_reduce = 5;
-        opj_setup_decoder(l_codec, &parameters);
-
-        if (!(opj_decode(l_codec, l_stream, image) && opj_end_decompress(l_codec, l_stream))) {
-            opj_destroy_codec(l_codec);
-            opj_stream_destroy(l_stream);
-            opj_image_destroy(image);
-            throw SipiError(__file__, __LINE__, "OpenJPEG2000: failed to decode image!!");
+        if (img->photo == YCBCR) {
+            img->convertYCC2RGB();
+            img->photo = RGB;
         }
 
-        cerr << "image.x0: " << image->x0 << endl;
-        cerr << "image.y0: " << image->y0 << endl;
-        cerr << "image.x1: " << image->x1 << endl;
-        cerr << "image.y1: " << image->y1 << endl;
-        cerr << "image.numcomps: " << image->numcomps << endl;
-
-        exit(0);
+        if ((size != nullptr) && (!redonly)) {
+            switch (scaling_quality.jk2) {
+                case HIGH: img->scale(nnx, nny);
+                    break;
+                case MEDIUM: img->scaleMedium(nnx, nny);
+                    break;
+                case LOW: img->scaleFast(nnx, nny);
+                    break;
+            }
+        }
+        return true;
     }
     //=============================================================================
 
-    bool SipiIOOpenJ2k::getDim(std::string filepath, int &width, int &height) {
-        auto logger = Logger::getLogger(shttps::loggername);
+    SipiImgInfo SipiIOOpenJ2k::getDim(std::string filepath, int pagenum) {
+        SipiImgInfo info;
+        if (!is_j2k(filepath)) {
+            info.success = SipiImgInfo::FAILURE;
+            return info;
+        }
 
+        J2kMetadata meta = read_metadata(filepath);
+        OpjDecoder dec;
+        dec.open(filepath, meta.jp2);
+        info.width = dec.image->x1 - dec.image->x0;
+        info.height = dec.image->y1 - dec.image->y0;
+        if (dec.cstr_info != nullptr) {
+            info.tile_width = dec.cstr_info->tdx;
+            info.tile_height = dec.cstr_info->tdy;
+            //
+            // precincts smaller than the tiles can be decoded separately, thus they are the tiles for IIIF
+            //
+            const opj_tccp_info_t *tccp = dec.cstr_info->m_default_tile_info.tccp_info;
+            if ((tccp != nullptr) && (tccp->numresolutions > 0)) {
+                info.tile_width = std::min(info.tile_width, 1 << tccp->prcw[tccp->numresolutions - 1]);
+                info.tile_height = std::min(info.tile_height, 1 << tccp->prch[tccp->numresolutions - 1]);
+            }
+        }
+        info.clevels = dec.maxReduce();
+        info.success = SipiImgInfo::DIMS;
+
+        if (!meta.essentials.empty()) {
+            SipiEssentials se(meta.essentials);
+            info.origmimetype = se.mimetype();
+            info.origname = se.origname();
+            info.success = SipiImgInfo::ALL;
+        }
+        return info;
     }
     //=============================================================================
 
-    void SipiIOOpenJ2k::write(SipiImage *img, string filepath, int quality) {
-        auto logger = Logger::getLogger(shttps::loggername);
-
+    void SipiIOOpenJ2k::write(SipiImage *img, std::string filepath, const SipiCompressionParams *params) {
+        SipiIOJ2k writer;
+        writer.write(img, filepath, params);
     }
     //=============================================================================
 }
@@ -24,17 +24,23 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <string>
 #include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <fstream>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
 
 #include <stdio.h>
 
 #include "SipiError.h"
 #include "SipiIOPdf.h"
+#include "SipiHeaderReader.h"
 #include "SipiCommon.h"
 #include "SipiImage.h"
 #include "shttps/Connection.h"
@@ -51,7 +57,79 @@
 static const char __file__[] = __FILE__;
 static const int DPI = 300; // TODO: submitted parameter...
 
+static const size_t PDF_CACHE_SIZE = 8; // maximal number of open documents
+
 namespace Sipi {
+
+    /*!
+     * An opened poppler document. poppler documents must not be used by several threads at the same time.
+     */
+    typedef struct {
+        std::string path;
+        time_t mtime;
+        std::unique_ptr<poppler::document> doc;
+        std::mutex locking; //!< held while pages of the document are created or rendered
+    } PdfDocument;
+
+    /*!
+     * Keeps the most recently used documents open, so that the requests for the pages or tiles of a
+     * document do not parse it again. A document is reloaded if the file has been modified.
+     */
+    class PdfDocumentCache {
+    private:
+        std::mutex locking;
+        std::list<std::shared_ptr<PdfDocument>> documents; //!< most recently used first
+
+        PdfDocumentCache() {}
+
+    public:
+        static PdfDocumentCache &instance() {
+            static PdfDocumentCache cache;
+            return cache;
+        }
+
+        /*!
+         * Gets an opened document
+         *
+         * \param[in] filepath Path of the PDF file
+         * \returns The document, which has to be locked while it is used
+         * \throws SipiImageError if the document cannot be opened
+         */
+        std::shared_ptr<PdfDocument> get(const std::string &filepath) {
+            struct stat fileinfo;
+            if (stat(filepath.c_str(), &fileinfo) != 0) {
+                throw Sipi::SipiImageError(__file__, __LINE__, "Cannot stat PDF file: " + filepath);
+            }
+
+            std::lock_guard<std::mutex> lock(locking);
+            for (auto it = documents.begin(); it != documents.end(); ++it) {
+                if ((*it)->path == filepath) {
+                    std::shared_ptr<PdfDocument> pdf = *it;
+                    documents.erase(it);
+                    if (pdf->mtime == fileinfo.st_mtime) {
+                        documents.push_front(pdf);
+                        return pdf;
+                    }
+                    break; // modified, reload it
+                }
+            }
+
+            auto pdf = std::make_shared<PdfDocument>();
+            pdf->path = filepath;
+            pdf->mtime = fileinfo.st_mtime;
+            pdf->doc = std::unique_ptr<poppler::document>(poppler::document::load_from_file(filepath));
+            if (pdf->doc == nullptr) {
+                std::string msg = "poppler::document::load_from_file failed: " + filepath;
+                throw Sipi::SipiImageError(__file__, __LINE__, msg);
+            }
+            documents.push_front(pdf);
+            if (documents.size() > PDF_CACHE_SIZE) documents.pop_back(); // still used by the readers holding it
+            return pdf;
+        }
+    };
+
+    //============================================================================
+
     bool SipiIOPdf::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
               std::shared_ptr<SipiSize> size, bool force_bps_8,
               ScalingQuality scaling_quality) {
@@ -70,21 +148,52 @@ namespace Sipi {
             return FALSE; // it's not a PDF file
         }
 
+        std::shared_ptr<PdfDocument> pdf = PdfDocumentCache::instance().get(filepath);
+        std::unique_lock<std::mutex> pdf_lock(pdf->locking);
 
-        poppler::document* mypdf = poppler::document::load_from_file(filepath);
-        if(mypdf == NULL) {
-            std::string msg = "poppler::document::load_from_file failed: " + filepath;
+        std::unique_ptr<poppler::page> mypage(pdf->doc->create_page(pagenum < 1 ? 0 : pagenum - 1));
+        if (mypage == nullptr) {
+            std::string msg = "PDF page " + std::to_string(pagenum) + " does not exist: " + filepath;
             throw Sipi::SipiImageError(__file__, __LINE__, msg);
         }
-        std::cerr << "pdf has " << mypdf->pages() << " pages\n";
-        poppler::page* mypage = mypdf->create_page(pagenum - 1);
         poppler::rectf rect = mypage->page_rect();
-        std::cerr << "PDF DIMS: " << rect.x() << " " << rect.y() << " " << rect.width() << " " << rect.height() << std::endl;
+
+        //
+        // The region is given in pixels of the page rendered at DPI (see getDim()). Only the region is
+        // rendered, and at the resolution which yields the requested size: a thumbnail of a page is
+        // rendered at a few DPI instead of being downscaled from a full page at DPI.
+        //
+        size_t page_w = lround(rect.width() * DPI / 72.);
+        size_t page_h = lround(rect.height() * DPI / 72.);
+        int rx = 0, ry = 0;
+        size_t rw = page_w, rh = page_h;
+        if ((region != nullptr) && (region->getType() != SipiRegion::FULL)) {
+            (void) region->crop_coords(page_w, page_h, rx, ry, rw, rh);
+        }
+        size_t nnx = rw, nny = rh;
+        if (size != nullptr) {
+            int reduce = -1;
+            bool redonly;
+            (void) size->get_size(rw, rh, nnx, nny, reduce, redonly);
+        }
+        if ((rw == 0) || (rh == 0) || (nnx == 0) || (nny == 0)) {
+            throw Sipi::SipiImageError(__file__, __LINE__, "Invalid region or size of PDF page: " + filepath);
+        }
+        double xres = (double) DPI * nnx / rw;
+        double yres = (double) DPI * nny / rh;
 
         poppler::page_renderer renderer;
         renderer.set_render_hint(poppler::page_renderer::text_antialiasing);
-        poppler::image myimage = renderer.render_page(mypage, DPI, DPI);
-        std::cerr << "created image of  " << myimage.width() << "x"<< myimage.height() << "\n";
+        poppler::image myimage = renderer.render_page(mypage.get(), xres, yres,
+                                                      (int) lround(rx * xres / DPI), (int) lround(ry * yres / DPI),
+                                                      (int) nnx, (int) nny);
+        mypage = nullptr;
+        pdf_lock.unlock();
+
+        if (!myimage.is_valid()) {
+            std::string msg = "Rendering of PDF page failed: " + filepath;
+            throw Sipi::SipiImageError(__file__, __LINE__, msg);
+        }
 
         img->nx = myimage.width();
         img->ny = myimage.height();
@@ -92,55 +201,40 @@ namespace Sipi {
         img->bps = 8;
         img->icc = std::make_shared<SipiIcc>(icc_sRGB);
         img->photo = RGB;
-        std::cerr << "===>" << myimage.format() << std::endl;
         if(myimage.format() == poppler::image::format_rgb24) {
-            std::cerr << "----------->rgb24" << std::endl;
             img->nc = 3;
         } else if(myimage.format() == poppler::image::format_argb32) {
-            std::cerr << "----------->argb32" << std::endl;
             img->nc = 4;
             img->es.push_back(UNSPECIFIED);
         } else {
             std::string msg = "PDF format invalid: " + filepath;
             throw Sipi::SipiImageError(__file__, __LINE__, msg);
         }
-        uint8 *dataptr = new uint8[img->ny * sll];
-        memcpy(dataptr, myimage.const_data(), img->ny * sll);
+        uint8 *dataptr = new uint8[img->ny * img->nx * img->nc];
+        for (size_t y = 0; y < img->ny; y++) {
+            memcpy(dataptr + y * img->nx * img->nc, myimage.const_data() + y * sll, img->nx * img->nc);
+        }
         if (img->nc == 4) {
-            for (int y = 0; y < img->ny; y++) {
-                for (int x = 0; x < img->nx; x++) {
-                    uint8 a = dataptr[y*sll + 4*x];
-                    dataptr[y*sll + 4*x] = dataptr[y*sll + 4*x + 2];
-                    dataptr[y*sll + 4*x + 2] = a;
+            for (size_t y = 0; y < img->ny; y++) {
+                for (size_t x = 0; x < img->nx; x++) {
+                    uint8 a = dataptr[(y*img->nx + x)*4];
+                    dataptr[(y*img->nx + x)*4] = dataptr[(y*img->nx + x)*4 + 2];
+                    dataptr[(y*img->nx + x)*4 + 2] = a;
                 }
             }
         }
         img->pixels = dataptr;
-        std::cerr << "Finished conversion of PDF to image..........." << std::endl;
-
-        //
-        // Cropping
-        //
-        if (region != nullptr) { //we just use the image.crop method
-            (void) img->crop(region);
-        }
 
         //
-        // resize/Scale the image if necessary
+        // at the border of the page the rendered image may be off by a pixel
         //
-        if (size != nullptr) {
-            size_t nnx, nny;
-            int reduce = -1;
-            bool redonly;
-            SipiSize::SizeType rtype = size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
-            if (rtype != SipiSize::FULL) {
-                switch (scaling_quality.png) {
-                    case HIGH: img->scale(nnx, nny);
-                        break;
-                    case MEDIUM: img->scaleMedium(nnx, nny);
-                        break;
-                    case LOW: img->scaleFast(nnx, nny);
-                }
+        if ((img->nx != nnx) || (img->ny != nny)) {
+            switch (scaling_quality.png) {
+                case HIGH: img->scale(nnx, nny);
+                    break;
+                case MEDIUM: img->scaleMedium(nnx, nny);
+                    break;
+                case LOW: img->scaleFast(nnx, nny);
             }
         }
 
@@ -151,30 +245,27 @@ namespace Sipi {
         SipiImgInfo info;
 
         //
-        // Check for magic number of PDF "%PDF" (hex 25 50 44 46)
+        // Check for magic number of PDF "%PDF" (hex 25 50 44 46). The page count and page size need the
+        // document, which stays open in the document cache.
         //
-        FILE *infile;
-        unsigned char header[4];
-        if ((infile = fopen(filepath.c_str(), "rb")) == nullptr) {
-            info.success = SipiImgInfo::FAILURE;
-            return info;        }
-        fread(header, 1, 4, infile);
-        fclose(infile);
-        if ((header[0] != 0x25) || (header[1] != 0x50) || (header[2] != 0x44) ||(header[3] != 0x46)) {
-            info.success = SipiImgInfo::FAILURE;
-            return info;
+        {
+            SipiHeaderReader hdr(filepath);
+            const std::vector<unsigned char> &head = hdr.first();
+            if ((head.size() < 4) || (memcmp(head.data(), "%PDF", 4) != 0)) {
+                info.success = SipiImgInfo::FAILURE;
+                return info;
+            }
         }
 
-        poppler::document* mypdf = poppler::document::load_from_file(filepath);
-        if(mypdf == NULL) {
-            std::string msg = "poppler::document::load_from_file failed: " + filepath;
-            throw Sipi::SipiImageError(__file__, __LINE__, msg);
+        std::shared_ptr<PdfDocument> pdf = PdfDocumentCache::instance().get(filepath);
+        std::lock_guard<std::mutex> pdf_lock(pdf->locking);
+        info.numpages = pdf->doc->pages();
+        std::unique_ptr<poppler::page> mypage(pdf->doc->create_page(pagenum < 1 ? 0 : pagenum - 1));
+        if (mypage == nullptr) {
+            info.success = SipiImgInfo::FAILURE;
+            return info;
         }
-        info.numpages = mypdf->pages();
-        std::cerr << "pdf has " << mypdf->pages() << " pages\n";
-        poppler::page* mypage = mypdf->create_page(pagenum < 1 ? 0 : pagenum - 1);
         poppler::rectf rect = mypage->page_rect();
-        std::cerr << "PDF DIMS: " << rect.x() << " " << rect.y() << " " << rect.width() << " " << rect.height() << std::endl;
         info.width = lround(rect.width()*DPI/72.);
         info.height = lround(rect.height()*DPI/72.);
 
@@ -26,9 +26,16 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <iterator>
+#include <utility>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <stdio.h>
 #include <math.h>
 #include <syslog.h>
@@ -36,6 +43,10 @@
 #include <string.h>
 
 #include "SipiIOPng.h"
+#include "SipiHeaderReader.h"
+#include "SipiImageKernels.h"
+#include "SipiSizePolicy.h"
+#include "shttps/makeunique.h"
 
 
 #include <png.h>
@@ -338,53 +349,24 @@ namespace Sipi {
 
 
     SipiImgInfo SipiIOPng::getDim(std::string filepath, int pagenum) {
-        FILE *infile;
         SipiImgInfo info;
-        unsigned char header[8];
+        SipiHeaderReader hdr(filepath);
+        const std::vector<unsigned char> &head = hdr.first();
 
         //
-        // open the input file
+        // the IHDR chunk directly follows the signature: length (4 bytes), "IHDR", width and height (4 bytes each)
         //
-        if ((infile = fopen(filepath.c_str(), "rb")) == nullptr) {
+        if ((head.size() < 24) || (png_sig_cmp(head.data(), 0, 8) != 0) || (memcmp(head.data() + 12, "IHDR", 4) != 0)) {
             info.success = SipiImgInfo::FAILURE;
             return info;
         }
-        fread(header, 1, 8, infile);
-        if (png_sig_cmp(header, 0, 8) != 0) {
-            fclose(infile);
-            info.success = SipiImgInfo::FAILURE;
-            return info;        }
-
-        png_structp png_ptr;
-        png_infop info_ptr;
-        png_infop end_info;
-
-        if ((png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp) nullptr, (png_error_ptr) nullptr,
-                                              (png_error_ptr) nullptr)) == nullptr) {
-            fclose(infile);
-            throw SipiImageError(__file__, __LINE__, "Error reading PNG file \"" + filepath +
-                                                     "\": Could not allocate mempry fpr png_structp !");
-        }
-        if ((info_ptr = png_create_info_struct(png_ptr)) == nullptr) {
-            fclose(infile);
-            throw SipiImageError(__file__, __LINE__, "Error reading PNG file \"" + filepath +
-                                                     "\": Could not allocate mempry fpr png_infop !");
-        }
-        if ((end_info = png_create_info_struct(png_ptr)) == nullptr) {
-            fclose(infile);
-            throw SipiImageError(__file__, __LINE__, "Error reading PNG file \"" + filepath +
-                                                     "\": Could not allocate mempry fpr png_infop !");
-        }
-
-        png_init_io(png_ptr, infile);
-        png_set_sig_bytes(png_ptr, 8);
-
-        info.width = png_get_image_width(png_ptr, info_ptr);
-        info.height = png_get_image_height(png_ptr, info_ptr);
+        uint64_t width, height;
+        hdr.getUint(16, 4, true, width);
+        hdr.getUint(20, 4, true, height);
+        info.width = width;
+        info.height = height;
         info.success = SipiImgInfo::DIMS;
 
-        png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-
         return info;
     }
     /*==========================================================================*/
@@ -428,7 +410,232 @@ namespace Sipi {
 
     /*==========================================================================*/
 
+    /*!
+     * Encoding settings of the PNG writer
+     */
+    typedef struct {
+        int filter;    //!< PNG_FILTER_NONE, ..., PNG_FILTER_PAETH or PNG_ALL_FILTERS (adaptive)
+        int level;     //!< zlib compression level
+        bool parallel; //!< deflate bands of rows in parallel
+    } PngPreset;
+
+    static bool parse_preset(const std::string &name, PngPreset &preset) {
+        if (name == "fast") preset = {PNG_FILTER_SUB, 1, true};
+        else if (name == "balanced") preset = {PNG_ALL_FILTERS, 6, true};
+        else if (name == "small") preset = {PNG_ALL_FILTERS, 9, false};
+        else return false;
+        return true;
+    }
+
+    static bool parse_filter(const std::string &name, int &filter) {
+        if (name == "none") filter = PNG_FILTER_NONE;
+        else if (name == "sub") filter = PNG_FILTER_SUB;
+        else if (name == "up") filter = PNG_FILTER_UP;
+        else if (name == "average") filter = PNG_FILTER_AVG;
+        else if (name == "paeth") filter = PNG_FILTER_PAETH;
+        else if (name == "adaptive") filter = PNG_ALL_FILTERS;
+        else return false;
+        return true;
+    }
+
+    /*==========================================================================*/
+
+    /*!
+     * Maps the size of the output image to the encoding preset.
+     */
+    static SipiSizePolicy<PngPreset> png_preset_policy;
+
+    void SipiIOPng::setPresetPolicy(const std::string &policy) {
+        png_preset_policy.set(policy, parse_preset, "PNG preset policy", "<longest edge>:<fast|balanced|small>");
+    }
+
+    /*==========================================================================*/
+
+    static inline unsigned int filter_cost(const byte *buf, size_t n) {
+        unsigned int sum = 0;
+        for (size_t i = 0; i < n; i++) sum += (buf[i] < 128) ? buf[i] : 256 - buf[i];
+        return sum;
+    }
+
+    /*!
+     * Filters one row as defined by the PNG specification. An adaptive filter chooses the filter
+     * with the smallest sum of absolute differences, as libpng does.
+     *
+     * \param[in] filter PNG_FILTER_NONE, ..., PNG_FILTER_PAETH or PNG_ALL_FILTERS
+     * \param[in] row The row (big endian samples)
+     * \param[in] prev The previous row, nullptr for the first row of the image
+     * \param[in] rowbytes Number of bytes of a row
+     * \param[in] bpp Number of bytes of a pixel (at least 1)
+     * \param[out] out Filter type byte followed by the rowbytes filtered bytes
+     * \param[in] tmp Buffer of rowbytes + 1 bytes used by the adaptive filter
+     */
+    static void filter_row(int filter, const byte *row, const byte *prev, size_t rowbytes, size_t bpp,
+                           byte *out, byte *tmp) {
+        static const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+                                      PNG_FILTER_PAETH};
+        unsigned int best_cost = 0;
+        bool first = true;
+        for (int type = 0; type < 5; type++) {
+            if ((filter & filters[type]) == 0) continue;
+            byte *dst = first ? out : tmp;
+            dst[0] = (byte) type;
+            for (size_t i = 0; i < rowbytes; i++) {
+                int a = (i >= bpp) ? row[i - bpp] : 0;
+                int b = (prev != nullptr) ? prev[i] : 0;
+                int c = ((i >= bpp) && (prev != nullptr)) ? prev[i - bpp] : 0;
+                int predictor;
+                switch (type) {
+                    case 0: predictor = 0; break;
+                    case 1: predictor = a; break;
+                    case 2: predictor = b; break;
+                    case 3: predictor = (a + b) / 2; break;
+                    default: {
+                        int p = a + b - c;
+                        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                        predictor = ((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c);
+                    }
+                }
+                dst[i + 1] = (byte) (row[i] - predictor);
+            }
+            if (filter == filters[type]) return; // only one filter allowed
+            unsigned int cost = filter_cost(dst + 1, rowbytes);
+            if (first || (cost < best_cost)) {
+                if (!first) Sipi::memcpy(out, tmp, rowbytes + 1);
+                best_cost = cost;
+            }
+            first = false;
+        }
+    }
+
+    /*!
+     * Filters and deflates the rows [first, end) of an image into a raw deflate stream which can be
+     * concatenated with the streams of the other rows: all but the last band end with a sync flush.
+     */
+    static bool deflate_band(SipiImage *img, const byte *pixels, size_t first, size_t end, int filter,
+                             int level, std::string &out, uLong &adler) {
+        const size_t bytes_per_sample = img->getBps() / 8;
+        const size_t rowbytes = img->getNx() * img->getNc() * bytes_per_sample;
+        const size_t bpp = img->getNc() * bytes_per_sample;
+
+        std::vector<byte> row(rowbytes), prev(rowbytes), filtered(rowbytes + 1), tmp(rowbytes + 1);
+        auto get_row = [&](size_t y, byte *dst) { // PNG samples are big endian
+            const byte *src = pixels + y * rowbytes;
+            if (bytes_per_sample == 2) {
+                for (size_t i = 0; i < rowbytes; i += 2) {
+                    dst[i] = src[i + 1];
+                    dst[i + 1] = src[i];
+                }
+            } else {
+                Sipi::memcpy(dst, src, rowbytes);
+            }
+        };
+
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        int strategy = (filter == PNG_FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+            return false;
+        }
+
+        adler = adler32(0L, Z_NULL, 0);
+        std::vector<byte> zbuf(64 * 1024);
+        if (first > 0) get_row(first - 1, prev.data());
+        for (size_t y = first; y < end; y++) {
+            get_row(y, row.data());
+            filter_row(filter, row.data(), (y > 0) ? prev.data() : nullptr, rowbytes, bpp, filtered.data(), tmp.data());
+            adler = adler32(adler, filtered.data(), (uInt) filtered.size());
+
+            int flush = (y + 1 < end) ? Z_NO_FLUSH : ((end == img->getNy()) ? Z_FINISH : Z_SYNC_FLUSH);
+            zs.next_in = filtered.data();
+            zs.avail_in = (uInt) filtered.size();
+            do {
+                zs.next_out = zbuf.data();
+                zs.avail_out = (uInt) zbuf.size();
+                if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                    deflateEnd(&zs);
+                    return false;
+                }
+                out.append((char *) zbuf.data(), zbuf.size() - zs.avail_out);
+            } while (zs.avail_out == 0);
+            std::swap(row, prev);
+        }
+        deflateEnd(&zs);
+        return true;
+    }
+
+    /*!
+     * Writes the IDAT chunks of an image whose bands of rows are filtered and deflated in parallel. The
+     * raw deflate streams of the bands are concatenated and framed by the zlib header and the Adler-32
+     * checksum of all bands.
+     */
+    static void write_parallel_idat(png_structp png_ptr, SipiImage *img, const byte *pixels, int filter,
+                                    int level) {
+        const size_t rowbytes = img->getNx() * img->getNc() * img->getBps() / 8;
+        std::mutex locking;
+        std::map<size_t, std::pair<std::string, uLong>> bands; // first row -> compressed data, Adler-32
+        bool failed = false;
+        parallel_strips(img->getNy(), img->getNx(), [&](size_t first, size_t end) {
+            std::string out;
+            uLong adler;
+            bool ok = deflate_band(img, pixels, first, end, filter, level, out, adler);
+            std::lock_guard<std::mutex> lock(locking);
+            if (!ok) failed = true;
+            bands[first] = std::make_pair(std::move(out), adler);
+        });
+        if (failed) {
+            throw SipiImageError(__file__, __LINE__, "Error writing PNG file: deflate failed!");
+        }
+
+        const int cmf = 0x78; // deflate, 32K window
+        int flg = ((level < 2) ? 0 : ((level < 6) ? 1 : ((level == 6) ? 2 : 3))) << 6;
+        flg += 31 - ((cmf * 256 + flg) % 31);
+        png_byte header[2] = {(png_byte) cmf, (png_byte) flg};
+        png_write_chunk(png_ptr, (png_const_bytep) "IDAT", header, 2);
+
+        uLong adler = adler32(0L, Z_NULL, 0);
+        for (auto band = bands.begin(); band != bands.end(); ++band) {
+            auto next = std::next(band);
+            size_t nrows = ((next != bands.end()) ? next->first : img->getNy()) - band->first;
+            adler = adler32_combine(adler, band->second.second, (z_off_t) (nrows * (rowbytes + 1)));
+            png_write_chunk(png_ptr, (png_const_bytep) "IDAT", (png_const_bytep) band->second.first.data(),
+                            band->second.first.size());
+        }
+        png_byte trailer[4] = {(png_byte) (adler >> 24), (png_byte) (adler >> 16), (png_byte) (adler >> 8),
+                               (png_byte) adler};
+        png_write_chunk(png_ptr, (png_const_bytep) "IDAT", trailer, 4);
+        png_write_chunk(png_ptr, (png_const_bytep) "IEND", nullptr, 0);
+    }
+
+    /*==========================================================================*/
+
     void SipiIOPng::write(SipiImage *img, std::string filepath, const SipiCompressionParams *params) {
+        PngPreset preset;
+        if (!png_preset_policy.get(img->nx > img->ny ? img->nx : img->ny, preset)) {
+            (void) parse_preset("balanced", preset);
+        }
+        if (params != nullptr) {
+            if (params->find(PNG_filter) != params->end()) {
+                if (!parse_filter(params->at(PNG_filter), preset.filter)) {
+                    throw SipiImageError(__file__, __LINE__, "Unknown PNG filter: " + params->at(PNG_filter));
+                }
+            }
+            if (params->find(PNG_level) != params->end()) {
+                try {
+                    preset.level = std::stoi(params->at(PNG_level));
+                } catch (const std::logic_error &err) {
+                    preset.level = -1;
+                }
+                if ((preset.level < 0) || (preset.level > 9)) {
+                    throw SipiImageError(__file__, __LINE__, "PNG compression level must be integer between 0 and 9");
+                }
+            }
+            if (params->find(PNG_parallel) != params->end()) {
+                preset.parallel = (params->at(PNG_parallel) == "yes");
+            }
+        }
+
         FILE *outfile = nullptr;
         png_structp png_ptr;
 
@@ -469,10 +676,10 @@ namespace Sipi {
 
         if (outfile != nullptr) png_init_io(png_ptr, outfile);
 
-        png_set_filter(png_ptr, 0, PNG_FILTER_NONE);
+        png_set_filter(png_ptr, 0, preset.filter);
 
         /* set the zlib compression level */
-        png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
+        png_set_compression_level(png_ptr, preset.level);
 
         int color_type;
         if (img->nc == 1) { // grey value
@@ -557,6 +764,40 @@ namespace Sipi {
             png_set_text(png_ptr, info_ptr, chunk_ptr.ptr(), chunk_ptr.num());
         }
 
+        if (img->strips != nullptr) {
+            //
+            // the pixels are decoded strip by strip, each row is passed to the encoder as soon as it is available
+            //
+            png_write_info(png_ptr, info_ptr);
+            if (img->bps == 16) png_set_swap(png_ptr); // we expect the data to be little endian...
+            size_t rowsize = img->nx * img->nc * img->bps / 8;
+            auto strip = shttps::make_unique<byte[]>(img->strips->stripHeight() * rowsize);
+            size_t nrows;
+            while ((nrows = img->strips->pull(strip.get())) > 0) {
+                for (size_t i = 0; i < nrows; i++) png_write_row(png_ptr, strip.get() + i * rowsize);
+            }
+            img->strips = nullptr;
+            png_write_end(png_ptr, info_ptr);
+
+            png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
+
+            if (outfile != nullptr) fclose(outfile);
+            return;
+        }
+
+        if (preset.parallel && (img->ny > 0) && ((img->bps == 8) || (img->bps == 16))) {
+            //
+            // the rows are filtered and deflated by bands in parallel, libpng writes only the header chunks
+            //
+            png_write_info(png_ptr, info_ptr);
+            write_parallel_idat(png_ptr, img, img->pixels, preset.filter, preset.level);
+
+            png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
+
+            if (outfile != nullptr) fclose(outfile);
+            return;
+        }
+
         png_bytep *row_pointers = (png_bytep *) png_malloc(png_ptr, img->ny * sizeof(png_byte *));
 
         if (img->bps == 8) {
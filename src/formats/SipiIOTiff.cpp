@@ -30,14 +30,24 @@
 #include <fstream>
 #include <cstdio>
 #include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <memory>
 
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "shttps/Connection.h"
+#include "shttps/makeunique.h"
 #include "SipiError.h"
 #include "SipiIOTiff.h"
+#include "SipiHeaderReader.h"
 #include "SipiImage.h"
+#include "SipiImageKernels.h"
 
 #include "tif_dir.h"  // libtiff internals; for _TIFFFieldArray
 
@@ -46,35 +56,27 @@
 
 static const char __file__[] = __FILE__;
 
+static std::atomic<bool> tiff_read_advice(true); // see SipiIOTiff::setReadAdvice()
+
 #define TIFF_GET_FIELD(file, tag, var, default) {\
 if (0 == TIFFGetField ((file), (tag), (var)))*(var) = (default); }
 
 extern "C" {
 
+/*!
+ * In-memory TIFF file used to write TIFF images to stdout or to a HTTP connection. The data is
+ * held in chunks of fixed size which are never reallocated nor copied while the file grows.
+ */
 typedef struct _memtiff {
-    unsigned char *data;
-    tsize_t size;
-    tsize_t incsiz;
+    std::vector<std::unique_ptr<unsigned char[]>> chunks;
+    tsize_t chunksiz;
     tsize_t flen;
     toff_t fptr;
 } MEMTIFF;
 
-static MEMTIFF *memTiffOpen(tsize_t incsiz = 10240, tsize_t initsiz = 10240) {
-    MEMTIFF *memtif;
-    if ((memtif = (MEMTIFF *) malloc(sizeof(MEMTIFF))) == nullptr) {
-        throw Sipi::SipiImageError(__file__, __LINE__, "malloc failed", errno);
-    }
-
-    memtif->incsiz = incsiz;
-
-    if (initsiz == 0) initsiz = incsiz;
-
-    if ((memtif->data = (unsigned char *) malloc(initsiz * sizeof(unsigned char))) == nullptr) {
-        free(memtif);
-        throw Sipi::SipiImageError(__file__, __LINE__, "malloc failed", errno);
-    }
-
-    memtif->size = initsiz;
+static MEMTIFF *memTiffOpen(tsize_t chunksiz = 256 * 1024) {
+    MEMTIFF *memtif = new MEMTIFF;
+    memtif->chunksiz = chunksiz;
     memtif->flen = 0;
     memtif->fptr = 0;
     return memtif;
@@ -84,17 +86,23 @@ static MEMTIFF *memTiffOpen(tsize_t incsiz = 10240, tsize_t initsiz = 10240) {
 static tsize_t memTiffReadProc(thandle_t handle, tdata_t buf, tsize_t size) {
     MEMTIFF *memtif = (MEMTIFF *) handle;
 
-    tsize_t n;
+    if ((tsize_t) memtif->fptr >= memtif->flen) return 0;
+    if ((tsize_t) memtif->fptr + size > memtif->flen) size = memtif->flen - memtif->fptr;
 
-    if (((tsize_t) memtif->fptr + size) <= memtif->flen) {
-        n = size;
-    } else {
-        n = memtif->flen - memtif->fptr;
+    tsize_t n = 0;
+    while (n < size) {
+        size_t chunk = memtif->fptr / memtif->chunksiz;
+        tsize_t offset = memtif->fptr % memtif->chunksiz;
+        tsize_t len = std::min(size - n, memtif->chunksiz - offset);
+        if (chunk < memtif->chunks.size()) {
+            memcpy((unsigned char *) buf + n, memtif->chunks[chunk].get() + offset, len);
+        } else {
+            memset((unsigned char *) buf + n, 0, len);
+        }
+        n += len;
+        memtif->fptr += len;
     }
 
-    memcpy(buf, memtif->data + memtif->fptr, n);
-    memtif->fptr += n;
-
     return n;
 }
 /*===========================================================================*/
@@ -102,18 +110,21 @@ static tsize_t memTiffReadProc(thandle_t handle, tdata_t buf, tsize_t size) {
 static tsize_t memTiffWriteProc(thandle_t handle, tdata_t buf, tsize_t size) {
     MEMTIFF *memtif = (MEMTIFF *) handle;
 
-    if (((tsize_t) memtif->fptr + size) > memtif->size) {
-        if ((memtif->data = (unsigned char *) realloc(memtif->data, memtif->fptr + memtif->incsiz + size)) == nullptr) {
-            throw Sipi::SipiImageError(__file__, __LINE__, "realloc failed", errno);
+    tsize_t n = 0;
+    while (n < size) {
+        size_t chunk = memtif->fptr / memtif->chunksiz;
+        tsize_t offset = memtif->fptr % memtif->chunksiz;
+        tsize_t len = std::min(size - n, memtif->chunksiz - offset);
+        while (memtif->chunks.size() <= chunk) {
+            // new chunks are zero-initialized, since libtiff may seek beyond the end of the file
+            memtif->chunks.push_back(shttps::make_unique<unsigned char[]>(memtif->chunksiz));
         }
-
-        memtif->size = memtif->fptr + memtif->incsiz + size;
+        memcpy(memtif->chunks[chunk].get() + offset, (unsigned char *) buf + n, len);
+        n += len;
+        memtif->fptr += len;
     }
 
-    memcpy(memtif->data + memtif->fptr, buf, size);
-    memtif->fptr += size;
-
-    if (memtif->fptr > memtif->flen) memtif->flen = memtif->fptr;
+    if ((tsize_t) memtif->fptr > memtif->flen) memtif->flen = memtif->fptr;
 
     return size;
 }
@@ -124,47 +135,19 @@ static toff_t memTiffSeekProc(thandle_t handle, toff_t off, int whence) {
 
     switch (whence) {
         case SEEK_SET: {
-            if ((tsize_t) off > memtif->size) {
-                if ((memtif->data = (unsigned char *) realloc(memtif->data, memtif->size + memtif->incsiz + off)) ==
-                    nullptr) {
-                    throw Sipi::SipiImageError(__file__, __LINE__, "realloc failed", errno);
-                }
-
-                memtif->size = memtif->size + memtif->incsiz + off;
-            }
-
             memtif->fptr = off;
             break;
         }
         case SEEK_CUR: {
-            if ((tsize_t) (memtif->fptr + off) > memtif->size) {
-                if ((memtif->data = (unsigned char *) realloc(memtif->data, memtif->fptr + memtif->incsiz + off)) ==
-                    nullptr) {
-                    throw Sipi::SipiImageError(__file__, __LINE__, "realloc failed", errno);
-                }
-
-                memtif->size = memtif->fptr + memtif->incsiz + off;
-            }
-
             memtif->fptr += off;
             break;
         }
         case SEEK_END: {
-            if ((tsize_t) (memtif->size + off) > memtif->size) {
-                if ((memtif->data = (unsigned char *) realloc(memtif->data, memtif->size + memtif->incsiz + off)) ==
-                    nullptr) {
-                    throw Sipi::SipiImageError(__file__, __LINE__, "realloc failed", errno);
-                }
-
-                memtif->size = memtif->size + memtif->incsiz + off;
-            }
-
-            memtif->fptr = memtif->size + off;
+            memtif->fptr = memtif->flen + off;
             break;
         }
     }
 
-    if (memtif->fptr > memtif->flen) memtif->flen = memtif->fptr;
     return memtif->fptr;
 }
 /*===========================================================================*/
@@ -185,10 +168,7 @@ static toff_t memTiffSizeProc(thandle_t handle) {
 
 
 static int memTiffMapProc(thandle_t handle, tdata_t *base, toff_t *psize) {
-    MEMTIFF *memtif = (MEMTIFF *) handle;
-    *base = memtif->data;
-    *psize = memtif->flen;
-    return (1);
+    return (0); // the chunks are not contiguous and can not be mapped
 }
 /*===========================================================================*/
 
@@ -198,14 +178,99 @@ static void memTiffUnmapProc(thandle_t handle, tdata_t base, toff_t size) {
 /*===========================================================================*/
 
 static void memTiffFree(MEMTIFF *memtif) {
-    if (memtif->data != nullptr) free(memtif->data);
-    memtif->data = nullptr;
-    if (memtif != nullptr) free(memtif);
-    memtif = nullptr;
+    delete memtif;
     return;
 }
 /*===========================================================================*/
 
+/*!
+ * TIFF file read with pread through its file descriptor. The descriptor is used to announce the access
+ * pattern to the kernel with posix_fadvise, e.g. to read ahead the tiles of a region.
+ */
+typedef struct _fdtiff {
+    int fd;
+    toff_t size;
+    toff_t fptr;
+} FDTIFF;
+
+static tsize_t fdTiffReadProc(thandle_t handle, tdata_t buf, tsize_t size) {
+    FDTIFF *fdtif = (FDTIFF *) handle;
+
+    if (fdtif->fptr >= fdtif->size) return 0;
+    if (fdtif->fptr + size > fdtif->size) size = fdtif->size - fdtif->fptr;
+
+    ssize_t n = pread(fdtif->fd, buf, (size_t) size, (off_t) fdtif->fptr);
+    if (n < 0) return -1;
+    fdtif->fptr += n;
+
+    return n;
+}
+/*===========================================================================*/
+
+static tsize_t fdTiffWriteProc(thandle_t handle, tdata_t buf, tsize_t size) {
+    return 0; // read only
+}
+/*===========================================================================*/
+
+static toff_t fdTiffSeekProc(thandle_t handle, toff_t off, int whence) {
+    FDTIFF *fdtif = (FDTIFF *) handle;
+
+    switch (whence) {
+        case SEEK_SET: {
+            fdtif->fptr = off;
+            break;
+        }
+        case SEEK_CUR: {
+            fdtif->fptr += off;
+            break;
+        }
+        case SEEK_END: {
+            fdtif->fptr = fdtif->size + off;
+            break;
+        }
+    }
+
+    return fdtif->fptr;
+}
+/*===========================================================================*/
+
+static int fdTiffCloseProc(thandle_t handle) {
+    FDTIFF *fdtif = (FDTIFF *) handle;
+    int res = close(fdtif->fd);
+    delete fdtif;
+    return res;
+}
+/*===========================================================================*/
+
+static toff_t fdTiffSizeProc(thandle_t handle) {
+    FDTIFF *fdtif = (FDTIFF *) handle;
+    return fdtif->size;
+}
+/*===========================================================================*/
+
+static int fdTiffMapProc(thandle_t handle, tdata_t *base, toff_t *psize) {
+    return (0); // the file is not mapped, libtiff reads through fdTiffReadProc
+}
+/*===========================================================================*/
+
+static void fdTiffUnmapProc(thandle_t handle, tdata_t base, toff_t size) {
+    return; // never mapped
+}
+/*===========================================================================*/
+
+/*!
+ * Tells the kernel that a byte range of the file will be read soon, so it can be read ahead. Does nothing
+ * on systems without posix_fadvise (e.g. macOS).
+ */
+static void fdTiffWillNeed(FDTIFF *fdtif, toff_t offset, toff_t size) {
+#ifdef POSIX_FADV_WILLNEED
+    if (offset >= fdtif->size) return;
+    if (offset + size > fdtif->size) size = fdtif->size - offset;
+    (void) posix_fadvise(fdtif->fd, (off_t) offset, (off_t) size, POSIX_FADV_WILLNEED);
+#endif
+}
+/*===========================================================================*/
+
 }
 
 
@@ -431,6 +496,344 @@ namespace Sipi {
     }
     //============================================================================
 
+    /*!
+     * Opens a TIFF file for reading with pread. The advice tells the kernel how the file will be accessed:
+     * sequential if the whole image is read, random if only a region, a reduced resolution or the header is
+     * read. If advice is disabled, TIFFOpen is used.
+     *
+     * \param[in] filepath Path of the TIFF file
+     * \param[in] sequential true if the whole file will be read
+     * \returns TIFF handle or nullptr
+     */
+    static TIFF *tiffOpenAdvised(const std::string &filepath, bool sequential) {
+        if (!tiff_read_advice) return TIFFOpen(filepath.c_str(), "r");
+
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        struct stat fileinfo;
+        if (fstat(fd, &fileinfo) != 0) {
+            close(fd);
+            return TIFFOpen(filepath.c_str(), "r");
+        }
+
+        FDTIFF *fdtif = new FDTIFF{fd, (toff_t) fileinfo.st_size, 0};
+#ifdef POSIX_FADV_SEQUENTIAL
+        (void) posix_fadvise(fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#endif
+        TIFF *tif = TIFFClientOpen(filepath.c_str(), "r", (thandle_t) fdtif, fdTiffReadProc, fdTiffWriteProc,
+                                   fdTiffSeekProc, fdTiffCloseProc, fdTiffSizeProc, fdTiffMapProc,
+                                   fdTiffUnmapProc);
+        if (tif == nullptr) fdTiffCloseProc((thandle_t) fdtif);
+        return tif;
+    }
+    //============================================================================
+
+    /*!
+     * Resolution level of a pyramidal TIFF file
+     */
+    typedef struct {
+        uint32 width;
+        uint32 height;
+        toff_t offset;  //!< offset of the IFD of this level
+    } TiffLevel;
+
+    /*!
+     * Returns the resolution levels of the current image, the full resolution first. Reduced
+     * resolutions are either given as SubIFDs of the current IFD or as the following IFDs having
+     * NewSubfileType = FILETYPE_REDUCEDIMAGE. Only levels with the same samples/pixel and bits/sample
+     * as the full resolution are used. The current directory is restored before returning.
+     */
+    static std::vector<TiffLevel> tiff_levels(TIFF *tif) {
+        std::vector<TiffLevel> levels;
+        const toff_t main_offset = TIFFCurrentDirOffset(tif);
+        uint16 main_spp, main_bps;
+        TiffLevel level;
+        TIFF_GET_FIELD (tif, TIFFTAG_SAMPLESPERPIXEL, &main_spp, 1);
+        TIFF_GET_FIELD (tif, TIFFTAG_BITSPERSAMPLE, &main_bps, 1);
+        if ((TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &level.width) == 0) ||
+            (TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &level.height) == 0)) {
+            return levels;
+        }
+        level.offset = main_offset;
+        levels.push_back(level);
+
+        auto add_level = [&]() -> bool {
+            uint16 spp, bps;
+            TIFF_GET_FIELD (tif, TIFFTAG_SAMPLESPERPIXEL, &spp, 1);
+            TIFF_GET_FIELD (tif, TIFFTAG_BITSPERSAMPLE, &bps, 1);
+            TiffLevel reduced;
+            if ((spp != main_spp) || (bps != main_bps) ||
+                (TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &reduced.width) == 0) ||
+                (TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &reduced.height) == 0)) {
+                return false;
+            }
+            reduced.offset = TIFFCurrentDirOffset(tif);
+            levels.push_back(reduced);
+            return true;
+        };
+
+        uint16 nsubifds = 0;
+        toff_t *subifds_ti = nullptr;
+        if ((TIFFGetField(tif, TIFFTAG_SUBIFD, &nsubifds, &subifds_ti) == 1) && (nsubifds > 0)) {
+            std::vector<toff_t> subifds(subifds_ti, subifds_ti + nsubifds); // invalid after changing the directory
+            for (auto offset : subifds) {
+                if (TIFFSetSubDirectory(tif, offset) == 1) add_level();
+            }
+        } else {
+            while (TIFFReadDirectory(tif) == 1) {
+                uint32 subfiletype;
+                TIFF_GET_FIELD (tif, TIFFTAG_SUBFILETYPE, &subfiletype, 0);
+                if (((subfiletype & FILETYPE_REDUCEDIMAGE) == 0) || !add_level()) break;
+            }
+        }
+
+        if (levels.size() > 1) {
+            TIFFSetSubDirectory(tif, main_offset);
+            std::sort(levels.begin() + 1, levels.end(), [](const TiffLevel &a, const TiffLevel &b) {
+                return a.width > b.width;
+            });
+        }
+        return levels;
+    }
+    //============================================================================
+
+    /*!
+     * Layout and compression of the TIFF file to be written
+     */
+    typedef struct {
+        uint16 compression;
+        uint16 predictor;
+        int jpeg_quality;   //!< 0 to use the default of libtiff
+        uint32 tile_size;   //!< 0 to write strips
+        bool pyramid;
+    } TiffWriteOptions;
+
+    /*!
+     * Gets the TIFF specific compression parameters. The default is an uncompressed file with strips.
+     * A pyramid is always tiled, using 256x256 tiles if no tile size is given.
+     */
+    static TiffWriteOptions tiff_write_options(const SipiCompressionParams *params, size_t bps) {
+        TiffWriteOptions opts = {COMPRESSION_NONE, PREDICTOR_NONE, 0, 0, false};
+        if (params == nullptr) return opts;
+
+        auto param = params->find(TIFF_compression);
+        if (param != params->end()) {
+            std::string compression = param->second;
+            std::transform(compression.begin(), compression.end(), compression.begin(), ::tolower);
+            if (compression == "none") {
+                opts.compression = COMPRESSION_NONE;
+            } else if (compression == "deflate") {
+                opts.compression = COMPRESSION_ADOBE_DEFLATE;
+            } else if (compression == "lzw") {
+                opts.compression = COMPRESSION_LZW;
+#ifdef COMPRESSION_ZSTD
+            } else if (compression == "zstd") {
+                opts.compression = COMPRESSION_ZSTD;
+#endif
+            } else if (compression == "jpeg") {
+                if (bps != 8) {
+                    throw Sipi::SipiImageError(__file__, __LINE__, "JPEG compression in TIFF needs 8 bits/sample");
+                }
+                opts.compression = COMPRESSION_JPEG;
+            } else {
+                throw Sipi::SipiImageError(__file__, __LINE__, "Unsupported TIFF compression: " + param->second);
+            }
+            if (!TIFFIsCODECConfigured(opts.compression)) {
+                throw Sipi::SipiImageError(__file__, __LINE__,
+                                           "TIFF compression not available in libtiff: " + param->second);
+            }
+            if (opts.compression != COMPRESSION_NONE && opts.compression != COMPRESSION_JPEG) {
+                opts.predictor = PREDICTOR_HORIZONTAL;
+            }
+        }
+
+        param = params->find(TIFF_predictor);
+        if (param != params->end()) {
+            if (param->second == "none") {
+                opts.predictor = PREDICTOR_NONE;
+            } else if (param->second == "horizontal") {
+                if (opts.compression != COMPRESSION_NONE && opts.compression != COMPRESSION_JPEG) {
+                    opts.predictor = PREDICTOR_HORIZONTAL;
+                }
+            } else {
+                throw Sipi::SipiImageError(__file__, __LINE__, "Unsupported TIFF predictor: " + param->second);
+            }
+        }
+
+        if (opts.compression == COMPRESSION_JPEG) {
+            param = params->find(JPEG_QUALITY);
+            if (param != params->end()) {
+                try {
+                    opts.jpeg_quality = std::stoi(param->second);
+                } catch (const std::logic_error &err) {
+                    throw Sipi::SipiImageError(__file__, __LINE__, "Invalid JPEG quality: " + param->second);
+                }
+                if ((opts.jpeg_quality < 1) || (opts.jpeg_quality > 100)) {
+                    throw Sipi::SipiImageError(__file__, __LINE__, "Invalid JPEG quality: " + param->second);
+                }
+            }
+        }
+
+        param = params->find(TIFF_tile);
+        if (param != params->end()) {
+            int tile_size;
+            try {
+                tile_size = std::stoi(param->second);
+            } catch (const std::logic_error &err) {
+                throw Sipi::SipiImageError(__file__, __LINE__, "Invalid TIFF tile size: " + param->second);
+            }
+            if ((tile_size < 16) || ((tile_size % 16) != 0)) {
+                throw Sipi::SipiImageError(__file__, __LINE__,
+                                           "TIFF tile size must be a multiple of 16: " + param->second);
+            }
+            opts.tile_size = (uint32) tile_size;
+        }
+
+        param = params->find(TIFF_pyramid);
+        if ((param != params->end()) && (param->second == "yes")) {
+            if ((bps != 8) && (bps != 16)) {
+                throw Sipi::SipiImageError(__file__, __LINE__, "TIFF pyramid needs 8 or 16 bits/sample");
+            }
+            opts.pyramid = true;
+            if (opts.tile_size == 0) opts.tile_size = 256;
+        }
+        return opts;
+    }
+    //============================================================================
+
+    /*!
+     * Converts the a* and b* channels of CIELAB pixels in place to the signed encoding used by TIFF
+     *
+     * \returns false if the bits/sample are not supported
+     */
+    static bool cielab_to_signed(unsigned char *pixels, size_t npixels, size_t nc, size_t bps) {
+        if (bps == 8) {
+            for (size_t i = 0; i < npixels; i++) {
+                union {
+                    unsigned char u;
+                    signed char s;
+                } v;
+                v.s = pixels[nc*i + 1] - 128;
+                pixels[nc*i + 1] = v.u;
+                v.s = pixels[nc*i + 2] - 128;
+                pixels[nc*i + 2] = v.u;
+            }
+        }
+        else if (bps == 16) {
+            unsigned short *data = (unsigned short *) pixels;
+            for (size_t i = 0; i < npixels; i++) {
+                union {
+                    unsigned short u;
+                    signed short s;
+                } v;
+                v.s = data[nc*i + 1] - 32768;
+                data[nc*i + 1] = v.u;
+                v.s = data[nc*i + 2] - 32768;
+                data[nc*i + 2] = v.u;
+            }
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+    //============================================================================
+
+    /*!
+     * Sets the compression and tiling tags of the current directory
+     */
+    static void set_tiff_layout(TIFF *tif, const TiffWriteOptions &opts) {
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, opts.compression);
+        if (opts.predictor != PREDICTOR_NONE) {
+            TIFFSetField(tif, TIFFTAG_PREDICTOR, opts.predictor);
+        }
+        if ((opts.compression == COMPRESSION_JPEG) && (opts.jpeg_quality > 0)) {
+            TIFFSetField(tif, TIFFTAG_JPEGQUALITY, opts.jpeg_quality);
+        }
+        if (opts.tile_size > 0) {
+            TIFFSetField(tif, TIFFTAG_TILEWIDTH, opts.tile_size);
+            TIFFSetField(tif, TIFFTAG_TILELENGTH, opts.tile_size);
+        }
+    }
+    //============================================================================
+
+    /*!
+     * Writes a contiguous pixel buffer tile by tile. The tiles at the right and bottom border are
+     * padded with zeros.
+     *
+     * \returns false if a tile could not be written
+     */
+    static bool write_tiles(TIFF *tif, const unsigned char *buf, uint32 nx, uint32 ny, size_t nc, size_t bps,
+                            uint32 tile_size) {
+        const size_t psize = nc * bps / 8;
+        const size_t tsize = (size_t) tile_size * tile_size * psize;
+        std::vector<unsigned char> tilebuf(tsize);
+
+        for (uint32 ty = 0; ty < ny; ty += tile_size) {
+            const uint32 th = std::min(tile_size, ny - ty);
+            for (uint32 tx = 0; tx < nx; tx += tile_size) {
+                const uint32 tw = std::min(tile_size, nx - tx);
+                if ((tw < tile_size) || (th < tile_size)) {
+                    std::fill(tilebuf.begin(), tilebuf.end(), 0);
+                }
+                for (uint32 y = 0; y < th; y++) {
+                    memcpy(tilebuf.data() + y * tile_size * psize, buf + ((ty + y) * (size_t) nx + tx) * psize,
+                           tw * psize);
+                }
+                if (TIFFWriteEncodedTile(tif, TIFFComputeTile(tif, tx, ty, 0, 0), tilebuf.data(), tsize) < 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    //============================================================================
+
+    /*!
+     * Reduced resolution of an image to be written as SubIFD
+     */
+    typedef struct {
+        uint32 width;
+        uint32 height;
+        std::unique_ptr<unsigned char[]> pixels;
+    } TiffPyramidLevel;
+
+    /*!
+     * Creates the reduced resolutions of a pyramid by halving the size (averaging 2x2 pixels) until
+     * the image fits into one tile.
+     */
+    static std::vector<TiffPyramidLevel> tiff_pyramid(const unsigned char *pixels, size_t nx, size_t ny, size_t nc,
+                                                      size_t bps, uint32 tile_size) {
+        std::vector<TiffPyramidLevel> levels;
+        const unsigned char *in = pixels;
+
+        while (((nx > tile_size) || (ny > tile_size)) && (nx > 1) && (ny > 1)) {
+            TiffPyramidLevel level;
+            level.width = (uint32) (nx / 2);
+            level.height = (uint32) (ny / 2);
+            level.pixels = shttps::make_unique<unsigned char[]>((size_t) level.width * level.height * nc * bps / 8);
+            unsigned char *out = level.pixels.get();
+            const size_t nnx = level.width;
+            parallel_strips(level.height, nnx, [&](size_t first, size_t end) {
+                dispatch_kernel<BoxAverageKernel>(bps, nc, in + 2 * first * nx * nc * bps / 8, nx,
+                                                  out + first * nnx * nc * bps / 8, nnx, end - first,
+                                                  (size_t) 2, (size_t) 2);
+            });
+            levels.push_back(std::move(level));
+            in = levels.back().pixels.get();
+            nx = levels.back().width;
+            ny = levels.back().height;
+        }
+        return levels;
+    }
+    //============================================================================
+
+    void SipiIOTiff::setReadAdvice(bool use) {
+        tiff_read_advice = use;
+    }
+    //============================================================================
+
     void SipiIOTiff::initLibrary(void) {
         static bool done = false;
         if (!done) {
@@ -448,7 +851,9 @@ namespace Sipi {
                           ScalingQuality scaling_quality) {
         TIFF *tif;
 
-        if (nullptr != (tif = TIFFOpen(filepath.c_str(), "r"))) {
+        const bool whole_image = ((region == nullptr) || (region->getType() == SipiRegion::FULL)) &&
+                                 ((size == nullptr) || (size->getType() == SipiSize::FULL));
+        if (nullptr != (tif = tiffOpenAdvised(filepath, whole_image))) {
             TIFFSetErrorHandler(tiffError);
             TIFFSetWarningHandler(tiffWarning);
 
@@ -721,7 +1126,69 @@ namespace Sipi {
                 img->essential_metadata(se);
             }
 
-            if ((region == nullptr) || (region->getType() == SipiRegion::FULL)) {
+            bool level_used = false; // true, if a reduced resolution level of a pyramidal TIFF has been read
+            size_t level_nnx = 0, level_nny = 0; // final size if a reduced resolution level has been read
+            if ((img->bps == 8) || (img->bps == 16)) {
+                //
+                // read the tiles or strips which intersect the region
+                //
+                int roi_x = 0, roi_y = 0;
+                size_t roi_w = img->nx, roi_h = img->ny;
+                if ((region != nullptr) && (region->getType() != SipiRegion::FULL)) {
+                    region->crop_coords(img->nx, img->ny, roi_x, roi_y, roi_w, roi_h);
+                }
+
+                //
+                // for pyramidal TIFFs we use the smallest resolution level which is still at least as
+                // large as the requested size
+                //
+                if ((size != nullptr) && (size->getType() != SipiSize::FULL)) {
+                    int reduce = -1;
+                    bool redonly;
+                    size->get_size(roi_w, roi_h, level_nnx, level_nny, reduce, redonly);
+                    std::vector<TiffLevel> levels = tiff_levels(tif);
+                    for (auto level = levels.rbegin(); (level + 1) != levels.rend(); ++level) {
+                        double fx = (double) level->width / (double) img->nx;
+                        double fy = (double) level->height / (double) img->ny;
+                        if ((roi_w * fx < level_nnx) || (roi_h * fy < level_nny)) continue;
+                        if (TIFFSetSubDirectory(tif, level->offset) == 0) break;
+                        TIFF_GET_FIELD (tif, TIFFTAG_PLANARCONFIG, &planar, PLANARCONFIG_CONTIG);
+                        int lx = (int) (roi_x * fx);
+                        int ly = (int) (roi_y * fy);
+                        roi_w = std::max((size_t) 1,
+                                         std::min((size_t) (level->width - lx), (size_t) lround(roi_w * fx)));
+                        roi_h = std::max((size_t) 1,
+                                         std::min((size_t) (level->height - ly), (size_t) lround(roi_h * fy)));
+                        roi_x = lx;
+                        roi_y = ly;
+                        img->nx = level->width;
+                        img->ny = level->height;
+                        level_used = true;
+                        break;
+                    }
+                }
+
+                try {
+                    img->pixels = readBlocks(tif, filepath, img, planar, roi_x, roi_y, roi_w, roi_h);
+                } catch (Sipi::SipiImageError &err) {
+                    TIFFClose(tif);
+                    throw;
+                }
+                img->nx = roi_w;
+                img->ny = roi_h;
+
+                if (planar == PLANARCONFIG_SEPARATE) { // RRRRR…RRR GGGGG…GGGG BBBBB…BBB
+                    //
+                    // rearrange the data to RGBRGBRGB…RGB
+                    //
+                    separateToContig(img, roi_w * img->bps / 8); // convert to RGBRGBRGB...
+                }
+            } else if (TIFFIsTiled(tif) || ((region != nullptr) && (region->getType() != SipiRegion::FULL))) {
+                TIFFClose(tif);
+                std::string msg = "Images with " + std::to_string(img->bps) +
+                                  " bit/sample not supported for tiles or regions in file " + filepath;
+                throw Sipi::SipiImageError(__file__, __LINE__, msg);
+            } else {
                 if (planar == PLANARCONFIG_CONTIG) {
                     uint32 i;
                     uint8 *dataptr = new uint8[img->ny * sll];
@@ -760,77 +1227,6 @@ namespace Sipi {
                     //
                     separateToContig(img, sll); // convert to RGBRGBRGB...
                 }
-            } else {
-                int roi_x, roi_y;
-                size_t roi_w, roi_h;
-                region->crop_coords(img->nx, img->ny, roi_x, roi_y, roi_w, roi_h);
-                int ps; // pixel size in bytes
-
-                switch (img->bps) {
-                    case 1: {
-                        std::string msg = "Images with 1 bit/sample not supported in file " + filepath;
-                        throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                    }
-
-                    case 8: {
-                        ps = 1;
-                        break;
-                    }
-
-                    case 16: {
-                        ps = 2;
-                        break;
-                    }
-                }
-
-                uint8 *dataptr = new uint8[sll];
-                uint8 *inbuf = new uint8[ps * roi_w * roi_h * img->nc];
-
-                if (planar == PLANARCONFIG_CONTIG) { // RGBRGBRGBRGBRGBRGBRGBRGB
-                    for (uint32 i = 0; i < roi_h; i++) {
-                        if (TIFFReadScanline(tif, dataptr, roi_y + i, 0) == -1) {
-                            delete[] dataptr;
-                            delete[] inbuf;
-                            TIFFClose(tif);
-                            std::string msg =
-                                    "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " + filepath;
-                            throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                        }
-
-                        memcpy(inbuf + ps * i * roi_w * img->nc, dataptr + ps * roi_x * img->nc, ps * roi_w * img->nc);
-                    }
-
-                    img->nx = roi_w;
-                    img->ny = roi_h;
-                    img->pixels = inbuf;
-                } else if (planar == PLANARCONFIG_SEPARATE) { // RRRRR…RRR GGGGG…GGGG BBBBB…BBB
-                    for (uint32 j = 0; j < img->nc; j++) {
-                        for (uint32 i = 0; i < roi_h; i++) {
-                            if (TIFFReadScanline(tif, dataptr, roi_y + i, j) == -1) {
-                                delete[] dataptr;
-                                delete[] inbuf;
-                                TIFFClose(tif);
-                                std::string msg =
-                                        "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " +
-                                        filepath;
-                                throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                            }
-
-                            memcpy(inbuf + ps * roi_w * (j * roi_h + i), dataptr + ps * roi_x, ps * roi_w);
-                        }
-                    }
-
-                    img->nx = roi_w;
-                    img->ny = roi_h;
-                    img->pixels = inbuf;
-
-                    //
-                    // rearrange the data to RGBRGBRGB…RGB
-                    //
-                    separateToContig(img, roi_w * ps); // convert to RGBRGBRGB...
-                }
-
-                delete[] dataptr;
             }
             TIFFClose(tif);
 
@@ -980,7 +1376,17 @@ namespace Sipi {
             //
             // resize/Scale the image if necessary
             //
-            if (size != NULL) {
+            if (level_used) {
+                if ((img->nx != level_nnx) || (img->ny != level_nny)) {
+                    switch (scaling_quality.jpeg) {
+                        case HIGH: img->scale(level_nnx, level_nny);
+                            break;
+                        case MEDIUM: img->scaleMedium(level_nnx, level_nny);
+                            break;
+                        case LOW: img->scaleFast(level_nnx, level_nny);
+                    }
+                }
+            } else if (size != NULL) {
                 size_t nnx, nny;
                 int reduce = -1;
                 bool redonly;
@@ -1007,10 +1413,180 @@ namespace Sipi {
     //============================================================================
 
 
+    /*!
+     * The fields of a TIFF directory needed by getDim
+     */
+    struct TiffHeaderDir {
+        uint64_t width = 0;
+        uint64_t height = 0;
+        uint64_t tile_width = 0;
+        uint64_t tile_height = 0;
+        uint64_t spp = 1;
+        uint64_t bps = 1;
+        uint64_t subfiletype = 0;
+        std::vector<uint64_t> subifds;
+        std::string sipimeta;
+        uint64_t next = 0; //!< offset of the next IFD, 0 if none
+    };
+
+    /*!
+     * Parses a TIFF or BigTIFF directory without libtiff
+     *
+     * \returns false if the directory cannot be parsed
+     */
+    static bool tiff_header_dir(SipiHeaderReader &hdr, bool big_endian, bool bigtiff, uint64_t offset,
+                                TiffHeaderDir &dir) {
+        const int count_size = bigtiff ? 8 : 2;     // size of the number of entries
+        const int entry_size = bigtiff ? 20 : 12;
+        const int value_size = bigtiff ? 8 : 4;     // size of the value/offset field of an entry
+
+        uint64_t nentries;
+        if (!hdr.getUint(offset, count_size, big_endian, nentries) || (nentries == 0) || (nentries > 4096)) {
+            return false;
+        }
+        std::vector<unsigned char> entries(nentries * entry_size);
+        if (!hdr.read(offset + count_size, entries.data(), entries.size())) return false;
+        if (!hdr.getUint(offset + count_size + entries.size(), value_size, big_endian, dir.next)) return false;
+
+        auto get = [big_endian](const unsigned char *p, int nbytes) -> uint64_t {
+            uint64_t val = 0;
+            for (int i = 0; i < nbytes; i++) val = (val << 8) | p[big_endian ? i : nbytes - 1 - i];
+            return val;
+        };
+
+        for (uint64_t i = 0; i < nentries; i++) {
+            const unsigned char *entry = entries.data() + i * entry_size;
+            uint16_t tag = get(entry, 2);
+            uint16_t type = get(entry + 2, 2);
+            uint64_t count = get(entry + 4, bigtiff ? 8 : 4);
+            const unsigned char *value = entry + (bigtiff ? 12 : 8);
+
+            int type_size;
+            switch (type) {
+                case TIFF_BYTE:
+                case TIFF_ASCII: type_size = 1; break;
+                case TIFF_SHORT: type_size = 2; break;
+                case TIFF_LONG:
+                case TIFF_IFD: type_size = 4; break;
+                case TIFF_LONG8:
+                case TIFF_IFD8: type_size = 8; break;
+                default: continue; // not a type of the fields we need
+            }
+            if ((count == 0) || (count > (1 << 20))) continue;
+
+            //
+            // the values are stored in the entry if they fit, otherwise the entry holds their offset
+            //
+            std::vector<unsigned char> values(count * type_size);
+            if (values.size() <= (size_t) value_size) {
+                memcpy(values.data(), value, values.size());
+            } else if ((tag == TIFFTAG_SUBIFD) || (tag == TIFFTAG_SIPIMETA) || (tag == TIFFTAG_BITSPERSAMPLE)) {
+                if (!hdr.read(get(value, value_size), values.data(), values.size())) return false;
+            } else {
+                continue;
+            }
+            uint64_t first = (type == TIFF_ASCII) ? 0 : get(values.data(), type_size);
+
+            switch (tag) {
+                case TIFFTAG_IMAGEWIDTH: dir.width = first; break;
+                case TIFFTAG_IMAGELENGTH: dir.height = first; break;
+                case TIFFTAG_TILEWIDTH: dir.tile_width = first; break;
+                case TIFFTAG_TILELENGTH: dir.tile_height = first; break;
+                case TIFFTAG_SAMPLESPERPIXEL: dir.spp = first; break;
+                case TIFFTAG_BITSPERSAMPLE: dir.bps = first; break;
+                case TIFFTAG_SUBFILETYPE: dir.subfiletype = first; break;
+                case TIFFTAG_SUBIFD: {
+                    for (uint64_t j = 0; j < count; j++) dir.subifds.push_back(get(values.data() + j * type_size, type_size));
+                    break;
+                }
+                case TIFFTAG_SIPIMETA: {
+                    dir.sipimeta.assign((const char *) values.data(), strnlen((const char *) values.data(), count));
+                    break;
+                }
+                default: ;
+            }
+        }
+        return (dir.width > 0) && (dir.height > 0);
+    }
+    //============================================================================
+
+    /*!
+     * Gets the dimensions, tiles and resolution levels (see tiff_levels()) of the first image of a
+     * TIFF or BigTIFF file from its directories, without libtiff
+     *
+     * \returns false if the file cannot be parsed
+     */
+    static bool tiff_header_info(SipiHeaderReader &hdr, SipiImgInfo &info) {
+        const std::vector<unsigned char> &head = hdr.first();
+        if (head.size() < 8) return false;
+        bool big_endian;
+        if ((head[0] == 'I') && (head[1] == 'I')) big_endian = false;
+        else if ((head[0] == 'M') && (head[1] == 'M')) big_endian = true;
+        else return false;
+
+        uint64_t version, offset;
+        if (!hdr.getUint(2, 2, big_endian, version)) return false;
+        bool bigtiff = (version == 43);
+        if (bigtiff) {
+            uint64_t offset_size;
+            if (!hdr.getUint(4, 2, big_endian, offset_size) || (offset_size != 8)) return false;
+            if (!hdr.getUint(8, 8, big_endian, offset)) return false;
+        } else if (version == 42) {
+            if (!hdr.getUint(4, 4, big_endian, offset)) return false;
+        } else {
+            return false;
+        }
+
+        TiffHeaderDir main;
+        if (!tiff_header_dir(hdr, big_endian, bigtiff, offset, main)) return false;
+        info.width = main.width;
+        info.height = main.height;
+        if ((main.tile_width > 0) && (main.tile_height > 0)) {
+            info.tile_width = main.tile_width;
+            info.tile_height = main.tile_height;
+        }
+        info.success = SipiImgInfo::DIMS;
+        if (!main.sipimeta.empty()) {
+            SipiEssentials se(main.sipimeta);
+            info.origmimetype = se.mimetype();
+            info.origname = se.origname();
+            info.success = SipiImgInfo::ALL;
+        }
+
+        size_t nlevels = 1;
+        auto is_level = [&](uint64_t dir_offset, TiffHeaderDir &reduced) -> bool {
+            return tiff_header_dir(hdr, big_endian, bigtiff, dir_offset, reduced) &&
+                   (reduced.spp == main.spp) && (reduced.bps == main.bps);
+        };
+        if (!main.subifds.empty()) {
+            for (auto subifd : main.subifds) {
+                TiffHeaderDir reduced;
+                if (is_level(subifd, reduced)) nlevels++;
+            }
+        } else {
+            uint64_t next = main.next;
+            for (int i = 0; (next != 0) && (i < 64); i++) {
+                TiffHeaderDir reduced;
+                if (!is_level(next, reduced) || ((reduced.subfiletype & FILETYPE_REDUCEDIMAGE) == 0)) break;
+                nlevels++;
+                next = reduced.next;
+            }
+        }
+        if (nlevels > 1) info.clevels = nlevels;
+        return true;
+    }
+    //============================================================================
+
     SipiImgInfo SipiIOTiff::getDim(std::string filepath, int pagenum) {
         TIFF *tif;
         SipiImgInfo info;
-        if (nullptr != (tif = TIFFOpen(filepath.c_str(), "r"))) {
+        if (SipiHeaderReader::isEnabled()) {
+            SipiHeaderReader hdr(filepath);
+            if (!hdr.good()) return info;
+            if (tiff_header_info(hdr, info)) return info;
+            info = SipiImgInfo();
+        }
+        if (nullptr != (tif = tiffOpenAdvised(filepath, false))) {
             //
             // OK, it's a TIFF file
             //
@@ -1034,6 +1610,15 @@ namespace Sipi {
             info.height = tmp_height;
             info.success = SipiImgInfo::DIMS;
 
+            if (TIFFIsTiled(tif)) {
+                uint32 tile_width, tile_height;
+                if ((TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tile_width) == 1) &&
+                    (TIFFGetField(tif, TIFFTAG_TILELENGTH, &tile_height) == 1)) {
+                    info.tile_width = tile_width;
+                    info.tile_height = tile_height;
+                }
+            }
+
             char *emdatastr;
             if (1 == TIFFGetField(tif, TIFFTAG_SIPIMETA, &emdatastr)) {
                 SipiEssentials se(emdatastr);
@@ -1042,6 +1627,14 @@ namespace Sipi {
                 info.success = SipiImgInfo::ALL;
             }
 
+            //
+            // pyramidal TIFF: the number of resolution levels is reported like the decomposition levels of J2K
+            //
+            std::vector<TiffLevel> levels = tiff_levels(tif);
+            if (levels.size() > 1) {
+                info.clevels = levels.size();
+            }
+
             TIFFClose(tif);
         }
         return info;
@@ -1053,6 +1646,7 @@ namespace Sipi {
         TIFF *tif;
         MEMTIFF *memtif = nullptr;
         uint32 rowsperstrip = (uint32) -1;
+        TiffWriteOptions opts = tiff_write_options(params, img->bps);
         if ((filepath == "stdout:") || (filepath == "HTTP")) {
             memtif = memTiffOpen();
             tif = TIFFClientOpen("MEMTIFF", "w", (thandle_t) memtif, memTiffReadProc, memTiffWriteProc, memTiffSeekProc,
@@ -1067,7 +1661,9 @@ namespace Sipi {
         TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (int) img->nx);
         TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (int) img->ny);
         TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, rowsperstrip));
+        if (opts.tile_size == 0) {
+            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, rowsperstrip));
+        }
         TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
         TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
         bool its_1_bit = false;
@@ -1101,40 +1697,21 @@ namespace Sipi {
         else {
             TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16) img->bps);
         }
+        //
+        // the reduced resolutions have to be calculated before the CIELAB values are converted to signed values
+        //
+        std::vector<TiffPyramidLevel> levels;
+        if (opts.pyramid && !its_1_bit) {
+            levels = tiff_pyramid(img->pixels, img->nx, img->ny, img->nc, img->bps, opts.tile_size);
+        }
         if (img->photo == PhotometricInterpretation::CIELAB) {
-            if (img->bps == 8) {
-                for (int y = 0; y < img->ny; y++) {
-                    for (int x = 0; x < img->nx; x++) {
-                        union {
-                            unsigned char u;
-                            signed char s;
-                        } v;
-                        v.s = img->pixels[img->nc*(y*img->nx + x) + 1] - 128;
-                        img->pixels[img->nc*(y*img->nx + x) + 1] = v.u;
-                        v.s = img->pixels[img->nc*(y*img->nx + x) + 2] - 128;
-                        img->pixels[img->nc*(y*img->nx + x) + 2] = v.u;
-                    }
-                }
-            }
-            else if (img->bps == 16) {
-                for (int y = 0; y < img->ny; y++) {
-                    for (int x = 0; x < img->nx; x++) {
-                        unsigned short *data = (unsigned short *) img->pixels;
-                        union {
-                            unsigned short u;
-                            signed short s;
-                        } v;
-                        v.s = data[img->nc*(y*img->nx + x) + 1] - 32768;
-                        data[img->nc*(y*img->nx + x) + 1] = v.u;
-                        v.s = data[img->nc*(y*img->nx + x) + 2] - 32768;
-                        data[img->nc*(y*img->nx + x) + 2] = v.u;
-                    }
-                }
-            }
-            else {
+            if (!cielab_to_signed(img->pixels, img->nx * img->ny, img->nc, img->bps)) {
                 throw Sipi::SipiImageError(__file__, __LINE__, "Unsupported bits per sample (" +
                                                                std::to_string(img->bps) + ")");
             }
+            for (auto &level : levels) {
+                cielab_to_signed(level.pixels.get(), (size_t) level.width * level.height, img->nc, img->bps);
+            }
 
             //delete img->icc; we don't want to add the ICC profile in this case (doesn't make sense!)
             img->icc = nullptr;
@@ -1147,6 +1724,14 @@ namespace Sipi {
 
         TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, img->photo);
 
+        if (!its_1_bit) {
+            set_tiff_layout(tif, opts);
+            if (!levels.empty()) {
+                std::vector<toff_t> subifds(levels.size(), 0); // the offsets are filled in by libtiff
+                TIFFSetField(tif, TIFFTAG_SUBIFD, (uint16) levels.size(), subifds.data());
+            }
+        }
+
         //
         // let's get the TIFF metadata if there is some. We stored the TIFF metadata in the exifData meber variable!
         //
@@ -1267,32 +1852,78 @@ namespace Sipi {
             }
 
             delete[] buf;
+        } else if (opts.tile_size > 0) {
+            if (!write_tiles(tif, img->pixels, img->nx, img->ny, img->nc, img->bps, opts.tile_size)) {
+                TIFFClose(tif);
+                if (memtif != nullptr) memTiffFree(memtif);
+                throw Sipi::SipiImageError(__file__, __LINE__, "Writing tiles of \"" + filepath + "\" failed!");
+            }
         } else {
             for (size_t i = 0; i < img->ny; i++) {
                 TIFFWriteScanline(tif, img->pixels + i * img->nc * img->nx * (img->bps / 8), (int) i, 0);
             }
         }
         //
+        // write the reduced resolutions as SubIFDs of the main image
+        //
+        if (!levels.empty()) {
+            TIFFWriteDirectory(tif);
+            for (auto &level : levels) {
+                TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+                TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, level.width);
+                TIFFSetField(tif, TIFFTAG_IMAGELENGTH, level.height);
+                TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+                TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+                TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16) img->bps);
+                TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, img->nc);
+                if (img->es.size() > 0) {
+                    TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, img->es.size(), img->es.data());
+                }
+                TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, img->photo);
+                set_tiff_layout(tif, opts);
+                if (!write_tiles(tif, level.pixels.get(), level.width, level.height, img->nc, img->bps,
+                                 opts.tile_size)) {
+                    TIFFClose(tif);
+                    if (memtif != nullptr) memTiffFree(memtif);
+                    throw Sipi::SipiImageError(__file__, __LINE__,
+                                               "Writing reduced resolution of \"" + filepath + "\" failed!");
+                }
+                TIFFWriteDirectory(tif);
+            }
+        }
+        //
         // write exif data
         //
         if (img->exif != nullptr) {
-            TIFFWriteDirectory(tif);
+            if (levels.empty()) TIFFWriteDirectory(tif);
             writeExif(img, tif);
         }
         TIFFClose(tif);
 
         if (memtif != nullptr) {
-            if (filepath == "stdout:") {
-                size_t n = 0;
+            const size_t nchunks = (memtif->flen + memtif->chunksiz - 1) / memtif->chunksiz;
+            auto chunk_size = [memtif](size_t i) -> size_t {
+                return (size_t) std::min(memtif->chunksiz, memtif->flen - (tsize_t) (i * memtif->chunksiz));
+            };
 
-                while (n < memtif->flen) {
-                    n += fwrite(&(memtif->data[n]), 1, memtif->flen - n > 10240 ? 10240 : memtif->flen - n, stdout);
+            if (filepath == "stdout:") {
+                for (size_t i = 0; i < nchunks; i++) {
+                    fwrite(memtif->chunks[i].get(), 1, chunk_size(i), stdout);
                 }
 
                 fflush(stdout);
             } else if (filepath == "HTTP") {
+                shttps::Connection *conn = img->connection();
                 try {
-                    img->connection()->sendAndFlush(memtif->data, memtif->flen);
+                    //
+                    // the chunks are sent one by one without copying them into one buffer. Without an
+                    // output buffer, this needs chunked transfer encoding.
+                    //
+                    if (!conn->isBuffered() && !conn->isChunked()) conn->setChunkedTransfer();
+                    for (size_t i = 0; i + 1 < nchunks; i++) {
+                        conn->send(memtif->chunks[i].get(), chunk_size(i));
+                    }
+                    if (nchunks > 0) conn->sendAndFlush(memtif->chunks[nchunks - 1].get(), chunk_size(nchunks - 1));
                 } catch (int i) {
                     memTiffFree(memtif);
                     throw Sipi::SipiImageError(__file__, __LINE__,
@@ -1620,6 +2251,121 @@ namespace Sipi {
     //============================================================================
 
 
+    unsigned char *SipiIOTiff::readBlocks(TIFF *tif, const std::string &filepath, SipiImage *img, uint16 planar,
+                                          uint32 roi_x, uint32 roi_y, uint32 roi_w, uint32 roi_h) {
+        const bool tiled = TIFFIsTiled(tif);
+        uint32 bw, bh; // block width and height
+        if (tiled) {
+            TIFF_GET_FIELD (tif, TIFFTAG_TILEWIDTH, &bw, img->nx);
+            TIFF_GET_FIELD (tif, TIFFTAG_TILELENGTH, &bh, img->ny);
+        } else {
+            bw = img->nx;
+            TIFF_GET_FIELD (tif, TIFFTAG_ROWSPERSTRIP, &bh, img->ny);
+            if (bh > img->ny) bh = img->ny;
+        }
+        if ((bw == 0) || (bh == 0)) {
+            throw Sipi::SipiImageError(__file__, __LINE__, "Invalid tile or strip size in file " + filepath);
+        }
+
+        const size_t ps = img->bps / 8; // bytes per sample
+        const size_t spp = (planar == PLANARCONFIG_CONTIG) ? img->nc : 1; // samples per pixel within a block
+        const size_t nplanes = (planar == PLANARCONFIG_CONTIG) ? 1 : img->nc;
+        const tmsize_t blocksize = tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+        const uint32 first_brow = roi_y / bh;
+        const uint32 nbrows = (roi_y + roi_h + bh - 1) / bh - first_brow;
+        const uint32 first_bcol = roi_x / bw;
+        const uint32 end_bcol = (roi_x + roi_w + bw - 1) / bw;
+        const toff_t diroffset = TIFFCurrentDirOffset(tif); // also valid for SubIFDs
+        const size_t planesize = ps * spp * roi_w * roi_h;
+
+        //
+        // for files opened with tiffOpenAdvised, the blocks of the region are read ahead asynchronously.
+        // This avoids waiting for each block in turn, especially on network file systems.
+        //
+        toff_t *offsets = nullptr;
+        toff_t *bytecounts = nullptr;
+        if ((TIFFGetMapFileProc(tif) == fdTiffMapProc) &&
+            (TIFFGetField(tif, tiled ? TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS, &offsets) == 1) &&
+            (TIFFGetField(tif, tiled ? TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS, &bytecounts) == 1)) {
+            FDTIFF *fdtif = (FDTIFF *) TIFFClientdata(tif);
+            for (uint32 br = first_brow; br < first_brow + nbrows; br++) {
+                for (uint32 bc = first_bcol; bc < end_bcol; bc++) {
+                    for (size_t plane = 0; plane < nplanes; plane++) {
+                        uint32 block = tiled ? TIFFComputeTile(tif, bc * bw, br * bh, 0, plane)
+                                             : TIFFComputeStrip(tif, br * bh, plane);
+                        fdTiffWillNeed(fdtif, offsets[block], bytecounts[block]);
+                    }
+                }
+            }
+        }
+
+        uint8 *outbuf = new uint8[planesize * nplanes];
+        std::atomic<bool> failed(false);
+
+        //
+        // The rows of blocks are distributed to several threads for large regions. Since a TIFF
+        // handle must not be shared between threads, each additional thread opens the file again.
+        //
+        auto read_block_rows = [&](size_t first, size_t end) {
+            TIFF *btif = tif;
+            if (first != 0) {
+                if ((btif = tiffOpenAdvised(filepath, false)) == nullptr) {
+                    failed = true;
+                    return;
+                }
+                if (TIFFSetSubDirectory(btif, diroffset) == 0) {
+                    TIFFClose(btif);
+                    failed = true;
+                    return;
+                }
+            }
+
+            std::vector<uint8> blockbuf(blocksize);
+            for (uint32 br = first_brow + first; (br < first_brow + end) && !failed; br++) {
+                const uint32 by = br * bh;
+                const uint32 y0 = std::max(by, roi_y);
+                const uint32 y1 = std::min(by + bh, roi_y + roi_h);
+                for (uint32 bc = first_bcol; (bc < end_bcol) && !failed; bc++) {
+                    const uint32 bx = bc * bw;
+                    const uint32 x0 = std::max(bx, roi_x);
+                    const uint32 x1 = std::min(bx + bw, roi_x + roi_w);
+                    for (size_t plane = 0; plane < nplanes; plane++) {
+                        tmsize_t n;
+                        if (tiled) {
+                            n = TIFFReadEncodedTile(btif, TIFFComputeTile(btif, bx, by, 0, plane), blockbuf.data(),
+                                                    blocksize);
+                        } else {
+                            n = TIFFReadEncodedStrip(btif, TIFFComputeStrip(btif, by, plane), blockbuf.data(),
+                                                     blocksize);
+                        }
+                        if (n == -1) {
+                            failed = true;
+                            break;
+                        }
+                        for (uint32 y = y0; y < y1; y++) {
+                            memcpy(outbuf + plane * planesize + ps * spp * ((y - roi_y) * roi_w + (x0 - roi_x)),
+                                   blockbuf.data() + ps * spp * ((y - by) * bw + (x0 - bx)),
+                                   ps * spp * (x1 - x0));
+                        }
+                    }
+                }
+            }
+
+            if (btif != tif) TIFFClose(btif);
+        };
+        parallel_strips(nbrows, roi_w * bh, read_block_rows);
+
+        if (failed) {
+            delete[] outbuf;
+            std::string msg = std::string(tiled ? "TIFFReadEncodedTile" : "TIFFReadEncodedStrip") +
+                              " failed in file " + filepath;
+            throw Sipi::SipiImageError(__file__, __LINE__, msg);
+        }
+        return outbuf;
+    }
+    //============================================================================
+
+
     void SipiIOTiff::separateToContig(SipiImage *img, unsigned int sll) {
         //
         // rearrange RRRRRR...GGGGG...BBBBB data  to RGBRGBRGB…RGB
@@ -1645,7 +2391,7 @@ namespace Sipi {
             for (unsigned int k = 0; k < img->nc; k++) {
                 for (unsigned int j = 0; j < img->ny; j++) {
                     for (unsigned int i = 0; i < img->nx; i++) {
-                        tmpptr[img->nc * (j * img->nx + i) + k] = dataptr[k * img->ny * sll + j * img->nx + i];
+                        tmpptr[img->nc * (j * img->nx + i) + k] = dataptr[k * img->ny * (sll / 2) + j * img->nx + i];
                     }
                 }
             }
@@ -0,0 +1,273 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#include "SipiIOWebp.h"
+#include "SipiHeaderReader.h"
+
+#include <webp/decode.h>
+#include <webp/encode.h>
+
+static const char __file__[] = __FILE__;
+
+namespace Sipi {
+
+    /*!
+     * WebP limits the width and height of an image to 16383 pixels
+     */
+    static const size_t WEBP_MAX_DIMENSION = 16383;
+
+    /*!
+     * The header of a WebP file is 12 bytes: "RIFF", the file size, "WEBP"
+     */
+    static bool is_webp(const unsigned char *header, size_t len) {
+        return (len >= 12) && (memcmp(header, "RIFF", 4) == 0) && (memcmp(header + 8, "WEBP", 4) == 0);
+    }
+    //============================================================================
+
+
+    bool SipiIOWebp::read(SipiImage *img, std::string filepath, int pagenum, std::shared_ptr<SipiRegion> region,
+                          std::shared_ptr<SipiSize> size, bool force_bps_8, ScalingQuality scaling_quality) {
+        FILE *infile;
+        if ((infile = fopen(filepath.c_str(), "rb")) == nullptr) {
+            return false;
+        }
+        unsigned char header[12];
+        if ((fread(header, 1, 12, infile) != 12) || !is_webp(header, 12)) {
+            fclose(infile);
+            return false; // it's not a WebP file
+        }
+
+        fseek(infile, 0, SEEK_END);
+        long filesize = ftell(infile);
+        fseek(infile, 0, SEEK_SET);
+        std::vector<uint8_t> data(filesize > 0 ? filesize : 0);
+        size_t nread = fread(data.data(), 1, data.size(), infile);
+        fclose(infile);
+        if (nread != data.size()) {
+            throw SipiImageError(__file__, __LINE__, "Error reading WebP file \"" + filepath + "\"!");
+        }
+
+        WebPBitstreamFeatures features;
+        if (WebPGetFeatures(data.data(), data.size(), &features) != VP8_STATUS_OK) {
+            throw SipiImageError(__file__, __LINE__, "Error reading WebP file \"" + filepath + "\": Invalid header!");
+        }
+        if (features.has_animation) {
+            throw SipiImageError(__file__, __LINE__, "Animated WebP file \"" + filepath + "\" is not supported!");
+        }
+
+        img->nx = features.width;
+        img->ny = features.height;
+        img->nc = features.has_alpha ? 4 : 3;
+        img->bps = 8;
+        img->photo = RGB;
+        img->icc = std::make_shared<SipiIcc>(icc_sRGB);
+        if (features.has_alpha) {
+            img->es.push_back(ASSOCALPHA);
+        }
+
+        size_t sll = img->nx * img->nc;
+        uint8_t *buffer = new uint8_t[img->ny * sll];
+        uint8_t *res;
+        if (features.has_alpha) {
+            res = WebPDecodeRGBAInto(data.data(), data.size(), buffer, img->ny * sll, (int) sll);
+        } else {
+            res = WebPDecodeRGBInto(data.data(), data.size(), buffer, img->ny * sll, (int) sll);
+        }
+        if (res == nullptr) {
+            delete[] buffer;
+            throw SipiImageError(__file__, __LINE__, "Error decoding WebP file \"" + filepath + "\"!");
+        }
+        img->pixels = buffer;
+
+        if (region != nullptr) { //we just use the image.crop method
+            (void) img->crop(region);
+        }
+
+        //
+        // resize/Scale the image if necessary
+        //
+        if (size != nullptr) {
+            size_t nnx, nny;
+            int reduce = -1;
+            bool redonly;
+            SipiSize::SizeType rtype = size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
+            if (rtype != SipiSize::FULL) {
+                switch (scaling_quality.png) {
+                    case HIGH: img->scale(nnx, nny);
+                        break;
+                    case MEDIUM: img->scaleMedium(nnx, nny);
+                        break;
+                    case LOW: img->scaleFast(nnx, nny);
+                }
+            }
+        }
+        return true;
+    }
+    //============================================================================
+
+
+    SipiImgInfo SipiIOWebp::getDim(std::string filepath, int pagenum) {
+        SipiImgInfo info;
+        SipiHeaderReader hdr(filepath);
+        const std::vector<unsigned char> &head = hdr.first();
+        if (!is_webp(head.data(), head.size())) {
+            return info;
+        }
+        //
+        // the dimensions are in the first chunk, which is in the first bytes for all of VP8, VP8L and VP8X
+        //
+        int width, height;
+        if (WebPGetInfo(head.data(), head.size(), &width, &height) == 0) {
+            return info;
+        }
+        info.width = width;
+        info.height = height;
+        info.success = SipiImgInfo::DIMS;
+        return info;
+    }
+    //============================================================================
+
+
+    void SipiIOWebp::write(SipiImage *img, std::string filepath, const SipiCompressionParams *params) {
+        float quality = 80.0F;
+        bool lossless = false;
+        if (params != nullptr) {
+            if (params->find(WEBP_quality) != params->end()) {
+                try {
+                    quality = std::stof(params->at(WEBP_quality));
+                } catch (const std::logic_error &err) {
+                    quality = -1.0F;
+                }
+                if ((quality < 0.0F) || (quality > 100.0F)) {
+                    throw SipiImageError(__file__, __LINE__, "WebP quality must be a number between 0 and 100");
+                }
+            }
+            if (params->find(WEBP_lossless) != params->end()) {
+                lossless = (params->at(WEBP_lossless) == "yes");
+            }
+        }
+
+        if ((img->nx > WEBP_MAX_DIMENSION) || (img->ny > WEBP_MAX_DIMENSION)) {
+            throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath + "\": image of " +
+                                 std::to_string(img->nx) + "x" + std::to_string(img->ny) +
+                                 " pixels exceeds the maximum of " + std::to_string(WEBP_MAX_DIMENSION) + " pixels");
+        }
+
+        if (!img->to8bps()) {
+            throw SipiImageError(__file__, __LINE__, "Cannot convert to 8 Bits/sample");
+        }
+
+        //
+        // WebP knows only RGB with an optional alpha channel. We keep the first alpha channel,
+        // remove all extra channels and convert the colors to sRGB
+        //
+        std::vector<uint8_t> alpha;
+        if (img->es.size() > 0) {
+            size_t achan = img->nc - img->es.size();
+            alpha.resize(img->nx * img->ny);
+            for (size_t i = 0; i < img->nx * img->ny; i++) {
+                alpha[i] = img->pixels[i * img->nc + achan];
+            }
+            while (img->es.size() > 0) {
+                img->removeChan(img->nc - 1);
+            }
+        }
+        if ((img->nc != 3) || (img->photo != RGB) || ((img->icc != nullptr) &&
+                                                      (img->icc->getProfileType() != icc_sRGB))) {
+            img->convertToIcc(SipiIcc(icc_sRGB), 8);
+        }
+
+        WebPConfig config;
+        if (!WebPConfigPreset(&config, WEBP_PRESET_DEFAULT, quality)) {
+            throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath + "\": WebP version mismatch");
+        }
+        config.lossless = lossless ? 1 : 0;
+        config.thread_level = 1;
+
+        WebPPicture picture;
+        if (!WebPPictureInit(&picture)) {
+            throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath + "\": WebP version mismatch");
+        }
+        picture.use_argb = lossless ? 1 : 0;
+        picture.width = img->nx;
+        picture.height = img->ny;
+
+        int ok;
+        if (alpha.empty()) {
+            ok = WebPPictureImportRGB(&picture, img->pixels, img->nx * 3);
+        } else {
+            std::vector<uint8_t> rgba(img->nx * img->ny * 4);
+            for (size_t i = 0; i < img->nx * img->ny; i++) {
+                rgba[4 * i] = img->pixels[3 * i];
+                rgba[4 * i + 1] = img->pixels[3 * i + 1];
+                rgba[4 * i + 2] = img->pixels[3 * i + 2];
+                rgba[4 * i + 3] = alpha[i];
+            }
+            ok = WebPPictureImportRGBA(&picture, rgba.data(), img->nx * 4);
+        }
+        if (!ok) {
+            WebPPictureFree(&picture);
+            throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath + "\": out of memory");
+        }
+
+        WebPMemoryWriter writer;
+        WebPMemoryWriterInit(&writer);
+        picture.writer = WebPMemoryWrite;
+        picture.custom_ptr = &writer;
+        ok = WebPEncode(&config, &picture);
+        WebPEncodingError error_code = picture.error_code;
+        WebPPictureFree(&picture);
+        if (!ok) {
+            WebPMemoryWriterClear(&writer);
+            throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath +
+                                 "\": encoder error " + std::to_string(error_code));
+        }
+
+        if (filepath == "HTTP") {
+            try {
+                img->connection()->sendAndFlush(writer.mem, writer.size);
+            } catch (int i) { // an error occured in sending the data (broken pipe?)
+                // do nothing...
+            }
+        } else if (filepath == "stdout:") {
+            fwrite(writer.mem, 1, writer.size, stdout);
+            fflush(stdout);
+        } else {
+            std::ofstream outfile(filepath, std::ofstream::binary);
+            if (!outfile) {
+                WebPMemoryWriterClear(&writer);
+                throw SipiImageError(__file__, __LINE__, "Error writing WebP file \"" + filepath +
+                                     "\": Could not open output file !");
+            }
+            outfile.write((const char *) writer.mem, writer.size);
+        }
+        WebPMemoryWriterClear(&writer);
+    }
+}
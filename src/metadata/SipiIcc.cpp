@@ -33,6 +33,7 @@ static const char __file__[] = __FILE__;
 
 #include "SipiImage.h"
 #include "shttps/makeunique.h"
+#include "shttps/Hash.h"
 
 namespace Sipi {
 
@@ -49,8 +50,8 @@ namespace Sipi {
         unsigned int len = cmsGetProfileInfoASCII(icc_profile, cmsInfoDescription, cmsNoLanguage, cmsNoCountry, nullptr, 0);
         auto buf = shttps::make_unique<char[]>(len);
         cmsGetProfileInfoASCII(icc_profile, cmsInfoDescription, cmsNoLanguage, cmsNoCountry, buf.get(), len);
-        if (strcmp(buf.get(), "sRGB IEC61966-2.1") == 0) {
-            profile_type = icc_sRGB;
+        if ((strcmp(buf.get(), "sRGB IEC61966-2.1") == 0) || (strcmp(buf.get(), "sRGB built-in") == 0)) {
+            profile_type = icc_sRGB; // "sRGB built-in" is the profile of lcms2 which SIPI embeds itself
         }
         else if (strncmp(buf.get(), "AdobeRGB", 8) == 0) {
             profile_type = icc_AdobeRGB;
@@ -58,6 +59,9 @@ namespace Sipi {
         else {
             profile_type = icc_unknown;
         }
+        shttps::Hash hash(shttps::HashType::md5);
+        hash.add_data(icc_buf, icc_len);
+        profile_hash = hash.hash();
     }
 
     SipiIcc::SipiIcc(const SipiIcc &icc_p) {
@@ -74,6 +78,7 @@ namespace Sipi {
             }
 
             profile_type = icc_p.profile_type;
+            profile_hash = icc_p.profile_hash;
         }
         else {
             icc_profile = nullptr;
@@ -91,6 +96,9 @@ namespace Sipi {
             if ((icc_profile = cmsOpenProfileFromMem(buf.get(), len)) == nullptr) {
                 throw SipiError(__file__, __LINE__, "cmsOpenProfileFromMem failed");
             }
+            shttps::Hash hash(shttps::HashType::md5);
+            hash.add_data(buf.get(), len);
+            profile_hash = hash.hash();
         }
         profile_type = icc_unknown;
     }
@@ -158,6 +166,10 @@ namespace Sipi {
                 break;
             }
         }
+        //
+        // the predefined profiles are always created the same way, their type identifies them without a checksum
+        //
+        if (icc_profile != nullptr) profile_hash = "predefined:" + std::to_string(profile_type);
     }
 
     SipiIcc::SipiIcc(float white_point_p[], float primaries_p[], const unsigned short tfunc[], const int tfunc_len) {
@@ -194,6 +206,7 @@ namespace Sipi {
         icc_profile = cmsCreateRGBProfileTHR(context, &white_point, &primaries, tonecurve);
         profile_type = icc_RGB;
         cmsFreeToneCurveTriple(tonecurve);
+        profile_hash = profileChecksum();
     }
 
     SipiIcc::~SipiIcc() {
@@ -214,6 +227,7 @@ namespace Sipi {
                 }
             }
             profile_type = rhs.profile_type;
+            profile_hash = rhs.profile_hash;
         }
         return *this;
     }
@@ -359,6 +373,17 @@ namespace Sipi {
         return format;
     }
 
+    std::string SipiIcc::profileChecksum() const {
+        if (icc_profile == nullptr) return std::string();
+        cmsUInt32Number len = 0;
+        if (!cmsSaveProfileToMem(icc_profile, nullptr, &len)) throw SipiError(__file__, __LINE__, "cmsSaveProfileToMem failed");
+        auto buf = shttps::make_unique<char[]>(len);
+        if (!cmsSaveProfileToMem(icc_profile, buf.get(), &len)) throw SipiError(__file__, __LINE__, "cmsSaveProfileToMem failed");
+        shttps::Hash hash(shttps::HashType::md5);
+        hash.add_data(buf.get(), len);
+        return hash.hash();
+    }
+
     std::ostream &operator<< (std::ostream &outstr, SipiIcc &rhs) {
         unsigned int len = cmsGetProfileInfoASCII(rhs.icc_profile, cmsInfoDescription, cmsNoLanguage, cmsNoCountry, nullptr, 0);
         auto buf = shttps::make_unique<char[]>(len);
@@ -480,4 +505,65 @@ namespace Sipi {
         return outstr;
     }
 
+    SipiIccTransformCache::SipiIccTransformCache() : access_counter(0) {
+        context = cmsCreateContext(nullptr, nullptr);
+        cmsSetLogErrorHandlerTHR(context, icc_error_logger);
+    }
+
+    SipiIccTransformCache &SipiIccTransformCache::instance() {
+        static SipiIccTransformCache cache; // thread safe initialization (C++11)
+        return cache;
+    }
+
+    SipiIccTransformCache::Transform SipiIccTransformCache::get(const SipiIcc &src_icc, cmsUInt32Number in_formatter,
+                                                                 const SipiIcc &dst_icc, cmsUInt32Number out_formatter,
+                                                                 cmsUInt32Number intent) {
+        std::string key = src_icc.iccHash() + ":" + dst_icc.iccHash() + ":" + std::to_string(in_formatter) + ":" +
+                          std::to_string(out_formatter) + ":" + std::to_string(intent);
+
+        std::lock_guard<std::mutex> lock(locking);
+
+        auto entry = transforms.find(key);
+        if (entry != transforms.end()) {
+            entry->second.last_access = ++access_counter;
+            return entry->second.transform;
+        }
+
+        //
+        // the transform keeps its own copy of everything it needs from the profiles, so the profiles
+        // may be deleted afterwards
+        //
+        cmsHTRANSFORM htransform = cmsCreateTransformTHR(context, src_icc.getIccProfile(), in_formatter,
+                                                         dst_icc.getIccProfile(), out_formatter, intent,
+                                                         cmsFLAGS_NOCACHE);
+        if (htransform == nullptr) {
+            throw SipiError(__file__, __LINE__, "Couldn't create color transform");
+        }
+        Transform transform(htransform, cmsDeleteTransform);
+
+        if (transforms.size() >= max_entries) { // remove the least recently used transform
+            auto oldest = transforms.begin();
+            for (auto it = transforms.begin(); it != transforms.end(); ++it) {
+                if (it->second.last_access < oldest->second.last_access) oldest = it;
+            }
+            transforms.erase(oldest);
+        }
+
+        CacheEntry new_entry;
+        new_entry.transform = transform;
+        new_entry.last_access = ++access_counter;
+        transforms[key] = new_entry;
+        return transform;
+    }
+
+    void SipiIccTransformCache::clear() {
+        std::lock_guard<std::mutex> lock(locking);
+        transforms.clear();
+    }
+
+    size_t SipiIccTransformCache::size() {
+        std::lock_guard<std::mutex> lock(locking);
+        return transforms.size();
+    }
+
 }
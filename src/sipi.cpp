@@ -59,6 +59,12 @@
 #include "shttps/Parsing.h"
 #include "SipiConf.h"
 #include "SipiIO.h"
+#include "formats/SipiIOJ2k.h"
+#include "formats/SipiIOJpeg.h"
+#include "formats/SipiIOPng.h"
+#ifdef SIPI_OPENJPEG
+#include "formats/SipiIOOpenJ2k.h"
+#endif
 
 
 // A macro for silencing incorrect compiler warnings about unused variables.
@@ -148,6 +154,14 @@ static void sipiConfGlobals(lua_State *L, shttps::Connection &conn, void *user_d
   lua_pushinteger(L, conf->getJpegQuality());
   lua_rawset(L, -3); // table1
 
+  lua_pushstring(L, "webp_quality"); // table1 - "index_L1"
+  lua_pushinteger(L, conf->getWebpQuality());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "webp_lossless"); // table1 - "index_L1"
+  lua_pushboolean(L, conf->getWebpLossless());
+  lua_rawset(L, -3); // table1
+
   lua_pushstring(L, "keep_alive"); // table1 - "index_L1"
   lua_pushinteger(L, conf->getKeepAlive());
   lua_rawset(L, -3); // table1
@@ -164,6 +178,30 @@ static void sipiConfGlobals(lua_State *L, shttps::Connection &conn, void *user_d
   lua_pushinteger(L, conf->getNThreads());
   lua_rawset(L, -3); // table1
 
+  lua_pushstring(L, "kakadu_threads"); // table1 - "index_L1"
+  lua_pushinteger(L, conf->getKakaduThreads());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "j2k_decoder"); // table1 - "index_L1"
+  lua_pushstring(L, conf->getJ2kDecoder().c_str());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "j2k_layers"); // table1 - "index_L1"
+  lua_pushstring(L, conf->getJ2kLayers().c_str());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "embedded_thumbnails"); // table1 - "index_L1"
+  lua_pushboolean(L, conf->getEmbeddedThumbnails());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "jpeg_profiles"); // table1 - "index_L1"
+  lua_pushstring(L, conf->getJpegProfiles().c_str());
+  lua_rawset(L, -3); // table1
+
+  lua_pushstring(L, "png_profiles"); // table1 - "index_L1"
+  lua_pushstring(L, conf->getPngProfiles().c_str());
+  lua_rawset(L, -3); // table1
+
   lua_pushstring(L, "max_post_size"); // table1 - "index_L1"
   lua_pushinteger(L, conf->getMaxPostSize());
   lua_rawset(L, -3); // table1
@@ -394,7 +432,7 @@ int main(int argc, char *argv[]) {
   std::string optOutFile;
   sipiopt.add_option("-z,--outf,outfile", optOutFile, "Output file to be converted.");
 
-  enum class OptFormat : int { jpx, jpg, tif, png, pdf };
+  enum class OptFormat : int { jpx, jpg, tif, png, pdf, webp };
   OptFormat optFormat = OptFormat::jpx;
   std::vector<std::pair<std::string, OptFormat>> optFormatMap{
       {"jpx", OptFormat::jpx},
@@ -402,7 +440,8 @@ int main(int argc, char *argv[]) {
       {"jpg", OptFormat::jpg},
       {"tif", OptFormat::tif},
       {"png", OptFormat::png},
-      {"pdf", OptFormat::pdf}
+      {"pdf", OptFormat::pdf},
+      {"webp", OptFormat::webp}
   };
   sipiopt.add_option("-F,--format", optFormat, "Output format.")
       ->transform(CLI::CheckedTransformer(optFormatMap, CLI::ignore_case));
@@ -422,6 +461,13 @@ int main(int argc, char *argv[]) {
   sipiopt.add_option("-q,--quality", optJpegQuality, "Quality (compression).")
       ->check(CLI::Range(1, 100))->envname("SIPI_JPEGQUALITY");
 
+  std::string optJpegProfile;
+  sipiopt.add_option("--jpeg_profile",
+                     optJpegProfile,
+                     "JPEG: Encoding profile. \"tile\" is baseline without ICC/XMP/EXIF/IPTC payloads for sRGB images "
+                     "[Default: progressive].")
+      ->check(CLI::IsMember({"baseline", "optimized", "progressive", "tile"}));
+
   //
   // Parameters for JPEG2000 compression (see kakadu kdu_compress for details!)
   //
@@ -469,6 +515,85 @@ int main(int argc, char *argv[]) {
                      j2k_Cuse_sop,
                      "J2K Cuse_sop: Include SOP markers (i.e., resync markers) [Default: yes].");
 
+  std::string j2k_Cmodes;
+  sipiopt.add_option("--Cmodes",
+                     j2k_Cmodes,
+                     "J2K Cmodes: Block coder modes, e.g. \"HT\" for the High-Throughput block coder (HTJ2K), or "
+                     "\"BYPASS|RESTART\" (see kdu_compress help!) [Default: none].");
+
+  bool j2k_ORGgen_plt;
+  sipiopt.add_option("--ORGgen_plt",
+                     j2k_ORGgen_plt,
+                     "J2K ORGgen_plt: Include packet length (PLT) markers for faster random access [Default: no].");
+
+  int j2k_ORGgen_tlm;
+  sipiopt.add_option("--ORGgen_tlm",
+                     j2k_ORGgen_tlm,
+                     "J2K ORGgen_tlm: Include tile-part length (TLM) markers. The value is the maximum number of "
+                     "tile-parts per tile [Default: 0, no TLM markers].");
+
+  std::string j2k_ORGtparts;
+  sipiopt.add_option("--ORGtparts",
+                     j2k_ORGtparts,
+                     "J2K ORGtparts: Tile-part boundaries, \"R\" (resolutions), \"L\" (layers) or \"C\" (components) "
+                     "[Default: one tile-part per tile].");
+
+  std::string j2k_preset;
+  sipiopt.add_option("--j2k_preset",
+                     j2k_preset,
+                     "J2K: Preset for the options above. \"deepzoom\" writes 256x256 precincts, RPCL order "
+                     "and PLT/TLM markers for fast IIIF tile access. Options given explicitly take precedence.")
+      ->check(CLI::IsMember({"deepzoom"}));
+
+  std::string tiff_compression;
+  sipiopt.add_option("--tiff_compression",
+                     tiff_compression,
+                     "TIFF: Compression of the image data [Default: none].")
+      ->check(CLI::IsMember({"none", "deflate", "lzw", "zstd", "jpeg"}, CLI::ignore_case));
+
+  std::string tiff_predictor;
+  sipiopt.add_option("--tiff_predictor",
+                     tiff_predictor,
+                     "TIFF: Predictor used with deflate, lzw and zstd compression [Default: horizontal].")
+      ->check(CLI::IsMember({"none", "horizontal"}));
+
+  int tiff_tile;
+  sipiopt.add_option("--tiff_tile", tiff_tile, "TIFF: Write square tiles of the given size (must be a multiple of 16) "
+                                               "instead of strips [Default: 256 for pyramids, no tiles otherwise].");
+
+  bool tiff_pyramid = false;
+  sipiopt.add_flag("--tiff_pyramid", tiff_pyramid, "TIFF: Add reduced resolutions as SubIFDs (implies tiles).");
+
+  //
+  // Parameters for PNG compression
+  //
+  std::string png_filter;
+  sipiopt.add_option("--png_filter",
+                     png_filter,
+                     "PNG: Row filter, \"adaptive\" chooses the best filter for each row [Default: adaptive].")
+      ->check(CLI::IsMember({"none", "sub", "up", "average", "paeth", "adaptive"}));
+
+  int png_level;
+  sipiopt.add_option("--png_level", png_level, "PNG: zlib compression level [Default: 6].")
+      ->check(CLI::Range(0, 9));
+
+  std::string png_parallel;
+  sipiopt.add_option("--png_parallel",
+                     png_parallel,
+                     "PNG: Deflate bands of rows in parallel (slightly larger files) [Default: yes].")
+      ->check(CLI::IsMember({"yes", "no"}));
+
+  //
+  // Parameters for WebP compression (also used by the server)
+  //
+  int optWebpQuality = 80;
+  sipiopt.add_option("--webp_quality", optWebpQuality, "WebP: Quality of lossy compression [Default: 80].")
+      ->check(CLI::Range(0, 100))->envname("SIPI_WEBPQUALITY");
+
+  bool optWebpLossless = false;
+  sipiopt.add_flag("--webp_lossless", optWebpLossless, "WebP: Use lossless compression.")->envname(
+      "SIPI_WEBPLOSSLESS");
+
   //
   // used for rendering only one page of multipage PDF or TIFF (NYI for tif...)
   //
@@ -543,6 +668,42 @@ int main(int argc, char *argv[]) {
   int optNThreads = std::thread::hardware_concurrency();
   sipiopt.add_option("-t,--nthreads", optNThreads, "Number of threads for SIPI server")->envname("SIPI_NTHREADS");
 
+  int optKakaduThreads = 4;
+  sipiopt.add_option("--kakadu_threads",
+                     optKakaduThreads,
+                     "Number of Kakadu threads used for one JPEG2000 image (0 = number of cores).")->envname(
+      "SIPI_KAKADU_THREADS");
+
+  std::string optJ2kDecoder = "kakadu";
+  sipiopt.add_option("--j2k_decoder",
+                     optJ2kDecoder,
+                     "Library used to decode JPEG2000 images (openjpeg only if built with SIPI_OPENJPEG).")->envname(
+      "SIPI_J2K_DECODER")->check(CLI::IsMember({"kakadu", "openjpeg"}));
+
+  std::string optJ2kLayers;
+  sipiopt.add_option("--j2k_layers",
+                     optJ2kLayers,
+                     "Percentage of JPEG2000 quality layers decoded for small images, e.g. '256:25,1024:50'.")->envname(
+      "SIPI_J2K_LAYERS");
+
+  bool optEmbeddedThumbnails = false;
+  sipiopt.add_flag("--embedded_thumbnails",
+                   optEmbeddedThumbnails,
+                   "Scale small images from the EXIF thumbnail embedded in JPEG files if it is large enough.")->envname(
+      "SIPI_EMBEDDED_THUMBNAILS");
+
+  std::string optJpegProfiles;
+  sipiopt.add_option("--jpeg_profiles",
+                     optJpegProfiles,
+                     "JPEG encoding profile by the size of the output image, e.g. '512:tile,2048:optimized'.")->envname(
+      "SIPI_JPEG_PROFILES");
+
+  std::string optPngProfiles;
+  sipiopt.add_option("--png_profiles",
+                     optPngProfiles,
+                     "PNG encoding preset by the size of the output image, e.g. '512:fast,4096:balanced'.")->envname(
+      "SIPI_PNG_PROFILES");
+
   std::string optMaxPostSize = "300M";
   sipiopt.add_option("--maxpost",
                      optMaxPostSize,
@@ -730,6 +891,8 @@ int main(int argc, char *argv[]) {
           break;
         case OptFormat::pdf: format = "png";
           break;
+        case OptFormat::webp: format = "webp";
+          break;
       }
     } else {
       //
@@ -749,6 +912,8 @@ int main(int argc, char *argv[]) {
           format = "png";
         } else if (ext == "pdf") {
           format = "pdf";
+        } else if (ext == "webp") {
+          format = "webp";
         } else {
           std::cerr << "Not a supported filename extension: '" << ext << "' !" << std::endl;
           return EXIT_FAILURE;
@@ -865,6 +1030,7 @@ int main(int argc, char *argv[]) {
     //int quality = 80
     Sipi::SipiCompressionParams comp_params;
     if (!sipiopt.get_option("--quality")->empty()) comp_params[Sipi::JPEG_QUALITY] = optJpegQuality;
+    if (!sipiopt.get_option("--jpeg_profile")->empty()) comp_params[Sipi::JPEG_profile] = optJpegProfile;
     if (!sipiopt.get_option("--Sprofile")->empty()) comp_params[Sipi::J2K_Sprofile] = j2k_Sprofile;
     if (!sipiopt.get_option("--Clayers")->empty()) comp_params[Sipi::J2K_Clayers] = std::to_string(j2k_Clayers);
     if (!sipiopt.get_option("--Clevels")->empty()) comp_params[Sipi::J2K_Clevels] = std::to_string(j2k_Clevels);
@@ -873,6 +1039,20 @@ int main(int argc, char *argv[]) {
     if (!sipiopt.get_option("--Cblk")->empty()) comp_params[Sipi::J2K_Cblk] = j2k_Cblk;
     if (!sipiopt.get_option("--Cuse_sop")->empty()) comp_params[Sipi::J2K_Cuse_sop] = j2k_Cuse_sop ? "yes" : "no";
     if (!sipiopt.get_option("--Stiles")->empty()) comp_params[Sipi::J2K_Stiles] = j2k_Stiles;
+    if (!sipiopt.get_option("--Cmodes")->empty()) comp_params[Sipi::J2K_Cmodes] = j2k_Cmodes;
+    if (!sipiopt.get_option("--ORGgen_plt")->empty()) comp_params[Sipi::J2K_ORGgen_plt] = j2k_ORGgen_plt ? "yes" : "no";
+    if (!sipiopt.get_option("--ORGgen_tlm")->empty()) comp_params[Sipi::J2K_ORGgen_tlm] = std::to_string(j2k_ORGgen_tlm);
+    if (!sipiopt.get_option("--ORGtparts")->empty()) comp_params[Sipi::J2K_ORGtparts] = j2k_ORGtparts;
+    if (!sipiopt.get_option("--j2k_preset")->empty()) comp_params[Sipi::J2K_preset] = j2k_preset;
+    if (!sipiopt.get_option("--tiff_compression")->empty()) comp_params[Sipi::TIFF_compression] = tiff_compression;
+    if (!sipiopt.get_option("--tiff_predictor")->empty()) comp_params[Sipi::TIFF_predictor] = tiff_predictor;
+    if (!sipiopt.get_option("--tiff_tile")->empty()) comp_params[Sipi::TIFF_tile] = std::to_string(tiff_tile);
+    if (tiff_pyramid) comp_params[Sipi::TIFF_pyramid] = "yes";
+    if (!sipiopt.get_option("--png_filter")->empty()) comp_params[Sipi::PNG_filter] = png_filter;
+    if (!sipiopt.get_option("--png_level")->empty()) comp_params[Sipi::PNG_level] = std::to_string(png_level);
+    if (!sipiopt.get_option("--png_parallel")->empty()) comp_params[Sipi::PNG_parallel] = png_parallel;
+    if (!sipiopt.get_option("--webp_quality")->empty()) comp_params[Sipi::WEBP_quality] = std::to_string(optWebpQuality);
+    if (!sipiopt.get_option("--webp_lossless")->empty()) comp_params[Sipi::WEBP_lossless] = optWebpLossless ? "yes" : "no";
     if (!sipiopt.get_option("--rates")->empty()) {
       std::stringstream ss;
       for (auto &rate: j2k_rates) {
@@ -952,6 +1132,56 @@ int main(int argc, char *argv[]) {
         if (!sipiopt.get_option("--nthreads")->empty()) sipiConf.setNThreads(optNThreads);
       }
 
+      if (!config_loaded) {
+        sipiConf.setKakaduThreads(optKakaduThreads);
+      } else {
+        if (!sipiopt.get_option("--kakadu_threads")->empty()) sipiConf.setKakaduThreads(optKakaduThreads);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setJ2kDecoder(optJ2kDecoder);
+      } else {
+        if (!sipiopt.get_option("--j2k_decoder")->empty()) sipiConf.setJ2kDecoder(optJ2kDecoder);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setJ2kLayers(optJ2kLayers);
+      } else {
+        if (!sipiopt.get_option("--j2k_layers")->empty()) sipiConf.setJ2kLayers(optJ2kLayers);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setEmbeddedThumbnails(optEmbeddedThumbnails);
+      } else {
+        if (!sipiopt.get_option("--embedded_thumbnails")->empty()) {
+          sipiConf.setEmbeddedThumbnails(optEmbeddedThumbnails);
+        }
+      }
+
+      if (!config_loaded) {
+        sipiConf.setJpegProfiles(optJpegProfiles);
+      } else {
+        if (!sipiopt.get_option("--jpeg_profiles")->empty()) sipiConf.setJpegProfiles(optJpegProfiles);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setPngProfiles(optPngProfiles);
+      } else {
+        if (!sipiopt.get_option("--png_profiles")->empty()) sipiConf.setPngProfiles(optPngProfiles);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setWebpQuality(optWebpQuality);
+      } else {
+        if (!sipiopt.get_option("--webp_quality")->empty()) sipiConf.setWebpQuality(optWebpQuality);
+      }
+
+      if (!config_loaded) {
+        sipiConf.setWebpLossless(optWebpLossless);
+      } else {
+        if (!sipiopt.get_option("--webp_lossless")->empty()) sipiConf.setWebpLossless(optWebpLossless);
+      }
+
       size_t l = optMaxPostSize.length();
       char c = optMaxPostSize[l - 1];
       tsize_t maxpost_size;
@@ -1230,6 +1460,32 @@ int main(int argc, char *argv[]) {
       server.dirs_to_exclude(sipiConf.getSubdirExcludes());
       server.scaling_quality(sipiConf.getScalingQuality());
       server.jpeg_quality(sipiConf.getJpegQuality());
+      server.webp_quality(sipiConf.getWebpQuality());
+      server.webp_lossless(sipiConf.getWebpLossless());
+      Sipi::SipiIOJ2k::setThreadBudget(sipiConf.getKakaduThreads());
+      Sipi::SipiIOJpeg::setEmbeddedThumbnails(sipiConf.getEmbeddedThumbnails());
+      if (sipiConf.getJ2kDecoder() == "openjpeg") {
+#ifdef SIPI_OPENJPEG
+        Sipi::SipiIOOpenJ2k::setThreadBudget(sipiConf.getKakaduThreads());
+        Sipi::SipiImage::setIO("jpx", std::make_shared<Sipi::SipiIOOpenJ2k>());
+#else
+        std::cerr << "j2k_decoder \"openjpeg\" is not available: SIPI has been built without SIPI_OPENJPEG"
+                  << std::endl;
+        return EXIT_FAILURE;
+#endif
+      } else if (sipiConf.getJ2kDecoder() != "kakadu") {
+        std::cerr << "Invalid j2k_decoder \"" << sipiConf.getJ2kDecoder() << "\", must be kakadu or openjpeg"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+      try {
+        Sipi::SipiIOJ2k::setLayerPolicy(sipiConf.getJ2kLayers());
+        Sipi::SipiIOJpeg::setProfilePolicy(sipiConf.getJpegProfiles());
+        Sipi::SipiIOPng::setPresetPolicy(sipiConf.getPngProfiles());
+      } catch (Sipi::SipiImageError &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+      }
 
       //
       // cache parameter...
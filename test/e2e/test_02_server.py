@@ -293,8 +293,8 @@ class TestServer:
                 {'width': 256, 'height': 256},
                 {'width': 128, 'height': 128}
             ],
-            'tiles': [{'width': 512, 'height': 512, 'scaleFactors': [1, 2, 3, 4]}],
-            'extraFormats': ['tif', 'pdf', 'jp2'],
+            'tiles': [{'width': 256, 'height': 256, 'scaleFactors': [1, 2, 3, 4]}],
+            'extraFormats': ['tif', 'pdf', 'jp2', 'webp'],
             'preferredFormats': ['jpg', 'tif', 'jp2', 'png'],
             'extraFeatures': [
                 'baseUriRedirect',
@@ -443,11 +443,11 @@ class TestServer:
                 {'width': 128, 'height': 128}
             ],
             'tiles': [{
-                'width': 512,
-                'height': 512,
+                'width': 256,
+                'height': 256,
                 'scaleFactors': [1, 2, 3, 4, 5, 6, 7]
             }],
-            'extraFormats': ['tif', 'pdf', 'jp2'],
+            'extraFormats': ['tif', 'pdf', 'jp2', 'webp'],
             'preferredFormats': ['jpg', 'tif', 'jp2', 'png'],
             'extraFeatures': [
                 'baseUriRedirect',
@@ -478,7 +478,8 @@ class TestServer:
         manager.compare_server_bytes("/unit/CV+Pub_LukasRosenthaler.pdf/file", manager.data_dir_path("unit/CV+Pub_LukasRosenthaler.pdf"))
 
     def test_pdf_page_server(self, manager):
-        """Test serving a PDF page as TIFF"""
+        """Test serving a PDF page as JPEG"""
+        # reference: sipi --file CV+Pub_LukasRosenthaler.pdf --pagenum 3 --size pct:25 --quality 80 --format jpg
         manager.compare_server_images("/unit/CV+Pub_LukasRosenthaler.pdf@3/full/pct:25/0/default.jpg", manager.data_dir_path("unit/CV+Pub_LukasRosenthaler_p3.jpg"))
 
     def test_upscaling_server(self, manager):
@@ -0,0 +1,412 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "../../../include/SipiImage.h"
+#include "../../../include/SipiIO.h"
+#include "../../../include/SipiImageKernels.h"
+#include "../../../include/formats/SipiHeaderReader.h"
+#include "../../../include/formats/SipiIOTiff.h"
+#include "scoped_restore.h"
+#ifdef SIPI_OPENJPEG
+#include "../../../include/formats/SipiIOOpenJ2k.h"
+#endif
+
+//
+// Simple benchmarks comparing the optimized implementations with the straight forward ones they replace.
+// They check that both produce the same result and print the timings. They are not part of the unit tests,
+// but built as a separate target with "make sipiimage_benchmark" and run from test/unit/sipiimage in the build
+// directory.
+//
+
+template<typename Func>
+inline double time_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+inline void print_timing(const std::string &name, double reference_ms, double optimized_ms) {
+    std::cout << "[ BENCH    ] " << name << ": reference " << reference_ms << " ms, optimized " << optimized_ms
+              << " ms, speedup " << reference_ms / optimized_ms << std::endl;
+}
+
+inline std::vector<unsigned char> random_pixels(size_t n) {
+    std::vector<unsigned char> buf(n);
+    srand(4711);
+    for (auto &v : buf) v = (unsigned char) (rand() & 0xff);
+    return buf;
+}
+
+const size_t bench_nx = 4000;
+const size_t bench_ny = 3000;
+
+// YCbCr to RGB: floating point loop (as used before) against the fixed point kernel with strips
+TEST(SipiimageBenchmark, YCC2RGB)
+{
+    const size_t nc = 3;
+    std::vector<unsigned char> inbuf = random_pixels(bench_nx * bench_ny * nc);
+    std::vector<unsigned char> refbuf(inbuf.size());
+    std::vector<unsigned char> outbuf(inbuf.size());
+
+    double reference_ms = time_ms([&]() {
+        for (size_t i = 0; i < bench_nx * bench_ny; i++) {
+            double Y = (double) inbuf[nc * i + 2];
+            double Cb = (double) inbuf[nc * i + 1];
+            double Cr = (double) inbuf[nc * i + 0];
+            int r = (int) (Y + 1.40200 * (Cr - 0x80));
+            int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
+            int b = (int) (Y + 1.77200 * (Cb - 0x80));
+            refbuf[nc * i + 0] = std::max(0, std::min(255, r));
+            refbuf[nc * i + 1] = std::max(0, std::min(255, g));
+            refbuf[nc * i + 2] = std::max(0, std::min(255, b));
+        }
+    });
+
+    double optimized_ms = time_ms([&]() {
+        const unsigned char *in = inbuf.data();
+        unsigned char *out = outbuf.data();
+        Sipi::parallel_strips(bench_ny, bench_nx, [=](size_t first, size_t end) {
+            Sipi::dispatch_kernel<Sipi::YCC2RGBKernel>(8, nc, in + first * bench_nx * nc,
+                                                       out + first * bench_nx * nc, (end - first) * bench_nx);
+        });
+    });
+    print_timing("YCbCr to RGB", reference_ms, optimized_ms);
+
+    // the fixed point kernel rounds, the reference truncates
+    int maxdiff = 0;
+    for (size_t i = 0; i < inbuf.size(); i++) {
+        maxdiff = std::max(maxdiff, std::abs((int) refbuf[i] - (int) outbuf[i]));
+    }
+    EXPECT_LE(maxdiff, 1);
+}
+
+// CMYK to sRGB: new transform for each conversion on one thread against the cached transform with strips
+TEST(SipiimageBenchmark, ConvertToIcc)
+{
+    Sipi::SipiIcc cmyk_icc(Sipi::icc_CYMK_standard);
+    Sipi::SipiIcc srgb_icc(Sipi::icc_sRGB);
+    cmsUInt32Number in_formatter = cmyk_icc.iccFormatter(8);
+    cmsUInt32Number out_formatter = srgb_icc.iccFormatter(8);
+
+    std::vector<unsigned char> inbuf = random_pixels(bench_nx * bench_ny * 4);
+    std::vector<unsigned char> refbuf(bench_nx * bench_ny * 3);
+    std::vector<unsigned char> outbuf(bench_nx * bench_ny * 3);
+
+    double reference_ms = time_ms([&]() {
+        cmsHTRANSFORM htransform = cmsCreateTransform(cmyk_icc.getIccProfile(), in_formatter,
+                                                      srgb_icc.getIccProfile(), out_formatter, INTENT_PERCEPTUAL, 0);
+        cmsDoTransform(htransform, inbuf.data(), refbuf.data(), bench_nx * bench_ny);
+        cmsDeleteTransform(htransform);
+    });
+
+    double optimized_ms = time_ms([&]() {
+        Sipi::SipiIccTransformCache::Transform transform =
+                Sipi::SipiIccTransformCache::instance().get(cmyk_icc, in_formatter, srgb_icc, out_formatter);
+        const unsigned char *in = inbuf.data();
+        unsigned char *out = outbuf.data();
+        Sipi::parallel_strips(bench_ny, bench_nx, [=](size_t first, size_t end) {
+            cmsDoTransform(transform.get(), in + first * bench_nx * 4, out + first * bench_nx * 3,
+                           (cmsUInt32Number) ((end - first) * bench_nx));
+        });
+    });
+    print_timing("CMYK to sRGB", reference_ms, optimized_ms);
+
+    EXPECT_TRUE(refbuf == outbuf);
+}
+
+// Rotation by 90 degrees: pixel by pixel against the cache blocked kernel
+TEST(SipiimageBenchmark, Rotate90)
+{
+    const size_t nc = 3;
+    std::vector<unsigned char> inbuf = random_pixels(bench_nx * bench_ny * nc);
+    std::vector<unsigned char> refbuf(inbuf.size());
+    std::vector<unsigned char> outbuf(inbuf.size());
+
+    double reference_ms = time_ms([&]() {
+        for (size_t j = 0; j < bench_nx; j++) {
+            for (size_t i = 0; i < bench_ny; i++) {
+                for (size_t k = 0; k < nc; k++) {
+                    refbuf[nc * (j * bench_ny + i) + k] = inbuf[nc * ((bench_ny - i - 1) * bench_nx + j) + k];
+                }
+            }
+        }
+    });
+
+    double optimized_ms = time_ms([&]() {
+        const unsigned char *in = inbuf.data();
+        unsigned char *out = outbuf.data();
+        Sipi::parallel_strips(bench_nx, bench_ny, [=](size_t first, size_t end) {
+            Sipi::dispatch_kernel<Sipi::Rotate90Kernel>(8, nc, in, out, bench_nx, bench_ny, first, end);
+        });
+    });
+    print_timing("Rotate 90", reference_ms, optimized_ms);
+
+    EXPECT_TRUE(refbuf == outbuf);
+}
+
+// JPEG2000 tile latency: 256x256 regions from a classic file against the same image encoded with the HT block coder.
+// A larger test image can be given with the environment variable SIPI_BENCH_IMAGE.
+TEST(SipiimageBenchmark, HTJ2KTiles)
+{
+    const char *bench_image = std::getenv("SIPI_BENCH_IMAGE");
+    std::string srcpath = (bench_image != nullptr) ? bench_image : "../../../../test/_test_data/images/unit/lena512_upscaled.tif";
+    std::string classic_path = "../../../../test/_test_data/images/unit/_bench_classic.jp2";
+    std::string ht_path = "../../../../test/_test_data/images/unit/_bench_ht.jp2";
+    const size_t tile = 256;
+
+    Sipi::SipiImage src;
+    ASSERT_NO_THROW(src.read(srcpath));
+    Sipi::SipiCompressionParams classic_params = {{Sipi::J2K_Creversible, "yes"}, {Sipi::J2K_Stiles, "{1024,1024}"}};
+    Sipi::SipiCompressionParams ht_params = {{Sipi::J2K_Creversible, "yes"}, {Sipi::J2K_Stiles, "{1024,1024}"},
+                                             {Sipi::J2K_Cmodes, "HT"}};
+    ASSERT_NO_THROW(src.write("jpx", classic_path, &classic_params));
+    ASSERT_NO_THROW(src.write("jpx", ht_path, &ht_params));
+
+    auto read_tiles = [&](const std::string &path) {
+        for (size_t y = 0; y < src.getNy(); y += tile) {
+            for (size_t x = 0; x < src.getNx(); x += tile) {
+                Sipi::SipiImage img;
+                img.read(path, 0, std::make_shared<Sipi::SipiRegion>((int) x, (int) y, tile, tile));
+            }
+        }
+    };
+    read_tiles(classic_path); // warm up the file cache
+    read_tiles(ht_path);
+
+    double classic_ms = time_ms([&]() { read_tiles(classic_path); });
+    double ht_ms = time_ms([&]() { read_tiles(ht_path); });
+    print_timing("HTJ2K tiles", classic_ms, ht_ms);
+
+    // both encodings are lossless
+    Sipi::SipiImage classic_img;
+    Sipi::SipiImage ht_img;
+    ASSERT_NO_THROW(classic_img.read(classic_path));
+    ASSERT_NO_THROW(ht_img.read(ht_path));
+    EXPECT_TRUE(classic_img == ht_img);
+}
+
+// JPEG2000 random tile access: deepzoom preset without against with PLT and TLM markers.
+// A larger test image can be given with the environment variable SIPI_BENCH_IMAGE.
+TEST(SipiimageBenchmark, J2kTileMarkers)
+{
+    const char *bench_image = std::getenv("SIPI_BENCH_IMAGE");
+    std::string srcpath = (bench_image != nullptr) ? bench_image : "../../../../test/_test_data/images/unit/lena512_upscaled.tif";
+    std::string plain_path = "../../../../test/_test_data/images/unit/_bench_nomarkers.jp2";
+    std::string markers_path = "../../../../test/_test_data/images/unit/_bench_markers.jp2";
+    const size_t tile = 256;
+    const int ntiles = 200;
+
+    Sipi::SipiImage src;
+    ASSERT_NO_THROW(src.read(srcpath));
+    Sipi::SipiCompressionParams plain_params = {{Sipi::J2K_preset, "deepzoom"}, {Sipi::J2K_ORGgen_plt, "no"},
+                                                {Sipi::J2K_ORGgen_tlm, "0"}};
+    Sipi::SipiCompressionParams markers_params = {{Sipi::J2K_preset, "deepzoom"}};
+    ASSERT_NO_THROW(src.write("jpx", plain_path, &plain_params));
+    ASSERT_NO_THROW(src.write("jpx", markers_path, &markers_params));
+
+    const size_t tx = (src.getNx() + tile - 1) / tile;
+    const size_t ty = (src.getNy() + tile - 1) / tile;
+    auto read_tiles = [&](const std::string &path) {
+        srand(4711);
+        for (int i = 0; i < ntiles; i++) {
+            size_t x = (rand() % tx) * tile;
+            size_t y = (rand() % ty) * tile;
+            Sipi::SipiImage img;
+            img.read(path, 0, std::make_shared<Sipi::SipiRegion>((int) x, (int) y, tile, tile));
+        }
+    };
+
+    double plain_ms = time_ms([&]() { read_tiles(plain_path); });
+    double markers_ms = time_ms([&]() { read_tiles(markers_path); });
+    print_timing("J2K tiles with PLT/TLM markers", plain_ms, markers_ms);
+
+    Sipi::SipiImage plain_img;
+    Sipi::SipiImage markers_img;
+    ASSERT_NO_THROW(plain_img.read(plain_path));
+    ASSERT_NO_THROW(markers_img.read(markers_path));
+    EXPECT_TRUE(plain_img == markers_img);
+}
+
+// PNG encoding: no filter and level 9 on one thread (as used before) against the "balanced" preset
+// (adaptive filters, level 6) with bands of rows deflated in parallel.
+// A larger test image can be given with the environment variable SIPI_BENCH_IMAGE.
+TEST(SipiimageBenchmark, PngEncode)
+{
+    const char *bench_image = std::getenv("SIPI_BENCH_IMAGE");
+    std::string srcpath = (bench_image != nullptr) ? bench_image : "../../../../test/_test_data/images/unit/lena512_upscaled.tif";
+    std::string reference_path = "../../../../test/_test_data/images/unit/_bench_reference.png";
+    std::string balanced_path = "../../../../test/_test_data/images/unit/_bench_balanced.png";
+
+    Sipi::SipiImage src;
+    ASSERT_NO_THROW(src.read(srcpath));
+    Sipi::SipiCompressionParams reference_params = {{Sipi::PNG_filter, "none"}, {Sipi::PNG_level, "9"},
+                                                    {Sipi::PNG_parallel, "no"}};
+    Sipi::SipiCompressionParams balanced_params = {{Sipi::PNG_filter, "adaptive"}, {Sipi::PNG_level, "6"},
+                                                   {Sipi::PNG_parallel, "yes"}};
+
+    double reference_ms = time_ms([&]() { src.write("png", reference_path, &reference_params); });
+    double balanced_ms = time_ms([&]() { src.write("png", balanced_path, &balanced_params); });
+    print_timing("PNG encoding", reference_ms, balanced_ms);
+
+    Sipi::SipiImage reference_img;
+    Sipi::SipiImage balanced_img;
+    ASSERT_NO_THROW(reference_img.read(reference_path));
+    ASSERT_NO_THROW(balanced_img.read(balanced_path));
+    auto file_size = [](const std::string &path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return (long long) file.tellg();
+    };
+    std::cout << "[ BENCH    ] PNG size: reference " << file_size(reference_path) << " bytes, optimized "
+              << file_size(balanced_path) << " bytes" << std::endl;
+    EXPECT_TRUE(reference_img == balanced_img);
+}
+
+// TIFF tile access: 256x256 regions read through TIFFOpen against pread with read ahead (posix_fadvise) of the
+// tiles of the region. A tiled TIFF file can be given with the environment variable SIPI_BENCH_TIFF; running
+// the benchmark with a copy of the same file on a network file system and on a local disk compares both.
+TEST(SipiimageBenchmark, TiffAdvisedTiles)
+{
+    const char *bench_tiff = std::getenv("SIPI_BENCH_TIFF");
+    std::string path = "../../../../test/_test_data/images/unit/_bench_tiled.tif";
+    if (bench_tiff != nullptr) {
+        path = bench_tiff;
+    } else {
+        Sipi::SipiImage src;
+        ASSERT_NO_THROW(src.read("../../../../test/_test_data/images/unit/lena512_upscaled.tif"));
+        Sipi::SipiCompressionParams params = {{Sipi::TIFF_tile, "256"}, {Sipi::TIFF_compression, "deflate"}};
+        ASSERT_NO_THROW(src.write("tif", path, &params));
+    }
+    const size_t tile = 256;
+
+    Sipi::SipiImage img;
+    Sipi::SipiImgInfo info = img.getDim(path);
+    ASSERT_NE(info.success, Sipi::SipiImgInfo::FAILURE);
+    auto read_tiles = [&](Sipi::SipiImage &last) {
+        for (size_t y = 0; y < (size_t) info.height; y += tile) {
+            for (size_t x = 0; x < (size_t) info.width; x += tile) {
+                Sipi::SipiImage tileimg;
+                tileimg.read(path, 0, std::make_shared<Sipi::SipiRegion>((int) x, (int) y, tile, tile));
+                if ((x + tile >= (size_t) info.width) && (y + tile >= (size_t) info.height)) last = tileimg;
+            }
+        }
+    };
+
+    Sipi::SipiImage plain_img;
+    Sipi::SipiImage advised_img;
+    read_tiles(plain_img); // warm up the file cache
+    double plain_ms;
+    {
+        ScopedRestore restore([]() { Sipi::SipiIOTiff::setReadAdvice(true); });
+        Sipi::SipiIOTiff::setReadAdvice(false);
+        plain_ms = time_ms([&]() { read_tiles(plain_img); });
+    }
+    double advised_ms = time_ms([&]() { read_tiles(advised_img); });
+    print_timing("TIFF tiles", plain_ms, advised_ms);
+    EXPECT_TRUE(plain_img == advised_img);
+}
+
+// getDim of all images of a directory: codec libraries against the header parsers. The directory
+// (e.g. the master files of a repository) can be given with the environment variable SIPI_BENCH_CORPUS.
+TEST(SipiimageBenchmark, GetDim)
+{
+    const char *bench_corpus = std::getenv("SIPI_BENCH_CORPUS");
+    std::string corpus = (bench_corpus != nullptr) ? bench_corpus : "../../../../test/_test_data/images/unit";
+    const int nrounds = 10;
+
+    std::vector<std::string> paths;
+    DIR *dir = opendir(corpus.c_str());
+    ASSERT_NE(dir, nullptr);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name = entry->d_name;
+        if ((name[0] == '.') || (name[0] == '_')) continue; // skip the output of the other tests
+        Sipi::SipiImage img;
+        try {
+            img.getDim(corpus + "/" + name);
+            paths.push_back(corpus + "/" + name);
+        } catch (Sipi::SipiImageError &err) {
+            // not an image
+        }
+    }
+    closedir(dir);
+    ASSERT_FALSE(paths.empty());
+
+    std::vector<Sipi::SipiImgInfo> reference_infos(paths.size());
+    std::vector<Sipi::SipiImgInfo> header_infos(paths.size());
+    Sipi::SipiImage img;
+
+    ScopedRestore restore([]() { Sipi::SipiHeaderReader::setEnabled(true); });
+    Sipi::SipiHeaderReader::setEnabled(false);
+    double reference_ms = time_ms([&]() {
+        for (int r = 0; r < nrounds; r++) {
+            for (size_t i = 0; i < paths.size(); i++) reference_infos[i] = img.getDim(paths[i]);
+        }
+    });
+    Sipi::SipiHeaderReader::setEnabled(true);
+    double header_ms = time_ms([&]() {
+        for (int r = 0; r < nrounds; r++) {
+            for (size_t i = 0; i < paths.size(); i++) header_infos[i] = img.getDim(paths[i]);
+        }
+    });
+    print_timing("getDim of " + std::to_string(paths.size()) + " files", reference_ms, header_ms);
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        EXPECT_EQ(reference_infos[i].width, header_infos[i].width) << paths[i];
+        EXPECT_EQ(reference_infos[i].height, header_infos[i].height) << paths[i];
+        EXPECT_EQ(reference_infos[i].clevels, header_infos[i].clevels) << paths[i];
+    }
+}
+
+#ifdef SIPI_OPENJPEG
+// JPEG2000 random tile access: Kakadu against OpenJPEG (region, resolution factor and threads).
+// A larger test image can be given with the environment variable SIPI_BENCH_IMAGE.
+TEST(SipiimageBenchmark, OpenJ2kTiles)
+{
+    const char *bench_image = std::getenv("SIPI_BENCH_IMAGE");
+    std::string srcpath = (bench_image != nullptr) ? bench_image : "../../../../test/_test_data/images/unit/lena512_upscaled.tif";
+    std::string path = "../../../../test/_test_data/images/unit/_bench_openj2k.jp2";
+    const size_t tile = 256;
+    const int ntiles = 200;
+
+    Sipi::SipiImage src;
+    ASSERT_NO_THROW(src.read(srcpath));
+    Sipi::SipiCompressionParams params = {{Sipi::J2K_Creversible, "yes"}, {Sipi::J2K_preset, "deepzoom"}};
+    ASSERT_NO_THROW(src.write("jpx", path, &params));
+
+    Sipi::SipiIOOpenJ2k openj2k;
+    const size_t tx = (src.getNx() + tile - 1) / tile;
+    const size_t ty = (src.getNy() + tile - 1) / tile;
+    auto read_tiles = [&](bool use_openj2k) {
+        srand(4711);
+        for (int i = 0; i < ntiles; i++) {
+            size_t x = (rand() % tx) * tile;
+            size_t y = (rand() % ty) * tile;
+            auto region = std::make_shared<Sipi::SipiRegion>((int) x, (int) y, tile, tile);
+            auto size = std::make_shared<Sipi::SipiSize>("128,");
+            Sipi::SipiImage img;
+            if (use_openj2k) {
+                openj2k.read(&img, path, 0, region, size);
+            } else {
+                img.read(path, 0, region, size);
+            }
+        }
+    };
+
+    double kakadu_ms = time_ms([&]() { read_tiles(false); });
+    double openj2k_ms = time_ms([&]() { read_tiles(true); });
+    print_timing("J2K tiles Kakadu (reference) against OpenJPEG", kakadu_ms, openj2k_ms);
+
+    Sipi::SipiImage kakadu_img;
+    Sipi::SipiImage openj2k_img;
+    ASSERT_NO_THROW(kakadu_img.read(path));
+    ASSERT_TRUE(openj2k.read(&openj2k_img, path));
+    EXPECT_TRUE(kakadu_img == openj2k_img);
+}
+#endif
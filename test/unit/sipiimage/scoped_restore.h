@@ -0,0 +1,25 @@
+#ifndef __sipi_test_scoped_restore_h
+#define __sipi_test_scoped_restore_h
+
+#include <functional>
+#include <utility>
+
+//
+// Restores a process wide setting (e.g. a codec option) when a test leaves its scope, also if an
+// assertion fails, so the setting does not leak into the following tests.
+//
+class ScopedRestore {
+private:
+    std::function<void()> restore;
+
+public:
+    explicit ScopedRestore(std::function<void()> restore_p) : restore(std::move(restore_p)) {}
+
+    ScopedRestore(const ScopedRestore &) = delete;
+
+    ScopedRestore &operator=(const ScopedRestore &) = delete;
+
+    ~ScopedRestore() { restore(); }
+};
+
+#endif
@@ -1,6 +1,26 @@
 #include "gtest/gtest.h"
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <utime.h>
 
 #include "../../../include/SipiImage.h"
+#include "../../../include/SipiWatermarkCache.h"
+#include "../../../include/formats/SipiIOJ2k.h"
+#include "../../../include/formats/SipiIOJpeg.h"
+#include "../../../include/formats/SipiIOPng.h"
+#include "../../../include/formats/SipiHeaderReader.h"
+#include "../../../include/formats/SipiIOPdf.h"
+#include "scoped_restore.h"
+
+#include "kdu_params.h"
+#include "kdu_compressed.h"
+#include "jp2.h"
+#include "jpx.h"
+#ifdef SIPI_OPENJPEG
+#include "../../../include/formats/SipiIOOpenJ2k.h"
+#endif
 
 //small function to check if file exist
 inline bool exists_file(const std::string &name) {
@@ -17,6 +37,28 @@ inline bool image_identical(const std::string &name1, const std::string &name2)
     return (img1 == img2);
 }
 
+// mean of the absolute differences of the samples of two 8 bit images of the same size
+inline double mean_difference(Sipi::SipiImage &img1, Sipi::SipiImage &img2) {
+    size_t n = img1.getNx() * img1.getNy() * img1.getNc();
+    const unsigned char *p1 = img1.getPixels();
+    const unsigned char *p2 = img2.getPixels();
+    double sum = 0.;
+    for (size_t i = 0; i < n; i++) sum += std::abs((int) p1[i] - (int) p2[i]);
+    return sum / (double) n;
+}
+
+// sets the samples of an image created with the SipiImage(nx, ny, nc, bps, photo) constructor
+template<typename T>
+inline void set_samples(Sipi::SipiImage &img, const std::vector<T> &samples) {
+    memcpy(const_cast<unsigned char *>(img.getPixels()), samples.data(), samples.size() * sizeof(T));
+}
+
+template<typename T>
+inline std::vector<T> get_samples(Sipi::SipiImage &img) {
+    const T *p = reinterpret_cast<const T *>(img.getPixels());
+    return std::vector<T>(p, p + img.getNx() * img.getNy() * img.getNc());
+}
+
 std::string leavesSmallWithAlpha = "../../../../test/_test_data/images/knora/Leaves-small-alpha.tif";
 std::string leavesSmallNoAlpha = "../../../../test/_test_data/images/knora/Leaves-small-no-alpha.tif";
 std::string png16bit = "../../../../test/_test_data/images/knora/png_16bit.png";
@@ -26,6 +68,11 @@ std::string cmyk = "../../../../test/_test_data/images/unit/cmyk.tif";
 std::string cielab16 = "../../../../test/_test_data/images/unit/CIELab16.tif";
 std::string palette = "../../../../test/_test_data/images/unit/palette.tif";
 std::string grayicc = "../../../../test/_test_data/images/unit/gray_with_icc.jp2";
+std::string grayalpha = "../../../../test/_test_data/images/unit/gray_alpha.png";
+std::string lena512tif = "../../../../test/_test_data/images/unit/lena512.tif";
+std::string lena512jp2 = "../../../../test/_test_data/images/unit/lena512.jp2";
+std::string cvpdf = "../../../../test/_test_data/images/unit/CV+Pub_LukasRosenthaler.pdf";
+std::string bigpdf = "../../../../test/_test_data/images/unit/big.pdf";
 
 // Check if configuration file can be found
 TEST(Sipiimage, CheckIfTestImagesCanBeFound)
@@ -37,6 +84,7 @@ TEST(Sipiimage, CheckIfTestImagesCanBeFound)
     EXPECT_TRUE(exists_file(cmyk));
     EXPECT_TRUE(exists_file(palette));
     EXPECT_TRUE(exists_file(grayicc));
+    EXPECT_TRUE(exists_file(grayalpha));
 }
 
 TEST(Sipiimage, ImageComparison)
@@ -207,3 +255,680 @@ TEST(Sipiimage, CMYK_lossy_compression)
     ASSERT_NO_THROW(img.write("jpx", "../../../../test/_test_data/images/unit/_cmyk_lossy.jp2", &params));
     EXPECT_TRUE(image_identical("../../../../test/_test_data/images/unit/cmyk_lossy.jp2", "../../../../test/_test_data/images/unit/_cmyk_lossy.jp2"));
 }
+
+TEST(Sipiimage, RotateAndMirror)
+{
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(leaves8tif));
+    ASSERT_NO_THROW(img2.read(leaves8tif));
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(img2.rotate(90.));
+    }
+    EXPECT_TRUE(img1 == img2);
+    ASSERT_TRUE(img2.rotate(180., true));
+    ASSERT_TRUE(img2.rotate(180., true));
+    EXPECT_TRUE(img1 == img2);
+}
+
+TEST(Sipiimage, CachedColorTransform)
+{
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(cmyk));
+    ASSERT_NO_THROW(img2.read(cmyk));
+    ASSERT_NO_THROW(img1.convertToIcc(Sipi::SipiIcc(Sipi::icc_sRGB), 8));
+    size_t ntransforms = Sipi::SipiIccTransformCache::instance().size();
+    ASSERT_NO_THROW(img2.convertToIcc(Sipi::SipiIcc(Sipi::icc_sRGB), 8));
+    EXPECT_EQ(ntransforms, Sipi::SipiIccTransformCache::instance().size());
+    EXPECT_TRUE(img1 == img2);
+
+    // predefined profiles are identified by their type, copies keep the key of the original
+    Sipi::SipiIcc srgb(Sipi::icc_sRGB);
+    EXPECT_EQ(srgb.iccHash(), Sipi::SipiIcc(srgb).iccHash());
+    EXPECT_NE(srgb.iccHash(), Sipi::SipiIcc(Sipi::icc_AdobeRGB).iccHash());
+
+    // sRGB to sRGB at the same bit depth leaves the pixels untouched
+    ASSERT_NO_THROW(img2.convertToIcc(Sipi::SipiIcc(Sipi::icc_sRGB), 8));
+    EXPECT_TRUE(img1 == img2);
+}
+
+// The watermark has the size of the images, thus each pixel is blended with the watermark value at the same position
+TEST(Sipiimage, RemoveChannel)
+{
+    // 8 bit RGBA: the channels behind the removed one move down
+    Sipi::SipiImage img1(2, 1, 4, 8, Sipi::RGB);
+    set_samples<unsigned char>(img1, {10, 20, 30, 40, 50, 60, 70, 80});
+    ASSERT_NO_THROW(img1.removeChan(1));
+    EXPECT_EQ(img1.getNc(), 3);
+    EXPECT_EQ(get_samples<unsigned char>(img1), std::vector<unsigned char>({10, 30, 40, 50, 70, 80}));
+
+    // 16 bit RGBA without the alpha channel
+    Sipi::SipiImage img2(2, 1, 4, 16, Sipi::RGB);
+    set_samples<unsigned short>(img2, {1000, 2000, 3000, 4000, 50000, 60000, 65535, 0});
+    ASSERT_NO_THROW(img2.removeChan(3));
+    EXPECT_EQ(img2.getNc(), 3);
+    EXPECT_EQ(get_samples<unsigned short>(img2), std::vector<unsigned short>({1000, 2000, 3000, 50000, 60000, 65535}));
+
+    // 5 channels use the kernel with the channel count given at runtime
+    Sipi::SipiImage img3(1, 2, 5, 8, Sipi::SEPARATED);
+    set_samples<unsigned char>(img3, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    ASSERT_NO_THROW(img3.removeChan(0));
+    EXPECT_EQ(img3.getNc(), 4);
+    EXPECT_EQ(get_samples<unsigned char>(img3), std::vector<unsigned char>({2, 3, 4, 5, 7, 8, 9, 10}));
+}
+
+TEST(Sipiimage, YCbCrConversion)
+{
+    // the samples are in the order Cr, Cb, Y; the expected values are
+    // R = Y + 1.402 Cr, G = Y - 0.34414 Cb - 0.71414 Cr, B = Y + 1.772 Cb (Cb and Cr relative to the mid value)
+    Sipi::SipiImage img1(3, 1, 3, 8, Sipi::YCBCR);
+    set_samples<unsigned char>(img1, {128, 128, 128, 178, 128, 100, 228, 28, 200});
+    ASSERT_NO_THROW(img1.convertYCC2RGB());
+    EXPECT_EQ(get_samples<unsigned char>(img1), std::vector<unsigned char>({128, 128, 128, 170, 64, 100, 255, 163, 23}));
+
+    // 16 bit: the mid value is 32768, values out of range are clamped
+    Sipi::SipiImage img2(5, 1, 3, 16, Sipi::YCBCR);
+    set_samples<unsigned short>(img2, {32768, 32768, 32768,
+                                       42768, 32768, 10000,
+                                       65535, 32768, 60000,
+                                       20000, 50000, 20000,
+                                       32768, 0, 5000});
+    ASSERT_NO_THROW(img2.convertYCC2RGB());
+    EXPECT_EQ(get_samples<unsigned short>(img2), std::vector<unsigned short>({32768, 32768, 32768,
+                                                                              24020, 2859, 10000,
+                                                                              65535, 36600, 60000,
+                                                                              2099, 23188, 50535,
+                                                                              5000, 16277, 0}));
+
+    // channels beyond the third are copied unchanged
+    Sipi::SipiImage img3(1, 1, 4, 16, Sipi::YCBCR);
+    set_samples<unsigned short>(img3, {42768, 32768, 10000, 12345});
+    ASSERT_NO_THROW(img3.convertYCC2RGB());
+    EXPECT_EQ(get_samples<unsigned short>(img3), std::vector<unsigned short>({24020, 2859, 10000, 12345}));
+}
+
+TEST(Sipiimage, Watermark)
+{
+    std::string wmfile = "../../../../test/_test_data/images/unit/_watermark.tif";
+    auto copy_file = [](const std::string &from, const std::string &to) {
+        std::ifstream src(from, std::ios::binary);
+        std::ofstream dst(to, std::ios::binary | std::ios::trunc);
+        dst << src.rdbuf();
+    };
+    copy_file(lena512tif, wmfile);
+    struct utimbuf times = {1000000000, 1000000000};
+    ASSERT_EQ(utime(wmfile.c_str(), &times), 0);
+
+    Sipi::SipiImage wm;
+    ASSERT_NO_THROW(wm.read(lena512tif));
+    ASSERT_EQ(wm.getNc(), 1);
+    const unsigned char *wmpix = wm.getPixels();
+
+    // 8 bit: round(v * (1 + val / 2550) + val / 10)
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(lena512tif));
+    ASSERT_NO_THROW(img2.read(lena512tif));
+    ASSERT_TRUE(img2.add_watermark(wmfile));
+    const unsigned char *pix1 = img1.getPixels();
+    const unsigned char *pix2 = img2.getPixels();
+    size_t n_wrong = 0;
+    for (size_t i = 0; i < img1.getNx() * img1.getNy(); i++) {
+        unsigned int v = pix1[i], val = wmpix[i];
+        double expected = std::min(v + std::floor(val * (v + 255) / 2550. + 0.5), 255.);
+        if (pix2[i] != (unsigned char) expected) n_wrong++;
+    }
+    EXPECT_EQ(n_wrong, (size_t) 0);
+
+    // 16 bit: the same blend on samples scaled to [0, 1]
+    Sipi::SipiImage img3;
+    Sipi::SipiImage img4;
+    ASSERT_NO_THROW(img3.read(png16bit));
+    ASSERT_TRUE(img3.scale(wm.getNx(), wm.getNy()));
+    ASSERT_EQ(img3.getBps(), 16);
+    img4 = img3;
+    ASSERT_TRUE(img4.add_watermark(wmfile));
+    const unsigned short *pix3 = reinterpret_cast<const unsigned short *>(img3.getPixels());
+    const unsigned short *pix4 = reinterpret_cast<const unsigned short *>(img4.getPixels());
+    size_t nc = img3.getNc();
+    int max_difference = 0;
+    for (size_t i = 0; i < img3.getNx() * img3.getNy() * nc; i++) {
+        unsigned int val = wmpix[i / nc];
+        double nval = (pix3[i] / 65535.) * (1. + val / 655350.) + val / 352500.;
+        int expected = (nval > 1.) ? 65535 : (int) std::floor(nval * 65535. + 0.5);
+        max_difference = std::max(max_difference, std::abs(expected - (int) pix4[i]));
+    }
+    EXPECT_LE(max_difference, 1); // the blend is calculated in single precision
+
+    // the resampled watermark is cached until the watermark file changes
+    Sipi::SipiWatermarkCache &cache = Sipi::SipiWatermarkCache::instance();
+    Sipi::SipiWatermarkCache::Mask mask1 = cache.get(wmfile, 100, 80);
+    Sipi::SipiWatermarkCache::Mask mask2 = cache.get(wmfile, 100, 80);
+    EXPECT_EQ(mask1, mask2);
+    EXPECT_EQ(mask1->size(), 100 * 80);
+
+    Sipi::SipiImage rotated;
+    ASSERT_NO_THROW(rotated.read(lena512tif));
+    ASSERT_TRUE(rotated.rotate(90));
+    ASSERT_NO_THROW(rotated.write("tif", wmfile));
+    times = {1000000010, 1000000010};
+    ASSERT_EQ(utime(wmfile.c_str(), &times), 0);
+    Sipi::SipiWatermarkCache::Mask mask3 = cache.get(wmfile, 100, 80);
+    EXPECT_NE(mask1, mask3);
+    EXPECT_FALSE(*mask1 == *mask3);
+    EXPECT_EQ(mask3, cache.get(wmfile, 100, 80));
+}
+
+TEST(Sipiimage, TiffRegionRead)
+{
+    std::shared_ptr<Sipi::SipiRegion> region = std::make_shared<Sipi::SipiRegion>(37, 101, 200, 150);
+    std::shared_ptr<Sipi::SipiSize> size;
+
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(lena512tif, 0, region, size));
+    ASSERT_NO_THROW(img2.read(lena512tif));
+    ASSERT_TRUE(img2.crop(37, 101, 200, 150));
+    EXPECT_TRUE(img1 == img2);
+}
+
+TEST(Sipiimage, JpegRegionRead)
+{
+    std::string lena512jpg = "../../../../test/_test_data/images/unit/_lena512.jpg";
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.write("jpg", lena512jpg));
+
+    std::shared_ptr<Sipi::SipiRegion> region = std::make_shared<Sipi::SipiRegion>(37, 101, 200, 150);
+    std::shared_ptr<Sipi::SipiSize> size;
+
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(lena512jpg, 0, region, size));
+    EXPECT_EQ(img1.getNx(), 200);
+    EXPECT_EQ(img1.getNy(), 150);
+    ASSERT_NO_THROW(img2.read(lena512jpg));
+    ASSERT_TRUE(img2.crop(37, 101, 200, 150));
+    EXPECT_TRUE(img1 == img2);
+}
+
+TEST(Sipiimage, JpegProfiles)
+{
+    EXPECT_THROW(Sipi::SipiIOJpeg::setProfilePolicy("512"), Sipi::SipiImageError);
+    EXPECT_THROW(Sipi::SipiIOJpeg::setProfilePolicy("512:fast"), Sipi::SipiImageError);
+    ASSERT_NO_THROW(Sipi::SipiIOJpeg::setProfilePolicy("256:tile, 1024:optimized"));
+    ASSERT_NO_THROW(Sipi::SipiIOJpeg::setProfilePolicy(""));
+
+    std::string progressivejpg = "../../../../test/_test_data/images/unit/_lena512_progressive.jpg";
+    std::string tilejpg = "../../../../test/_test_data/images/unit/_lena512_tile.jpg";
+    Sipi::SipiCompressionParams progressive_params = {{Sipi::JPEG_QUALITY, "80"}, {Sipi::JPEG_profile, "progressive"}};
+    Sipi::SipiCompressionParams tile_params = {{Sipi::JPEG_QUALITY, "80"}, {Sipi::JPEG_profile, "tile"}};
+
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.write("jpg", progressivejpg, &progressive_params));
+    ASSERT_NO_THROW(img.write("jpg", tilejpg, &tile_params));
+
+    // same quantization, so both decode to the same pixels
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(progressivejpg));
+    ASSERT_NO_THROW(img2.read(tilejpg));
+    EXPECT_TRUE(img1 == img2);
+}
+
+TEST(Sipiimage, JpegLosslessRotation)
+{
+    std::string lena512jpg = "../../../../test/_test_data/images/unit/_lena512_rot0.jpg";
+    std::string rot90jpg = "../../../../test/_test_data/images/unit/_lena512_rot90.jpg";
+    std::string rot360jpg = "../../../../test/_test_data/images/unit/_lena512_rot360.jpg";
+    std::string croppedjpg = "../../../../test/_test_data/images/unit/_lena500x300.jpg";
+
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.convertToIcc(Sipi::SipiIcc(Sipi::icc_sRGB), 8));
+    ASSERT_NO_THROW(img.write("jpg", lena512jpg));
+    ASSERT_TRUE(img.crop(0, 0, 500, 300));
+    ASSERT_NO_THROW(img.write("jpg", croppedjpg));
+
+    // not a multiple of the MCU size
+    EXPECT_FALSE(Sipi::SipiIOJpeg::isLosslessRotatable(croppedjpg));
+    EXPECT_FALSE(Sipi::SipiIOJpeg::rotateLossless(croppedjpg, 90, rot90jpg));
+
+    // rotating back gives the same coefficients
+    ASSERT_TRUE(Sipi::SipiIOJpeg::isLosslessRotatable(lena512jpg));
+    ASSERT_TRUE(Sipi::SipiIOJpeg::rotateLossless(lena512jpg, 90, rot90jpg));
+    ASSERT_TRUE(Sipi::SipiIOJpeg::rotateLossless(rot90jpg, 270, rot360jpg));
+    EXPECT_TRUE(image_identical(lena512jpg, rot360jpg));
+
+    ASSERT_TRUE(Sipi::SipiIOJpeg::rotateLossless(lena512jpg, 180, rot90jpg));
+    ASSERT_TRUE(Sipi::SipiIOJpeg::rotateLossless(rot90jpg, 180, rot360jpg));
+    EXPECT_TRUE(image_identical(lena512jpg, rot360jpg));
+
+    // a single rotation by 90 degrees decodes to the rotated image (the quantization tables are transposed too)
+    ASSERT_TRUE(Sipi::SipiIOJpeg::rotateLossless(lena512jpg, 90, rot90jpg));
+    Sipi::SipiImage rotated;
+    Sipi::SipiImage reference;
+    ASSERT_NO_THROW(rotated.read(rot90jpg));
+    ASSERT_NO_THROW(reference.read(lena512jpg));
+    ASSERT_TRUE(reference.rotate(90.));
+    ASSERT_EQ(rotated.getNx(), reference.getNx());
+    ASSERT_EQ(rotated.getNy(), reference.getNy());
+    ASSERT_EQ(rotated.getNc(), reference.getNc());
+    EXPECT_LE(mean_difference(rotated, reference), 1.0);
+}
+
+TEST(Sipiimage, MisnamedFileRead)
+{
+    // a PNG file with a TIFF extension is read by the PNG reader
+    std::string misnamedtif = "../../../../test/_test_data/images/unit/_lena512_png.tif";
+
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.write("png", misnamedtif));
+
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.read(misnamedtif));
+    EXPECT_TRUE(img == img1);
+
+    Sipi::SipiImgInfo info = img1.getDim(misnamedtif);
+    EXPECT_EQ(info.internalmimetype, "image/png");
+    EXPECT_EQ(info.width, 512);
+    EXPECT_EQ(info.height, 512);
+}
+
+TEST(Sipiimage, WebpWrite)
+{
+    std::string losslesswebp = "../../../../test/_test_data/images/unit/_lena512_lossless.webp";
+    std::string lossywebp = "../../../../test/_test_data/images/unit/_lena512_lossy.webp";
+    std::string alphawebp = "../../../../test/_test_data/images/unit/_leaves_alpha.webp";
+    Sipi::SipiCompressionParams lossless_params = {{Sipi::WEBP_lossless, "yes"}};
+    Sipi::SipiCompressionParams lossy_params = {{Sipi::WEBP_quality, "60"}};
+
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.write("webp", losslesswebp, &lossless_params));
+    ASSERT_NO_THROW(img.write("webp", lossywebp, &lossy_params));
+
+    // the image has been converted to 8 bit sRGB by writing it
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.read(losslesswebp));
+    EXPECT_TRUE(img == img1);
+
+    Sipi::SipiImgInfo info = img1.getDim(lossywebp);
+    EXPECT_EQ(info.success, Sipi::SipiImgInfo::DIMS);
+    EXPECT_EQ(info.width, 512);
+    EXPECT_EQ(info.height, 512);
+
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img2.read(leavesSmallWithAlpha));
+    ASSERT_NO_THROW(img2.write("webp", alphawebp));
+    Sipi::SipiImage img3;
+    ASSERT_NO_THROW(img3.read(alphawebp));
+    EXPECT_EQ(img3.getNc(), 4);
+    EXPECT_EQ(img3.getNalpha(), 1);
+}
+
+TEST(Sipiimage, TiffPyramidWrite)
+{
+    std::string pyramidtif = "../../../../test/_test_data/images/unit/_lena512_pyramid.tif";
+    Sipi::SipiCompressionParams comp_params = {{Sipi::TIFF_compression, "deflate"},
+                                               {Sipi::TIFF_tile, "128"},
+                                               {Sipi::TIFF_pyramid, "yes"}};
+
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.read(lena512tif));
+    ASSERT_NO_THROW(img1.write("tif", pyramidtif, &comp_params));
+
+    Sipi::SipiImage img2;
+    Sipi::SipiImgInfo info = img2.getDim(pyramidtif);
+    EXPECT_EQ(info.tile_width, 128);
+    EXPECT_EQ(info.tile_height, 128);
+    EXPECT_EQ(info.clevels, 3); // 512, 256 and 128
+
+    ASSERT_NO_THROW(img2.read(pyramidtif));
+    EXPECT_TRUE(img1 == img2);
+
+    std::shared_ptr<Sipi::SipiRegion> region;
+    std::shared_ptr<Sipi::SipiSize> size = std::make_shared<Sipi::SipiSize>("128,");
+    Sipi::SipiImage img3;
+    ASSERT_NO_THROW(img3.read(pyramidtif, 0, region, size));
+    EXPECT_EQ(img3.getNx(), 128);
+    EXPECT_EQ(img3.getNy(), 128);
+}
+
+// the header parsers report the same as the codec libraries
+TEST(Sipiimage, HeaderGetDim)
+{
+    std::string pyramidtif = "../../../../test/_test_data/images/unit/_lena512_pyramid_header.tif";
+    Sipi::SipiCompressionParams comp_params = {{Sipi::TIFF_tile, "128"}, {Sipi::TIFF_pyramid, "yes"}};
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(lena512tif));
+    ASSERT_NO_THROW(img.write("tif", pyramidtif, &comp_params));
+
+    ScopedRestore restore([]() { Sipi::SipiHeaderReader::setEnabled(true); });
+    for (auto &path : {lena512tif, lena512jp2, cielab, cmyk, palette, grayicc, leaves8tif, pyramidtif}) {
+        Sipi::SipiHeaderReader::setEnabled(false);
+        Sipi::SipiImgInfo reference = img.getDim(path);
+        Sipi::SipiHeaderReader::setEnabled(true);
+        Sipi::SipiImgInfo info = img.getDim(path);
+        EXPECT_EQ(info.success, reference.success) << path;
+        EXPECT_EQ(info.width, reference.width) << path;
+        EXPECT_EQ(info.height, reference.height) << path;
+        EXPECT_EQ(info.tile_width, reference.tile_width) << path;
+        EXPECT_EQ(info.tile_height, reference.tile_height) << path;
+        EXPECT_EQ(info.clevels, reference.clevels) << path;
+        EXPECT_EQ(info.origname, reference.origname) << path;
+    }
+}
+
+TEST(Sipiimage, J2kStripRead)
+{
+    std::string stripspng = "../../../../test/_test_data/images/unit/_lena512_strips.png";
+    std::shared_ptr<Sipi::SipiRegion> region = std::make_shared<Sipi::SipiRegion>(37, 101, 200, 150);
+    std::shared_ptr<Sipi::SipiSize> size;
+
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.readStrips(lena512jp2, 0, region, size));
+    EXPECT_EQ(img1.getNx(), 200);
+    EXPECT_EQ(img1.getNy(), 150);
+    ASSERT_NO_THROW(img1.write("png", stripspng));
+
+    Sipi::SipiImage img2;
+    Sipi::SipiImage img3;
+    ASSERT_NO_THROW(img2.read(lena512jp2, 0, region, size));
+    ASSERT_NO_THROW(img3.read(stripspng));
+    EXPECT_TRUE(img2 == img3);
+
+    Sipi::SipiImage img4;
+    ASSERT_NO_THROW(img4.readStrips(lena512jp2, 0, region, size));
+    ASSERT_NO_THROW(img4.loadStrips());
+    EXPECT_TRUE(img2 == img4);
+
+    // the strips can be delivered only once, thus an image with undecoded strips can't be copied or compared
+    Sipi::SipiImage img5;
+    ASSERT_NO_THROW(img5.readStrips(lena512jp2, 0, region, size));
+    EXPECT_THROW(Sipi::SipiImage img6(img5), Sipi::SipiImageError);
+    EXPECT_THROW(img2 == img5, Sipi::SipiImageError);
+    ASSERT_NO_THROW(img5.loadStrips());
+    Sipi::SipiImage img7(img5);
+    EXPECT_TRUE(img2 == img7);
+}
+
+TEST(Sipiimage, J2kLayerPolicy)
+{
+    ScopedRestore restore([]() { Sipi::SipiIOJ2k::setLayerPolicy(""); });
+    EXPECT_THROW(Sipi::SipiIOJ2k::setLayerPolicy("256"), Sipi::SipiImageError);
+    EXPECT_THROW(Sipi::SipiIOJ2k::setLayerPolicy("256:0"), Sipi::SipiImageError);
+    EXPECT_THROW(Sipi::SipiIOJ2k::setLayerPolicy("abc:25"), Sipi::SipiImageError);
+    ASSERT_NO_THROW(Sipi::SipiIOJ2k::setLayerPolicy("128:1%, 1024:50%"));
+
+    std::shared_ptr<Sipi::SipiRegion> region;
+    std::shared_ptr<Sipi::SipiSize> size = std::make_shared<Sipi::SipiSize>("128,");
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.read(lena512jp2, 0, region, size));
+    EXPECT_EQ(img1.getNx(), 128);
+    EXPECT_EQ(img1.getNy(), 128);
+
+    // larger than all entries: all layers are decoded
+    Sipi::SipiImage img2;
+    Sipi::SipiImage img3;
+    ASSERT_NO_THROW(img2.read(lena512jp2));
+    ASSERT_NO_THROW(Sipi::SipiIOJ2k::setLayerPolicy(""));
+    ASSERT_NO_THROW(img3.read(lena512jp2));
+    EXPECT_TRUE(img2 == img3);
+}
+
+// reads the tile size and the precinct size of the highest resolution back from a JPEG2000 main header
+static void read_j2k_layout(const std::string &path, int &tw, int &th, int &pw, int &ph) {
+    kdu_supp::jp2_family_src jp2_src;
+    kdu_supp::jpx_source jpx_in;
+    jp2_src.open(path.c_str());
+    jpx_in.open(&jp2_src, false);
+    kdu_core::kdu_codestream codestream;
+    codestream.create(jpx_in.access_codestream(0).open_stream());
+    kdu_core::siz_params *siz = codestream.access_siz();
+    siz->get(Stiles, 0, 0, th);
+    siz->get(Stiles, 0, 1, tw);
+    kdu_core::kdu_params *cod = siz->access_cluster(COD_params);
+    cod->get(Cprecincts, 0, 0, ph);
+    cod->get(Cprecincts, 0, 1, pw);
+    codestream.destroy();
+    jpx_in.close();
+    jp2_src.close();
+}
+
+// the deepzoom preset splits each resolution into 256x256 precincts, which getDim offers as IIIF tiles
+TEST(Sipiimage, J2kDeepzoomPreset)
+{
+    std::string upscaled = "../../../../test/_test_data/images/unit/lena512_upscaled.tif";
+    std::string untiledjp2 = "../../../../test/_test_data/images/unit/_deepzoom_untiled.jp2";
+    std::string tiledjp2 = "../../../../test/_test_data/images/unit/_deepzoom_tiled.jp2";
+    Sipi::SipiCompressionParams untiled_params = {{Sipi::J2K_preset, "deepzoom"}};
+    Sipi::SipiCompressionParams tiled_params = {{Sipi::J2K_preset, "deepzoom"}, {Sipi::J2K_Stiles, "{512,512}"}};
+    Sipi::SipiImage img;
+    ASSERT_NO_THROW(img.read(upscaled));
+    ASSERT_EQ(img.getNx(), 1000);
+    ASSERT_EQ(img.getNy(), 1000);
+    ASSERT_NO_THROW(img.write("jpx", untiledjp2, &untiled_params));
+    ASSERT_NO_THROW(img.write("jpx", tiledjp2, &tiled_params));
+
+    int tw, th, pw, ph;
+    read_j2k_layout(untiledjp2, tw, th, pw, ph);
+    EXPECT_EQ(tw, 1000);
+    EXPECT_EQ(th, 1000);
+    EXPECT_EQ(pw, 256);
+    EXPECT_EQ(ph, 256);
+    Sipi::SipiImgInfo info = img.getDim(untiledjp2);
+    EXPECT_EQ(info.tile_width, 256);
+    EXPECT_EQ(info.tile_height, 256);
+
+    read_j2k_layout(tiledjp2, tw, th, pw, ph);
+    EXPECT_EQ(tw, 512);
+    EXPECT_EQ(th, 512);
+    EXPECT_EQ(pw, 256);
+    EXPECT_EQ(ph, 256);
+    info = img.getDim(tiledjp2);
+    EXPECT_EQ(info.tile_width, 256);
+    EXPECT_EQ(info.tile_height, 256);
+
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(untiledjp2));
+    ASSERT_NO_THROW(img2.read(tiledjp2));
+    EXPECT_EQ(img1.getNx(), 1000);
+    EXPECT_EQ(img2.getNx(), 1000);
+}
+
+// Parallel PNG encoding: the images are large enough to be split into several bands of rows (one per core)
+TEST(Sipiimage, PngParallelWrite)
+{
+    EXPECT_THROW(Sipi::SipiIOPng::setPresetPolicy("256"), Sipi::SipiImageError);
+    EXPECT_THROW(Sipi::SipiIOPng::setPresetPolicy("256:tiny"), Sipi::SipiImageError);
+    ASSERT_NO_THROW(Sipi::SipiIOPng::setPresetPolicy("256:fast, 1024:balanced"));
+    ASSERT_NO_THROW(Sipi::SipiIOPng::setPresetPolicy(""));
+
+    Sipi::SipiCompressionParams parallel_params = {{Sipi::PNG_parallel, "yes"}};
+    Sipi::SipiCompressionParams serial_params = {{Sipi::PNG_parallel, "no"}};
+
+    // 16 bit RGB with alpha channel
+    std::string parallel16 = "../../../../test/_test_data/images/unit/_png16_parallel.png";
+    std::string serial16 = "../../../../test/_test_data/images/unit/_png16_serial.png";
+    Sipi::SipiImage img1;
+    ASSERT_NO_THROW(img1.read(png16bit));
+    ASSERT_TRUE(img1.scale(5 * img1.getNx(), 5 * img1.getNy()));
+    ASSERT_EQ(img1.getBps(), 16);
+    ASSERT_NO_THROW(img1.write("png", parallel16, &parallel_params));
+    ASSERT_NO_THROW(img1.write("png", serial16, &serial_params));
+
+    Sipi::SipiImage img2;
+    Sipi::SipiImage img3;
+    ASSERT_NO_THROW(img2.read(parallel16));
+    ASSERT_NO_THROW(img3.read(serial16));
+    EXPECT_EQ(img2.getBps(), 16);
+    EXPECT_EQ(img2.getNalpha(), 1);
+    EXPECT_TRUE(img1 == img2);
+    EXPECT_TRUE(img2 == img3);
+
+    // 8 bit grey value with alpha channel
+    std::string parallelga = "../../../../test/_test_data/images/unit/_gray_alpha_parallel.png";
+    std::string serialga = "../../../../test/_test_data/images/unit/_gray_alpha_serial.png";
+    Sipi::SipiImage img4;
+    ASSERT_NO_THROW(img4.read(grayalpha));
+    ASSERT_EQ(img4.getNc(), 2);
+    ASSERT_EQ(img4.getNalpha(), 1);
+    ASSERT_NO_THROW(img4.write("png", parallelga, &parallel_params));
+    ASSERT_NO_THROW(img4.write("png", serialga, &serial_params));
+
+    Sipi::SipiImage img5;
+    Sipi::SipiImage img6;
+    ASSERT_NO_THROW(img5.read(parallelga));
+    ASSERT_NO_THROW(img6.read(serialga));
+    EXPECT_EQ(img5.getNc(), 2);
+    EXPECT_EQ(img5.getNalpha(), 1);
+    EXPECT_TRUE(img4 == img5);
+    EXPECT_TRUE(img5 == img6);
+}
+
+TEST(Sipiimage, EmbeddedThumbnail)
+{
+    // Leaves.jpg (2591x2572, Adobe RGB) contains an EXIF thumbnail of 256x254 pixels. A copy without
+    // the ICC profile (APP2 segments) is written to test the untagged case.
+    std::string leavesjpg = "../../../../test/_test_data/images/knora/Leaves.jpg";
+    std::string untaggedjpg = "../../../../test/_test_data/images/unit/_leaves_untagged.jpg";
+    {
+        std::ifstream src(leavesjpg, std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(src)), std::istreambuf_iterator<char>());
+        std::ofstream dst(untaggedjpg, std::ios::binary | std::ios::trunc);
+        size_t pos = 2;
+        dst.write((const char *) data.data(), 2);
+        while ((pos + 4 <= data.size()) && (data[pos] == 0xFF) && (data[pos + 1] != 0xDA)) {
+            size_t seglen = 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+            if (data[pos + 1] != 0xE2) dst.write((const char *) data.data() + pos, seglen);
+            pos += seglen;
+        }
+        dst.write((const char *) data.data() + pos, data.size() - pos); // SOS and entropy coded data
+    }
+
+    std::shared_ptr<Sipi::SipiRegion> region;
+    std::shared_ptr<Sipi::SipiSize> small = std::make_shared<Sipi::SipiSize>("!128,128");
+    std::shared_ptr<Sipi::SipiSize> large = std::make_shared<Sipi::SipiSize>("!512,512");
+
+    Sipi::SipiImage img1, img2, img3, img4, img5, img6;
+    ScopedRestore restore([]() { Sipi::SipiIOJpeg::setEmbeddedThumbnails(false); });
+    Sipi::SipiIOJpeg::setEmbeddedThumbnails(false);
+    ASSERT_NO_THROW(img1.read(untaggedjpg, 0, region, small));
+    ASSERT_NO_THROW(img3.read(untaggedjpg, 0, region, large));
+    ASSERT_NO_THROW(img5.read(leavesjpg, 0, region, small));
+    Sipi::SipiIOJpeg::setEmbeddedThumbnails(true);
+    ASSERT_NO_THROW(img2.read(untaggedjpg, 0, region, small));
+    ASSERT_NO_THROW(img4.read(untaggedjpg, 0, region, large));
+    ASSERT_NO_THROW(img6.read(leavesjpg, 0, region, small));
+
+    // the small image is scaled from the thumbnail, the large one is still decoded from the image
+    EXPECT_EQ(img2.getNx(), img1.getNx());
+    EXPECT_EQ(img2.getNy(), img1.getNy());
+    EXPECT_EQ(img2.getNc(), img1.getNc());
+    EXPECT_FALSE(img1 == img2);
+    EXPECT_TRUE(img3 == img4);
+
+    // the sRGB thumbnail does not match the Adobe RGB profile of the image, which is decoded
+    EXPECT_TRUE(img5 == img6);
+}
+
+TEST(Sipiimage, PdfRegionRead)
+{
+    Sipi::SipiIOPdf pdfio;
+    Sipi::SipiImgInfo info = pdfio.getDim(cvpdf, 3);
+    ASSERT_EQ(info.success, Sipi::SipiImgInfo::DIMS);
+    ASSERT_GE(info.width, 1200);
+    ASSERT_GE(info.height, 1000);
+
+    // the region is given in pixels at 300 DPI and rendered directly at a quarter of the resolution
+    std::shared_ptr<Sipi::SipiRegion> region = std::make_shared<Sipi::SipiRegion>(400, 400, 800, 600);
+    std::shared_ptr<Sipi::SipiSize> size = std::make_shared<Sipi::SipiSize>("200,");
+    Sipi::SipiImage img1;
+    ASSERT_TRUE(pdfio.read(&img1, cvpdf, 3, region, size));
+    EXPECT_EQ(img1.getNx(), 200);
+    EXPECT_EQ(img1.getNy(), 150);
+
+    // the same part of the whole page rendered at a quarter of the resolution
+    std::shared_ptr<Sipi::SipiRegion> full;
+    std::shared_ptr<Sipi::SipiSize> quarter = std::make_shared<Sipi::SipiSize>("pct:25");
+    Sipi::SipiImage img2;
+    ASSERT_TRUE(pdfio.read(&img2, cvpdf, 3, full, quarter));
+    ASSERT_TRUE(img2.crop(100, 100, 200, 150));
+    ASSERT_EQ(img1.getNc(), img2.getNc());
+    EXPECT_LE(mean_difference(img1, img2), 4.0); // the resolutions differ by the rounding of the page size
+}
+
+TEST(Sipiimage, PdfDocumentReload)
+{
+    std::string reloadpdf = "../../../../test/_test_data/images/unit/_reload.pdf";
+    auto copy_file = [](const std::string &from, const std::string &to) {
+        std::ifstream src(from, std::ios::binary);
+        std::ofstream dst(to, std::ios::binary | std::ios::trunc);
+        dst << src.rdbuf();
+    };
+
+    Sipi::SipiIOPdf pdfio;
+    Sipi::SipiImgInfo cvinfo = pdfio.getDim(cvpdf, 1);
+    Sipi::SipiImgInfo biginfo = pdfio.getDim(bigpdf, 1);
+    ASSERT_EQ(cvinfo.success, Sipi::SipiImgInfo::DIMS);
+    ASSERT_EQ(biginfo.success, Sipi::SipiImgInfo::DIMS);
+    ASSERT_TRUE((cvinfo.numpages != biginfo.numpages) || (cvinfo.width != biginfo.width) ||
+                (cvinfo.height != biginfo.height));
+
+    copy_file(cvpdf, reloadpdf);
+    struct utimbuf times = {1000000000, 1000000000};
+    ASSERT_EQ(utime(reloadpdf.c_str(), &times), 0);
+    Sipi::SipiImgInfo info = pdfio.getDim(reloadpdf, 1);
+    EXPECT_EQ(info.numpages, cvinfo.numpages);
+    EXPECT_EQ(info.width, cvinfo.width);
+    EXPECT_EQ(info.height, cvinfo.height);
+
+    // the cached document is replaced as soon as the modification time of the file changes
+    copy_file(bigpdf, reloadpdf);
+    times = {1000000010, 1000000010};
+    ASSERT_EQ(utime(reloadpdf.c_str(), &times), 0);
+    info = pdfio.getDim(reloadpdf, 1);
+    EXPECT_EQ(info.numpages, biginfo.numpages);
+    EXPECT_EQ(info.width, biginfo.width);
+    EXPECT_EQ(info.height, biginfo.height);
+
+    Sipi::SipiImage img;
+    std::shared_ptr<Sipi::SipiRegion> region;
+    std::shared_ptr<Sipi::SipiSize> size = std::make_shared<Sipi::SipiSize>("pct:10");
+    ASSERT_TRUE(pdfio.read(&img, reloadpdf, 1, region, size));
+    EXPECT_EQ(img.getNx(), (size_t) ceilf(biginfo.width * 10 / 100.F));
+}
+
+#ifdef SIPI_OPENJPEG
+TEST(Sipiimage, OpenJ2kRead)
+{
+    std::string reversiblejp2 = "../../../../test/_test_data/images/unit/_lena512_reversible.jp2";
+    Sipi::SipiImage src;
+    ASSERT_NO_THROW(src.read(lena512tif));
+    Sipi::SipiCompressionParams params = {{Sipi::J2K_Creversible, "yes"}, {Sipi::J2K_Stiles, "{128,128}"}};
+    ASSERT_NO_THROW(src.write("jpx", reversiblejp2, &params));
+
+    Sipi::SipiIOOpenJ2k openj2k;
+    Sipi::SipiImgInfo info = openj2k.getDim(reversiblejp2);
+    EXPECT_EQ(info.success, Sipi::SipiImgInfo::ALL);
+    EXPECT_EQ(info.width, 512);
+    EXPECT_EQ(info.height, 512);
+    EXPECT_EQ(info.tile_width, 128);
+
+    // lossless: region and reduced resolution are identical to the Kakadu decoder
+    std::shared_ptr<Sipi::SipiRegion> region = std::make_shared<Sipi::SipiRegion>(64, 96, 256, 128);
+    std::shared_ptr<Sipi::SipiSize> size = std::make_shared<Sipi::SipiSize>("128,");
+    Sipi::SipiImage img1;
+    Sipi::SipiImage img2;
+    ASSERT_NO_THROW(img1.read(reversiblejp2, 0, region, size));
+    ASSERT_TRUE(openj2k.read(&img2, reversiblejp2, 0, region, size));
+    EXPECT_EQ(img2.getNx(), 128);
+    EXPECT_EQ(img2.getNy(), 64);
+    EXPECT_TRUE(img1 == img2);
+}
+#endif